@@ -0,0 +1,202 @@
+/*
+ * base/cache_policy.h
+ * -------------------------------------------------------------------------
+ * Eviction/admission policies for hash_lru_cache_map.
+ * -------------------------------------------------------------------------
+ *
+ * Copyright (c) 2012, Tarick Bedeir.
+ * 
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef S3_BASE_CACHE_POLICY_H
+#define S3_BASE_CACHE_POLICY_H
+
+#include <stdint.h>
+
+#include <vector>
+
+namespace s3
+{
+  namespace base
+  {
+    // a policy tells hash_lru_cache_map how to split its entries between a
+    // "window" (plain LRU, where new entries go) and a "main" segmented LRU
+    // region (probation + protected), and whether an entry leaving the
+    // window should be let into the main region at the expense of the
+    // main region's eviction candidate.
+    //
+    // policies must provide:
+    //
+    //   WINDOW_PERCENT     share of entries kept in the window.  100 means
+    //                      the map is a plain LRU and the other members are
+    //                      never used.
+    //   PROTECTED_PERCENT  share of the main region kept in "protected".
+    //
+    //   void resize(size_t buckets)
+    //     called when the map's hash table grows.
+    //
+    //   void record(size_t hash)
+    //     called on every insert and every hit.
+    //
+    //   bool admit(size_t candidate_hash, size_t victim_hash)
+    //     true if the candidate (leaving the window) should replace the
+    //     victim (the oldest entry in the main region).
+
+    // plain LRU: everything lives in the window
+    class lru_policy
+    {
+    public:
+      enum
+      {
+        WINDOW_PERCENT = 100,
+        PROTECTED_PERCENT = 0
+      };
+
+      inline void resize(size_t) {}
+      inline void record(size_t) {}
+      inline bool admit(size_t, size_t) { return true; }
+    };
+
+    // W-TinyLFU: a small LRU window in front of a segmented LRU, with
+    // admission to the segmented LRU decided by comparing (approximate)
+    // access frequencies.  the frequencies come from a count-min sketch
+    // that's periodically halved, so that entries that were popular long
+    // ago don't stay in the cache forever.
+    //
+    // a one-off scan fills the window, and each scanned entry then loses
+    // to whatever it would displace in the main region, so the working set
+    // survives.
+    class tiny_lfu_policy
+    {
+    public:
+      enum
+      {
+        WINDOW_PERCENT = 1,
+        PROTECTED_PERCENT = 80
+      };
+
+      inline tiny_lfu_policy()
+        : _mask(0),
+          _additions(0),
+          _sample_size(0),
+          _admitted(0),
+          _rejected(0)
+      {
+      }
+
+      inline void resize(size_t buckets)
+      {
+        std::vector<uint8_t> old;
+        size_t old_width = _mask + 1;
+
+        // one counter per bucket per row, which is at least one per entry.
+        // a counter's index within its row is the hash masked to the row
+        // width, so each new counter starts with the count of the old one it
+        // splits from (an overestimate, as count-min estimates always are).
+        old.swap(_counters);
+        _counters.resize(buckets * ROWS, 0);
+        _mask = buckets - 1;
+        _sample_size = buckets * SAMPLE_FACTOR;
+
+        if (old.empty())
+          return;
+
+        for (int r = 0; r < ROWS; r++)
+          for (size_t i = 0; i < buckets; i++)
+            _counters[r * buckets + i] = old[r * old_width + (i & (old_width - 1))];
+      }
+
+      inline void record(size_t hash)
+      {
+        bool added = false;
+
+        for (int r = 0; r < ROWS; r++) {
+          uint8_t &c = _counters[get_index(hash, r)];
+
+          if (c < MAX_COUNT) {
+            c++;
+            added = true;
+          }
+        }
+
+        if (added && ++_additions >= _sample_size)
+          age();
+      }
+
+      inline bool admit(size_t candidate_hash, size_t victim_hash)
+      {
+        if (get_frequency(candidate_hash) > get_frequency(victim_hash)) {
+          _admitted++;
+          return true;
+        }
+
+        _rejected++;
+        return false;
+      }
+
+      inline int get_frequency(size_t hash) const
+      {
+        int f = MAX_COUNT;
+
+        for (int r = 0; r < ROWS; r++) {
+          int c = _counters[get_index(hash, r)];
+
+          if (c < f)
+            f = c;
+        }
+
+        return f;
+      }
+
+      inline uint64_t get_admitted() const { return _admitted; }
+      inline uint64_t get_rejected() const { return _rejected; }
+
+    private:
+      enum
+      {
+        ROWS = 4,
+        MAX_COUNT = 15,
+        SAMPLE_FACTOR = 10
+      };
+
+      inline size_t get_index(size_t hash, int row) const
+      {
+        // a different odd multiplier per row, keeping the high bits
+        static const uint64_t SEEDS[ROWS] = {
+          0x9e3779b97f4a7c15ULL,
+          0xc2b2ae3d27d4eb4fULL,
+          0x165667b19e3779f9ULL,
+          0xd6e8feb86659fd93ULL };
+
+        uint64_t h = (static_cast<uint64_t>(hash) + row) * SEEDS[row];
+
+        return row * (_mask + 1) + ((h >> 32) & _mask);
+      }
+
+      inline void age()
+      {
+        for (size_t i = 0; i < _counters.size(); i++)
+          _counters[i] >>= 1;
+
+        _additions /= 2;
+      }
+
+      std::vector<uint8_t> _counters;
+      size_t _mask, _additions, _sample_size;
+      uint64_t _admitted, _rejected;
+    };
+  }
+}
+
+#endif
@@ -0,0 +1,374 @@
+/*
+ * base/clock_pro_map.h
+ * -------------------------------------------------------------------------
+ * Weighted map with CLOCK-Pro replacement.
+ * -------------------------------------------------------------------------
+ *
+ * Copyright (c) 2013, Tarick Bedeir.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef S3_BASE_CLOCK_PRO_MAP_H
+#define S3_BASE_CLOCK_PRO_MAP_H
+
+#include <stddef.h>
+
+#include <algorithm>
+#include <boost/functional/hash.hpp>
+#include <boost/unordered_map.hpp>
+#include <boost/utility.hpp>
+
+namespace s3
+{
+  namespace base
+  {
+    // a map limited by the total weight of its values, which evicts with
+    // CLOCK-Pro (Jiang, Chen and Zhang, USENIX 2005).
+    //
+    // entries sit on one circular list and are either hot or cold.  a hit
+    // only sets the entry's reference bit, so lookups never reorder the
+    // list.  three hands go around it:
+    //
+    // - the cold hand evicts unreferenced cold entries.  a referenced cold
+    //   entry still in its "test period" becomes hot; one past its test
+    //   period starts a new one.
+    //
+    // - the hot hand turns unreferenced hot entries cold, and ends the test
+    //   periods of the cold entries it passes.
+    //
+    // - the test hand ends test periods too, to keep the keys of evicted
+    //   entries (see below) to no more than the map's capacity.
+    //
+    // an entry evicted during its test period leaves its key (but not its
+    // value) behind.  if that key is inserted again before its test period
+    // ends, the entry was evicted too soon: it comes back hot, and the share
+    // of the capacity given to cold entries grows.  when a test period ends
+    // unused, that share shrinks.  so entries used once (a scan) pass through
+    // the cold share without displacing the hot ones, and the cold share
+    // adapts to how far apart reuses are.
+    //
+    // not thread-safe.
+    template <class key_type, class value_type, class hash_type = boost::hash<key_type> >
+    class clock_pro_map : boost::noncopyable
+    {
+    public:
+      inline explicit clock_pro_map(size_t capacity)
+        : _capacity(capacity),
+          _cold_target(get_min_cold()),
+          _hot_weight(0),
+          _cold_weight(0),
+          _test_weight(0),
+          _hot_count(0),
+          _cold_count(0),
+          _hand_hot(NULL),
+          _hand_cold(NULL),
+          _hand_test(NULL)
+      {
+      }
+
+      // a successful find counts as a use of the entry
+      inline bool find(const key_type &key, value_type *value)
+      {
+        typename node_map::iterator itor = _nodes.find(key);
+
+        if (itor == _nodes.end() || !itor->second.resident)
+          return false;
+
+        itor->second.referenced = true;
+        *value = itor->second.value;
+
+        return true;
+      }
+
+      // values heavier than the whole map aren't kept
+      inline void insert(const key_type &key, const value_type &value, size_t weight)
+      {
+        typename node_map::iterator itor = _nodes.find(key);
+        node *n;
+        bool hot = false, referenced = false;
+
+        if (weight > _capacity)
+          return erase(key);
+
+        if (itor != _nodes.end()) {
+          if (itor->second.resident) {
+            // a replacement keeps the entry's standing
+            hot = itor->second.hot;
+            referenced = true;
+          } else {
+            // back within its test period: it shouldn't have been evicted
+            _cold_target = std::min(_cold_target + weight, get_max_cold());
+            hot = true;
+          }
+
+          remove_node(&itor->second);
+        }
+
+        make_room(weight);
+
+        n = &_nodes[key];
+
+        n->key = &_nodes.find(key)->first;
+        n->value = value;
+        n->weight = weight;
+        n->resident = true;
+        n->hot = hot;
+        n->in_test = !hot;
+        n->referenced = referenced;
+
+        link_head(n);
+        add_weight(n);
+
+        balance_hot();
+      }
+
+      inline void erase(const key_type &key)
+      {
+        typename node_map::iterator itor = _nodes.find(key);
+
+        if (itor != _nodes.end())
+          remove_node(&itor->second);
+      }
+
+      // total weight of the values held
+      inline size_t get_weight() const { return _hot_weight + _cold_weight; }
+      inline size_t get_hot_weight() const { return _hot_weight; }
+      inline size_t get_cold_target() const { return _cold_target; }
+      inline size_t get_size() const { return _hot_count + _cold_count; }
+      inline size_t get_capacity() const { return _capacity; }
+
+    private:
+      enum { MIN_COLD_PERCENT = 1 };
+
+      struct node
+      {
+        const key_type *key;
+        value_type value;
+        size_t weight;
+        bool resident, hot, in_test, referenced;
+        node *prev, *next;
+
+        inline node()
+          : key(NULL),
+            weight(0),
+            resident(false),
+            hot(false),
+            in_test(false),
+            referenced(false),
+            prev(NULL),
+            next(NULL)
+        {
+        }
+      };
+
+      // nodes in an unordered_map keep their addresses across rehashing
+      typedef boost::unordered_map<key_type, node, hash_type> node_map;
+
+      inline size_t get_min_cold() const
+      {
+        return std::max(_capacity * MIN_COLD_PERCENT / 100, static_cast<size_t>(1));
+      }
+
+      inline size_t get_max_cold() const
+      {
+        return (_capacity > get_min_cold()) ? _capacity - get_min_cold() : _capacity;
+      }
+
+      inline size_t get_hot_target() const
+      {
+        return (_capacity > _cold_target) ? _capacity - _cold_target : 0;
+      }
+
+      inline void add_weight(const node *n)
+      {
+        if (!n->resident) {
+          _test_weight += n->weight;
+        } else if (n->hot) {
+          _hot_weight += n->weight;
+          _hot_count++;
+        } else {
+          _cold_weight += n->weight;
+          _cold_count++;
+        }
+      }
+
+      inline void remove_weight(const node *n)
+      {
+        if (!n->resident) {
+          _test_weight -= n->weight;
+        } else if (n->hot) {
+          _hot_weight -= n->weight;
+          _hot_count--;
+        } else {
+          _cold_weight -= n->weight;
+          _cold_count--;
+        }
+      }
+
+      // new entries go just behind the hot hand, which is the last to reach
+      // them
+      inline void link_head(node *n)
+      {
+        if (!_hand_hot) {
+          n->prev = n->next = n;
+          _hand_hot = _hand_cold = _hand_test = n;
+          return;
+        }
+
+        n->next = _hand_hot;
+        n->prev = _hand_hot->prev;
+        n->prev->next = n;
+        _hand_hot->prev = n;
+      }
+
+      inline void unlink(node *n)
+      {
+        if (n->next == n) {
+          _hand_hot = _hand_cold = _hand_test = NULL;
+        } else {
+          n->prev->next = n->next;
+          n->next->prev = n->prev;
+
+          if (_hand_hot == n)
+            _hand_hot = n->next;
+
+          if (_hand_cold == n)
+            _hand_cold = n->next;
+
+          if (_hand_test == n)
+            _hand_test = n->next;
+        }
+
+        n->prev = n->next = NULL;
+      }
+
+      inline void remove_node(node *n)
+      {
+        remove_weight(n);
+        unlink(n);
+        _nodes.erase(*n->key);
+      }
+
+      // a test period that ended without the key coming back
+      inline void end_test(node *n)
+      {
+        n->in_test = false;
+
+        if (!n->resident) {
+          _cold_target = std::max(
+            (_cold_target > n->weight) ? _cold_target - n->weight : 0,
+            get_min_cold());
+
+          remove_node(n);
+        }
+      }
+
+      inline void make_room(size_t weight)
+      {
+        while (get_weight() + weight > _capacity) {
+          if (_cold_count)
+            run_hand_cold();
+          else
+            run_hand_hot();
+        }
+      }
+
+      inline void balance_hot()
+      {
+        while (_hot_weight > get_hot_target())
+          run_hand_hot();
+      }
+
+      inline void run_hand_cold()
+      {
+        node *n = _hand_cold;
+
+        while (n->hot || !n->resident)
+          n = n->next;
+
+        _hand_cold = n->next;
+
+        if (n->referenced) {
+          n->referenced = false;
+
+          if (n->in_test) {
+            remove_weight(n);
+            n->hot = true;
+            n->in_test = false;
+            add_weight(n);
+
+            balance_hot();
+
+          } else {
+            // used since its last test period: start another, from the head
+            unlink(n);
+            n->in_test = true;
+            link_head(n);
+          }
+
+          return;
+        }
+
+        if (!n->in_test)
+          return remove_node(n);
+
+        // keep the key until its test period ends
+        remove_weight(n);
+        n->resident = false;
+        n->value = value_type();
+        add_weight(n);
+
+        while (_test_weight > _capacity)
+          run_hand_test();
+      }
+
+      inline void run_hand_hot()
+      {
+        node *n = _hand_hot;
+
+        _hand_hot = n->next;
+
+        if (n->hot) {
+          if (n->referenced) {
+            n->referenced = false;
+          } else {
+            remove_weight(n);
+            n->hot = false;
+            add_weight(n);
+          }
+        } else if (n->in_test) {
+          end_test(n);
+        }
+      }
+
+      inline void run_hand_test()
+      {
+        node *n = _hand_test;
+
+        _hand_test = n->next;
+
+        if (!n->hot && n->in_test)
+          end_test(n);
+      }
+
+      size_t _capacity, _cold_target;
+      size_t _hot_weight, _cold_weight, _test_weight;
+      size_t _hot_count, _cold_count;
+      node_map _nodes;
+      node *_hand_hot, *_hand_cold, *_hand_test;
+    };
+  }
+}
+
+#endif
@@ -0,0 +1,588 @@
+/*
+ * base/hash_lru_cache_map.h
+ * -------------------------------------------------------------------------
+ * Hash table-based LRU cache map with constant-time lookup and eviction.
+ * -------------------------------------------------------------------------
+ *
+ * Copyright (c) 2012, Tarick Bedeir.
+ * 
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef S3_BASE_HASH_LRU_CACHE_MAP_H
+#define S3_BASE_HASH_LRU_CACHE_MAP_H
+
+#include <stdint.h>
+
+#include <algorithm>
+#include <vector>
+#include <boost/function.hpp>
+#include <boost/functional/hash.hpp>
+
+#include "base/cache_policy.h"
+#include "base/lru_cache_map.h"
+
+namespace s3
+{
+  namespace base
+  {
+    // same interface as lru_cache_map, but:
+    //
+    // - entries live in a pool and are found through an open-addressing
+    //   (linear probing) table of pool indices, so lookups hash the key once
+    //   and compare it (usually) once.
+    //
+    // - the LRU links are pool indices stored in the entries themselves.
+    //
+    // - entries that eviction finds can't be removed are moved to a separate
+    //   "pinned" list instead of being walked past on every insert.  one
+    //   pinned entry is rechecked per insert, and becomes the next eviction
+    //   candidate once it's removable.
+    //
+    // - find() doesn't insert.
+    //
+    // - entries can be given weights (via set_weight()), and the map can be
+    //   limited by total weight as well as by entry count.
+    //
+    // - find(), erase() and set_weight() take a "lookup_type" (key_type by
+    //   default), which must hash (with boost::hash) and compare equal to
+    //   key_type.  this lets a map keyed on some compact key type be searched
+    //   without building one.
+    //
+    // - which entries are evicted is up to "policy_type" (see
+    //   cache_policy.h).  the default is plain LRU.
+    template
+    <
+      class key_type,
+      class value_type,
+      bool (*is_removable_fn)(const value_type &v) = default_removable_test<value_type>,
+      class lookup_type = key_type,
+      class policy_type = lru_policy
+    >
+    class hash_lru_cache_map
+    {
+    public:
+      typedef boost::function2<void, const key_type &, const value_type &> itor_callback_fn;
+
+      inline hash_lru_cache_map(size_t max_size, size_t max_weight = static_cast<size_t>(-1))
+        : _max_size(max_size),
+          _size(0),
+          _max_weight(max_weight),
+          _weight(0),
+          _free(NIL)
+      {
+        _buckets.resize(MIN_BUCKETS, NIL);
+        _mask = MIN_BUCKETS - 1;
+        _policy.resize(MIN_BUCKETS);
+      }
+
+      inline value_type & operator [](const key_type &key)
+      {
+        size_t hash = _hasher(key);
+        uint32_t i = find_index(key, hash);
+
+        if (i != NIL) {
+          touch(i);
+          return _nodes[i].value;
+        }
+
+        _policy.record(hash);
+
+        if (_size >= _max_size || _weight > _max_weight)
+          trim(1, NIL);
+
+        i = alloc_node(key, hash);
+        insert_index(i);
+        link_newest(LIST_WINDOW, i);
+
+        // while there's room, entries leaving the window go straight into
+        // the main region.  once the map is full, trim() decides.
+        if (is_segmented() && _lists[LIST_WINDOW].count > get_window_limit())
+          move_newest(LIST_PROBATION, _lists[LIST_WINDOW].oldest);
+
+        return _nodes[i].value;
+      }
+
+      // returns NULL if "key" isn't in the map.  a successful find counts as
+      // a use of the entry.
+      inline value_type * find(const lookup_type &key)
+      {
+        uint32_t i = find_index(key, _lookup_hasher(key));
+
+        if (i == NIL)
+          return NULL;
+
+        touch(i);
+
+        return &_nodes[i].value;
+      }
+
+      // like find(), but doesn't count as a use (for housekeeping that
+      // shouldn't keep entries alive)
+      inline value_type * peek(const lookup_type &key)
+      {
+        uint32_t i = find_index(key, _lookup_hasher(key));
+
+        return (i == NIL) ? NULL : &_nodes[i].value;
+      }
+
+      inline bool find(const lookup_type &key, value_type *t)
+      {
+        value_type *v = find(key);
+
+        if (!v)
+          return false;
+
+        *t = *v;
+
+        return true;
+      }
+
+      // new entries have a weight of zero.  changing an entry's weight
+      // doesn't count as a use, but may evict other entries.
+      inline void set_weight(const lookup_type &key, size_t weight)
+      {
+        uint32_t i = find_index(key, _lookup_hasher(key));
+
+        if (i == NIL)
+          return;
+
+        _weight = _weight - _nodes[i].weight + weight;
+        _nodes[i].weight = weight;
+
+        if (_weight > _max_weight)
+          trim(0, i);
+      }
+
+      inline void erase(const lookup_type &key)
+      {
+        uint32_t i = find_index(key, _lookup_hasher(key));
+
+        if (i != NIL)
+          remove_node(i);
+      }
+
+      // from most to least recently used within the window, then the
+      // protected and probation segments, then the pinned entries set aside
+      // by eviction
+      inline void for_each_newest(const itor_callback_fn &cb) const
+      {
+        for_each_newest(LIST_WINDOW, cb);
+        for_each_newest(LIST_PROTECTED, cb);
+        for_each_newest(LIST_PROBATION, cb);
+        for_each_newest(LIST_PINNED, cb);
+      }
+
+      // the order in which entries would be evicted, then the pinned entries
+      inline void for_each_oldest(const itor_callback_fn &cb) const
+      {
+        for_each_oldest(LIST_PROBATION, cb);
+        for_each_oldest(LIST_PROTECTED, cb);
+        for_each_oldest(LIST_WINDOW, cb);
+        for_each_oldest(LIST_PINNED, cb);
+      }
+
+      inline size_t get_size()
+      {
+        return _size;
+      }
+
+      inline size_t get_weight()
+      {
+        return _weight;
+      }
+
+      inline const policy_type & get_policy() const
+      {
+        return _policy;
+      }
+
+    private:
+      enum
+      {
+        MIN_BUCKETS = 16
+      };
+
+      enum list_id
+      {
+        LIST_WINDOW,
+        LIST_PROBATION,
+        LIST_PROTECTED,
+        LIST_PINNED,
+        LIST_COUNT,
+
+        LIST_FREE = LIST_COUNT
+      };
+
+      static const uint32_t NIL = 0xffffffff;
+
+      struct node
+      {
+        key_type key;
+        value_type value;
+        size_t hash, weight;
+        uint32_t older, newer;
+        list_id owner;
+
+        node()
+          : key(),
+            value(),
+            hash(0),
+            weight(0),
+            older(NIL),
+            newer(NIL),
+            owner(LIST_FREE)
+        {
+        }
+      };
+
+      struct node_list
+      {
+        uint32_t oldest, newest;
+        size_t count;
+
+        node_list()
+          : oldest(NIL),
+            newest(NIL),
+            count(0)
+        {
+        }
+      };
+
+      inline static bool is_segmented()
+      {
+        return policy_type::WINDOW_PERCENT < 100;
+      }
+
+      // segment limits follow the number of entries actually in the map,
+      // since maps limited by weight don't know how many they'll hold
+      inline size_t get_window_limit() const
+      {
+        size_t limit = (std::min(_size, _max_size) * policy_type::WINDOW_PERCENT) / 100;
+
+        return (limit > 0) ? limit : 1;
+      }
+
+      inline size_t get_protected_limit() const
+      {
+        size_t size = std::min(_size, _max_size), window = get_window_limit();
+
+        return (size > window) ? ((size - window) * policy_type::PROTECTED_PERCENT) / 100 : 0;
+      }
+
+      template <class T>
+      inline uint32_t find_index(const T &key, size_t hash) const
+      {
+        for (size_t b = hash & _mask; _buckets[b] != NIL; b = (b + 1) & _mask) {
+          const node &n = _nodes[_buckets[b]];
+
+          if (n.hash == hash && n.key == key)
+            return _buckets[b];
+        }
+
+        return NIL;
+      }
+
+      inline void insert_index(uint32_t i)
+      {
+        // keep the load factor at or under 3/4
+        if ((_size + 1) * 4 > _buckets.size() * 3) {
+          rehash(_buckets.size() * 2);
+          _policy.resize(_buckets.size());
+        }
+
+        place(i);
+        _size++;
+      }
+
+      inline void place(uint32_t i)
+      {
+        size_t b = _nodes[i].hash & _mask;
+
+        while (_buckets[b] != NIL)
+          b = (b + 1) & _mask;
+
+        _buckets[b] = i;
+      }
+
+      inline void rehash(size_t bucket_count)
+      {
+        std::vector<uint32_t> old;
+
+        old.swap(_buckets);
+        _buckets.resize(bucket_count, NIL);
+        _mask = bucket_count - 1;
+
+        for (size_t b = 0; b < old.size(); b++)
+          if (old[b] != NIL)
+            place(old[b]);
+      }
+
+      inline void remove_index(uint32_t i)
+      {
+        size_t b = _nodes[i].hash & _mask, next;
+
+        while (_buckets[b] != i)
+          b = (b + 1) & _mask;
+
+        // backward-shift deletion: pull later entries in the probe run into
+        // the hole unless that would put them before their home bucket
+        for (next = (b + 1) & _mask; _buckets[next] != NIL; next = (next + 1) & _mask) {
+          size_t home = _nodes[_buckets[next]].hash & _mask;
+
+          if (((next - home) & _mask) >= ((next - b) & _mask)) {
+            _buckets[b] = _buckets[next];
+            b = next;
+          }
+        }
+
+        _buckets[b] = NIL;
+        _size--;
+      }
+
+      inline uint32_t alloc_node(const key_type &key, size_t hash)
+      {
+        uint32_t i;
+
+        if (_free != NIL) {
+          i = _free;
+          _free = _nodes[i].newer;
+        } else {
+          i = _nodes.size();
+          _nodes.push_back(node());
+        }
+
+        _nodes[i].key = key;
+        _nodes[i].hash = hash;
+        _nodes[i].older = _nodes[i].newer = NIL;
+
+        return i;
+      }
+
+      inline void remove_node(uint32_t i)
+      {
+        node &n = _nodes[i];
+
+        remove_index(i);
+        unlink(i);
+
+        _weight -= n.weight;
+
+        // release whatever the key and value hold now rather than when the
+        // node is reused
+        n.key = key_type();
+        n.value = value_type();
+        n.weight = 0;
+        n.owner = LIST_FREE;
+        n.newer = _free;
+        _free = i;
+      }
+
+      inline void unlink(uint32_t i)
+      {
+        node &n = _nodes[i];
+        node_list &l = _lists[n.owner];
+
+        if (n.older != NIL)
+          _nodes[n.older].newer = n.newer;
+        else
+          l.oldest = n.newer;
+
+        if (n.newer != NIL)
+          _nodes[n.newer].older = n.older;
+        else
+          l.newest = n.older;
+
+        n.older = n.newer = NIL;
+        l.count--;
+      }
+
+      inline void link_newest(list_id id, uint32_t i)
+      {
+        node &n = _nodes[i];
+        node_list &l = _lists[id];
+
+        n.older = l.newest;
+        n.newer = NIL;
+        n.owner = id;
+
+        if (l.newest != NIL)
+          _nodes[l.newest].newer = i;
+        else
+          l.oldest = i;
+
+        l.newest = i;
+        l.count++;
+      }
+
+      inline void link_oldest(list_id id, uint32_t i)
+      {
+        node &n = _nodes[i];
+        node_list &l = _lists[id];
+
+        n.newer = l.oldest;
+        n.older = NIL;
+        n.owner = id;
+
+        if (l.oldest != NIL)
+          _nodes[l.oldest].older = i;
+        else
+          l.newest = i;
+
+        l.oldest = i;
+        l.count++;
+      }
+
+      inline void move_newest(list_id id, uint32_t i)
+      {
+        unlink(i);
+        link_newest(id, i);
+      }
+
+      inline void touch(uint32_t i)
+      {
+        _policy.record(_nodes[i].hash);
+
+        if (_nodes[i].owner == LIST_PROTECTED) {
+          move_newest(LIST_PROTECTED, i);
+
+        } else if (_nodes[i].owner == LIST_PROBATION && is_segmented()) {
+          // a second use promotes an entry, possibly demoting another
+          move_newest(LIST_PROTECTED, i);
+
+          if (_lists[LIST_PROTECTED].count > get_protected_limit())
+            move_newest(LIST_PROBATION, _lists[LIST_PROTECTED].oldest);
+
+        } else {
+          move_newest(LIST_WINDOW, i);
+        }
+      }
+
+      inline void for_each_newest(list_id id, const itor_callback_fn &cb) const
+      {
+        for (uint32_t i = _lists[id].newest; i != NIL; i = _nodes[i].older)
+          cb(_nodes[i].key, _nodes[i].value);
+      }
+
+      inline void for_each_oldest(list_id id, const itor_callback_fn &cb) const
+      {
+        for (uint32_t i = _lists[id].oldest; i != NIL; i = _nodes[i].newer)
+          cb(_nodes[i].key, _nodes[i].value);
+      }
+
+      // looks at the oldest pinned entry: if it's become removable it
+      // becomes the next candidate for eviction; otherwise it goes to the
+      // back of the pinned list
+      inline void recheck_pinned()
+      {
+        uint32_t i = _lists[LIST_PINNED].oldest;
+
+        if (i == NIL)
+          return;
+
+        unlink(i);
+
+        if (is_removable_fn(_nodes[i].value))
+          link_oldest(LIST_PROBATION, i);
+        else
+          link_newest(LIST_PINNED, i);
+      }
+
+      // evicts entries until there's room for "extra" more, without evicting
+      // "keep"
+      inline void trim(size_t extra, uint32_t keep)
+      {
+        recheck_pinned();
+
+        while (_size + extra > _max_size || _weight > _max_weight) {
+          // if everything is pinned, let the map grow past its limits
+          if (!evict_one(extra, keep))
+            break;
+        }
+      }
+
+      inline bool evict_one(size_t extra, uint32_t keep)
+      {
+        uint32_t candidate, victim;
+
+        // an entry leaving a full window has to displace the main region's
+        // oldest entry to stay in the map
+        if (is_segmented() && _lists[LIST_WINDOW].count + extra > get_window_limit()) {
+          candidate = get_removable(LIST_WINDOW, keep);
+
+          if (candidate != NIL) {
+            victim = get_removable(LIST_PROBATION, keep);
+
+            if (victim == NIL)
+              victim = get_removable(LIST_PROTECTED, keep);
+
+            if (victim != NIL && _policy.admit(_nodes[candidate].hash, _nodes[victim].hash)) {
+              remove_node(victim);
+              move_newest(LIST_PROBATION, candidate);
+            } else {
+              remove_node(candidate);
+            }
+
+            return true;
+          }
+        }
+
+        victim = get_removable(LIST_PROBATION, keep);
+
+        if (victim == NIL)
+          victim = get_removable(LIST_PROTECTED, keep);
+
+        if (victim == NIL)
+          victim = get_removable(LIST_WINDOW, keep);
+
+        if (victim == NIL)
+          return false;
+
+        remove_node(victim);
+
+        return true;
+      }
+
+      // returns the oldest removable entry in list "id", moving any
+      // unremovable entries in the way to the pinned list.  stops at "keep".
+      inline uint32_t get_removable(list_id id, uint32_t keep)
+      {
+        uint32_t i;
+
+        while ((i = _lists[id].oldest) != NIL && i != keep) {
+          if (is_removable_fn(_nodes[i].value))
+            return i;
+
+          move_newest(LIST_PINNED, i);
+        }
+
+        return NIL;
+      }
+
+      size_t _max_size, _size, _mask;
+      size_t _max_weight, _weight;
+      std::vector<node> _nodes;
+      std::vector<uint32_t> _buckets;
+      uint32_t _free;
+      node_list _lists[LIST_COUNT];
+      boost::hash<key_type> _hasher;
+      boost::hash<lookup_type> _lookup_hasher;
+      policy_type _policy;
+    };
+
+    template <class key_type, class value_type, bool (*is_removable_fn)(const value_type &v), class lookup_type, class policy_type>
+    const uint32_t hash_lru_cache_map<key_type, value_type, is_removable_fn, lookup_type, policy_type>::NIL;
+  }
+}
+
+#endif
@@ -0,0 +1,141 @@
+/*
+ * base/interned_string.cc
+ * -------------------------------------------------------------------------
+ * Immutable, shared string storage.
+ * -------------------------------------------------------------------------
+ *
+ * Copyright (c) 2012, Tarick Bedeir.
+ * 
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <boost/functional/hash.hpp>
+#include <boost/thread.hpp>
+#include <boost/unordered_map.hpp>
+
+#include "base/interned_string.h"
+
+using std::string;
+
+using s3::base::interned_string;
+
+namespace
+{
+  // the table is keyed on a pointer to the entry's own copy of the string,
+  // so that the contents are only stored once
+  struct deref_hash
+  {
+    inline size_t operator ()(const string *s) const { return boost::hash<string>()(*s); }
+  };
+
+  struct deref_equal
+  {
+    inline bool operator ()(const string *a, const string *b) const { return *a == *b; }
+  };
+
+  // partitioned so that threads creating unrelated objects don't contend
+  const size_t TABLE_COUNT = 16;
+
+  typedef boost::unordered_map<const string *, void *, deref_hash, deref_equal> entry_map;
+
+  struct table
+  {
+    boost::mutex mutex;
+    entry_map map;
+  };
+
+  // never freed.  static objects in other files (the object cache, say)
+  // can hold interned strings, and may be destroyed after anything static
+  // here would be, so the tables have to outlive every static destructor.
+  inline table * get_tables()
+  {
+    static table *tables = new table[TABLE_COUNT];
+
+    return tables;
+  }
+
+  inline table & get_table(size_t hash)
+  {
+    return get_tables()[hash % TABLE_COUNT];
+  }
+}
+
+// likewise never freed
+const string &interned_string::s_empty(*new string());
+const size_t interned_string::s_empty_hash(boost::hash<string>()(interned_string::s_empty));
+
+interned_string::interned_string(const string &s)
+  : _entry(NULL)
+{
+  size_t hash;
+
+  if (s.empty())
+    return;
+
+  hash = boost::hash<string>()(s);
+
+  {
+    table &t = get_table(hash);
+    boost::mutex::scoped_lock lock(t.mutex);
+    entry_map::iterator itor = t.map.find(&s);
+
+    if (itor != t.map.end()) {
+      _entry = static_cast<entry *>(itor->second);
+      add_ref(_entry);
+
+      return;
+    }
+
+    _entry = new entry(s, hash);
+    t.map[&_entry->value] = _entry;
+  }
+}
+
+void interned_string::release(entry *e)
+{
+  long refs = __atomic_load_n(&e->refs, __ATOMIC_RELAXED);
+
+  // as long as we're not dropping the last reference, there's nothing in the
+  // table to change, so don't take its lock
+  while (refs > 1)
+    if (__atomic_compare_exchange_n(&e->refs, &refs, refs - 1, true, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+      return;
+
+  table &t = get_table(e->hash);
+  boost::mutex::scoped_lock lock(t.mutex);
+
+  // the count only reaches zero under the table lock, so a concurrent
+  // lookup can't pick up an entry that's being deleted.  one may have found
+  // it (and taken a reference) since we looked, though.
+  if (__atomic_sub_fetch(&e->refs, 1, __ATOMIC_ACQ_REL))
+    return;
+
+  t.map.erase(&e->value);
+  lock.unlock();
+
+  delete e;
+}
+
+size_t interned_string::get_count()
+{
+  size_t count = 0;
+
+  for (size_t i = 0; i < TABLE_COUNT; i++) {
+    table &t = get_tables()[i];
+    boost::mutex::scoped_lock lock(t.mutex);
+
+    count += t.map.size();
+  }
+
+  return count;
+}
@@ -0,0 +1,122 @@
+/*
+ * base/interned_string.h
+ * -------------------------------------------------------------------------
+ * Immutable, shared string storage.
+ * -------------------------------------------------------------------------
+ *
+ * Copyright (c) 2012, Tarick Bedeir.
+ * 
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef S3_BASE_INTERNED_STRING_H
+#define S3_BASE_INTERNED_STRING_H
+
+#include <string>
+
+namespace s3
+{
+  namespace base
+  {
+    // equal interned strings share a single, reference-counted copy of their
+    // contents, so copying one is a pointer copy (plus a reference count
+    // increment) and comparing two is a pointer comparison.  the hash of an
+    // interned string matches boost::hash<std::string> on its contents, so
+    // hash containers keyed by interned strings can be searched with plain
+    // strings.
+    class interned_string
+    {
+    public:
+      inline interned_string()
+        : _entry(NULL)
+      {
+      }
+
+      explicit interned_string(const std::string &s);
+
+      inline interned_string(const interned_string &other)
+        : _entry(other._entry)
+      {
+        if (_entry)
+          add_ref(_entry);
+      }
+
+      inline ~interned_string()
+      {
+        if (_entry)
+          release(_entry);
+      }
+
+      inline interned_string & operator =(const interned_string &other)
+      {
+        if (other._entry)
+          add_ref(other._entry);
+
+        if (_entry)
+          release(_entry);
+
+        _entry = other._entry;
+
+        return *this;
+      }
+
+      inline const std::string & str() const { return _entry ? _entry->value : s_empty; }
+      inline size_t get_hash() const { return _entry ? _entry->hash : s_empty_hash; }
+
+      inline bool operator ==(const interned_string &other) const { return _entry == other._entry; }
+      inline bool operator !=(const interned_string &other) const { return _entry != other._entry; }
+      inline bool operator ==(const std::string &s) const { return str() == s; }
+
+      // number of distinct strings currently interned
+      static size_t get_count();
+
+    private:
+      struct entry
+      {
+        std::string value;
+        size_t hash;
+
+        // changed only with atomic builtins (see release(), and the check
+        // for them in configure.ac)
+        long refs;
+
+        inline entry(const std::string &value_, size_t hash_)
+          : value(value_),
+            hash(hash_),
+            refs(1)
+        {
+        }
+      };
+
+      // the caller already holds a reference, so the count can't be at zero
+      inline static void add_ref(entry *e)
+      {
+        __atomic_add_fetch(&e->refs, 1, __ATOMIC_RELAXED);
+      }
+
+      static void release(entry *e);
+
+      static const std::string &s_empty;
+      static const size_t s_empty_hash;
+
+      entry *_entry;
+    };
+
+    inline size_t hash_value(const interned_string &s)
+    {
+      return s.get_hash();
+    }
+  }
+}
+
+#endif
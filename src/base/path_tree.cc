@@ -0,0 +1,341 @@
+/*
+ * base/path_tree.cc
+ * -------------------------------------------------------------------------
+ * Tree of path components, for answering namespace questions locally.
+ * -------------------------------------------------------------------------
+ *
+ * Copyright (c) 2012, Tarick Bedeir.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <algorithm>
+
+#include "base/path_tree.h"
+
+using std::string;
+using std::vector;
+
+using s3::base::path_tree;
+using s3::base::path_tree_state;
+
+namespace
+{
+  struct name_less
+  {
+    template <class node_type>
+    inline bool operator ()(const node_type *n, const string &name) const
+    {
+      return n->name < name;
+    }
+  };
+}
+
+path_tree::path_tree()
+  : _root("", 0),
+    _size(0),
+    _generation(0)
+{
+}
+
+path_tree::~path_tree()
+{
+  clear();
+}
+
+path_tree::node * path_tree::find_child(const node *parent, const string &name)
+{
+  vector<node *>::const_iterator itor = std::lower_bound(parent->children.begin(), parent->children.end(), name, name_less());
+
+  return (itor != parent->children.end() && (*itor)->name == name) ? *itor : NULL;
+}
+
+path_tree::node * path_tree::find_node(const string &path) const
+{
+  node *n = const_cast<node *>(&_root);
+  size_t start = 0;
+
+  if (path.empty())
+    return n;
+
+  while (n) {
+    size_t end = path.find('/', start);
+
+    n = find_child(n, path.substr(start, (end == string::npos) ? string::npos : end - start));
+
+    if (end == string::npos)
+      break;
+
+    start = end + 1;
+  }
+
+  return n;
+}
+
+path_tree::node * path_tree::make_node(const string &path, time_t expiry)
+{
+  node *n = &_root;
+  size_t start = 0;
+
+  if (path.empty())
+    return n;
+
+  while (true) {
+    size_t end = path.find('/', start);
+    string name = path.substr(start, (end == string::npos) ? string::npos : end - start);
+    vector<node *>::iterator itor = std::lower_bound(n->children.begin(), n->children.end(), name, name_less());
+
+    if (itor == n->children.end() || (*itor)->name != name) {
+      itor = n->children.insert(itor, new node(name, n->children_generation));
+      _size++;
+    }
+
+    n = *itor;
+
+    // a path can't exist without its ancestors
+    if (n->expiry < expiry)
+      n->expiry = expiry;
+
+    if (end == string::npos)
+      return n;
+
+    start = end + 1;
+  }
+}
+
+size_t path_tree::delete_subtree(node *n)
+{
+  size_t count = 0;
+
+  for (vector<node *>::const_iterator itor = n->children.begin(); itor != n->children.end(); ++itor) {
+    count += delete_subtree(*itor) + 1;
+    delete *itor;
+  }
+
+  n->children.clear();
+  n->listing_expiry = 0;
+
+  return count;
+}
+
+void path_tree::insert(const string &path, time_t expiry)
+{
+  make_node(path, expiry);
+}
+
+void path_tree::set_children(const string &path, const vector<string> &names_, time_t expiry)
+{
+  node *n = make_node(path, expiry);
+  vector<string> names(names_);
+  vector<node *> children;
+  vector<node *>::const_iterator old = n->children.begin();
+
+  std::sort(names.begin(), names.end());
+  names.erase(std::unique(names.begin(), names.end()), names.end());
+
+  children.reserve(names.size());
+
+  // both lists are sorted, so walk them together, keeping the old nodes
+  // (and their subtrees) for names that are still there
+  for (vector<string>::const_iterator itor = names.begin(); itor != names.end(); ++itor) {
+    for (; old != n->children.end() && (*old)->name < *itor; ++old) {
+      _size -= delete_subtree(*old) + 1;
+      delete *old;
+    }
+
+    if (old != n->children.end() && (*old)->name == *itor) {
+      children.push_back(*old++);
+    } else {
+      children.push_back(new node(*itor, n->children_generation));
+      _size++;
+    }
+
+    children.back()->expiry = expiry;
+  }
+
+  for (; old != n->children.end(); ++old) {
+    _size -= delete_subtree(*old) + 1;
+    delete *old;
+  }
+
+  n->children.swap(children);
+  n->listing_expiry = expiry;
+}
+
+void path_tree::erase(const string &path)
+{
+  size_t last_slash = path.rfind('/');
+  node *parent;
+  vector<node *>::iterator itor;
+  string name;
+
+  if (path.empty()) {
+    clear();
+    return;
+  }
+
+  parent = find_node((last_slash == string::npos) ? string() : path.substr(0, last_slash));
+
+  if (!parent)
+    return;
+
+  name = (last_slash == string::npos) ? path : path.substr(last_slash + 1);
+  itor = std::lower_bound(parent->children.begin(), parent->children.end(), name, name_less());
+
+  if (itor == parent->children.end() || (*itor)->name != name)
+    return;
+
+  _size -= delete_subtree(*itor) + 1;
+  delete *itor;
+
+  parent->children.erase(itor);
+}
+
+void path_tree::erase_children(const string &path)
+{
+  node *n = find_node(path);
+
+  if (n)
+    _size -= delete_subtree(n);
+}
+
+void path_tree::set_listed(node *n, time_t expiry)
+{
+  if (n->listing_expiry < expiry)
+    n->listing_expiry = expiry;
+
+  for (vector<node *>::const_iterator itor = n->children.begin(); itor != n->children.end(); ++itor)
+    set_listed(*itor, expiry);
+}
+
+void path_tree::set_subtree_listed(const string &path, time_t expiry)
+{
+  set_listed(make_node(path, expiry), expiry);
+}
+
+void path_tree::clear()
+{
+  _size -= delete_subtree(&_root);
+
+  // anything watched has gone, and will come back with the root's generation
+  mark_changed(string());
+}
+
+uint64_t path_tree::watch(const string &path)
+{
+  make_node(path, 0);
+
+  return _generation;
+}
+
+void path_tree::mark_changed(const string &path)
+{
+  node *n = &_root;
+  size_t start = 0;
+
+  _generation++;
+  _root.subtree_generation = _generation;
+
+  // a path that doesn't have a node has nothing watching it, but its
+  // ancestors might
+  while (!path.empty()) {
+    size_t end = path.find('/', start);
+
+    n = find_child(n, path.substr(start, (end == string::npos) ? string::npos : end - start));
+
+    if (!n)
+      return;
+
+    n->subtree_generation = _generation;
+
+    if (end == string::npos)
+      break;
+
+    start = end + 1;
+  }
+
+  n->children_generation = _generation;
+}
+
+bool path_tree::children_changed_since(const string &path, uint64_t generation) const
+{
+  const node *n = find_node(path);
+
+  // erased since, so its parent has changed
+  return !n || n->children_generation > generation;
+}
+
+bool path_tree::subtree_changed_since(const string &path, uint64_t generation) const
+{
+  const node *n = find_node(path);
+
+  return !n || n->subtree_generation > generation;
+}
+
+path_tree_state path_tree::find(const string &path, time_t now) const
+{
+  const node *n = &_root;
+  size_t start = 0;
+
+  if (path.empty())
+    return PT_PRESENT;
+
+  while (true) {
+    size_t end = path.find('/', start);
+    const node *child = find_child(n, path.substr(start, (end == string::npos) ? string::npos : end - start));
+
+    if (!child)
+      return (n->listing_expiry > now) ? PT_ABSENT : PT_UNKNOWN;
+
+    n = child;
+
+    if (end == string::npos)
+      break;
+
+    start = end + 1;
+  }
+
+  return (n->expiry > now) ? PT_PRESENT : PT_UNKNOWN;
+}
+
+path_tree_state path_tree::has_children(const string &path, time_t now) const
+{
+  const node *n = find_node(path);
+
+  if (!n)
+    return PT_UNKNOWN;
+
+  if (n->listing_expiry > now)
+    return n->children.empty() ? PT_ABSENT : PT_PRESENT;
+
+  for (vector<node *>::const_iterator itor = n->children.begin(); itor != n->children.end(); ++itor)
+    if ((*itor)->expiry > now)
+      return PT_PRESENT;
+
+  return PT_UNKNOWN;
+}
+
+bool path_tree::get_children(const string &path, time_t now, vector<string> *names) const
+{
+  const node *n = find_node(path);
+
+  if (!n || n->listing_expiry <= now)
+    return false;
+
+  names->reserve(names->size() + n->children.size());
+
+  for (vector<node *>::const_iterator itor = n->children.begin(); itor != n->children.end(); ++itor)
+    names->push_back((*itor)->name);
+
+  return true;
+}
@@ -0,0 +1,148 @@
+/*
+ * base/path_tree.h
+ * -------------------------------------------------------------------------
+ * Tree of path components, for answering namespace questions locally.
+ * -------------------------------------------------------------------------
+ *
+ * Copyright (c) 2012, Tarick Bedeir.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef S3_BASE_PATH_TREE_H
+#define S3_BASE_PATH_TREE_H
+
+#include <stdint.h>
+#include <time.h>
+
+#include <string>
+#include <vector>
+#include <boost/utility.hpp>
+
+namespace s3
+{
+  namespace base
+  {
+    enum path_tree_state
+    {
+      PT_UNKNOWN,
+      PT_ABSENT,
+      PT_PRESENT
+    };
+
+    // paths are slash-separated, without leading or trailing slashes, and ""
+    // is the root.  each node holds one path component, so "a/b/c" and
+    // "a/b/d" share the nodes for "a" and "b", and a subtree goes with its
+    // node when the node is erased.
+    //
+    // nodes remember until when they're known to exist.  a node whose
+    // children were set from a complete listing also remembers until when
+    // that listing holds, and until then a name that isn't among its
+    // children is known not to exist.
+    //
+    // "now" is passed in (rather than read from the clock) so that the
+    // caller decides what time it is.  not thread-safe.
+    //
+    // so that a listing that was in flight when something changed can't
+    // undo the change, each node also remembers the generation at which its
+    // children, and anything under it, last changed (see mark_changed()).  a
+    // node created since takes its generation from its parent, since it may
+    // have replaced one that was erased along with its changes.
+    class path_tree : boost::noncopyable
+    {
+    public:
+      path_tree();
+      ~path_tree();
+
+      // records that "path" (and so each of its ancestors) exists
+      void insert(const std::string &path, time_t expiry);
+
+      // records that "names" are all of the children of "path", keeping the
+      // subtrees of children that were already known
+      void set_children(const std::string &path, const std::vector<std::string> &names, time_t expiry);
+
+      // forgets "path" and everything under it.  the parent's listing, if it
+      // has one, stays complete, so "path" is then known not to exist.
+      void erase(const std::string &path);
+
+      // forgets everything under "path" (and whether its listing is
+      // complete), but not "path" itself
+      void erase_children(const std::string &path);
+
+      // records that the children of "path", and of each node under it, are
+      // complete (e.g., because they came from a listing of everything under
+      // "path")
+      void set_subtree_listed(const std::string &path, time_t expiry);
+
+      // forgets everything, which counts as a change to the root
+      void clear();
+
+      // makes sure "path" has a node (without recording that it exists), so
+      // that its generation can be followed, and returns the current
+      // generation
+      uint64_t watch(const std::string &path);
+
+      // records that the children of "path" have changed other than from a
+      // listing (and so that everything above "path" has too)
+      void mark_changed(const std::string &path);
+
+      // true if the children of "path", or anything under "path", have
+      // changed since watch() returned "generation"
+      bool children_changed_since(const std::string &path, uint64_t generation) const;
+      bool subtree_changed_since(const std::string &path, uint64_t generation) const;
+
+      path_tree_state find(const std::string &path, time_t now) const;
+
+      // PT_ABSENT means "path" has no children at all
+      path_tree_state has_children(const std::string &path, time_t now) const;
+
+      // returns false (and leaves "names" alone) unless the listing of
+      // "path" is complete
+      bool get_children(const std::string &path, time_t now, std::vector<std::string> *names) const;
+
+      // number of nodes, not counting the root
+      inline size_t get_size() const { return _size; }
+
+    private:
+      struct node
+      {
+        std::string name;
+        time_t expiry, listing_expiry;
+        uint64_t children_generation, subtree_generation;
+        std::vector<node *> children; // sorted by name
+
+        inline node(const std::string &name_, uint64_t generation)
+          : name(name_),
+            expiry(0),
+            listing_expiry(0),
+            children_generation(generation),
+            subtree_generation(generation)
+        {
+        }
+      };
+
+      static node * find_child(const node *parent, const std::string &name);
+
+      node * find_node(const std::string &path) const;
+      node * make_node(const std::string &path, time_t expiry);
+      size_t delete_subtree(node *n);
+      void set_listed(node *n, time_t expiry);
+
+      node _root;
+      size_t _size;
+      uint64_t _generation;
+    };
+  }
+}
+
+#endif
@@ -0,0 +1,79 @@
+/*
+ * base/readahead_window.cc
+ * -------------------------------------------------------------------------
+ * Sequential read detection and adaptive readahead sizing.
+ * -------------------------------------------------------------------------
+ *
+ * Copyright (c) 2013, Tarick Bedeir.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <algorithm>
+
+#include "base/readahead_window.h"
+
+using s3::base::readahead_window;
+
+readahead_window::readahead_window(size_t min_size, size_t max_size)
+  : _min_size(min_size),
+    _max_size(std::max(min_size, max_size)),
+    _size(min_size),
+    _last_size(0),
+    _next(0),
+    _ahead_end(0),
+    _run(0)
+{
+}
+
+bool readahead_window::on_read(off_t offset, size_t size, off_t *ahead_offset, size_t *ahead_size)
+{
+  const off_t end = offset + size;
+  const off_t slack = std::max(size, _min_size);
+
+  if (offset + slack < _next || offset > _next + slack) {
+    // whatever we asked for ahead of the old position is likely wasted
+    _size = std::max(_size / 2, _min_size);
+    _run = 1;
+    _next = end;
+    _ahead_end = end;
+    _last_size = 0;
+
+    return false;
+  }
+
+  if (_run < SEQUENTIAL_READS)
+    _run++;
+
+  _next = std::max(_next, end);
+
+  if (_run < SEQUENTIAL_READS)
+    return false;
+
+  // the reader has overtaken what we asked for
+  if (_ahead_end < end)
+    _ahead_end = end;
+
+  // still more than half of the last window to go
+  if (_ahead_end - end > static_cast<off_t>(_last_size / 2))
+    return false;
+
+  *ahead_offset = _ahead_end;
+  *ahead_size = _size;
+
+  _ahead_end += _size;
+  _last_size = _size;
+  _size = std::min(_size * 2, _max_size);
+
+  return true;
+}
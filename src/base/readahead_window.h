@@ -0,0 +1,67 @@
+/*
+ * base/readahead_window.h
+ * -------------------------------------------------------------------------
+ * Sequential read detection and adaptive readahead sizing.
+ * -------------------------------------------------------------------------
+ *
+ * Copyright (c) 2013, Tarick Bedeir.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef S3_BASE_READAHEAD_WINDOW_H
+#define S3_BASE_READAHEAD_WINDOW_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+namespace s3
+{
+  namespace base
+  {
+    // watches the offsets of reads of one file and decides what should be
+    // requested ahead of the reader.  not thread-safe.
+    //
+    // reads that start near where the last one ended are sequential (near,
+    // rather than exactly at, since a multithreaded reader's requests can
+    // arrive slightly out of order).  once SEQUENTIAL_READS in a row are,
+    // a window of "min_size" bytes past the reader is requested.  whenever
+    // the reader gets halfway through the last window requested, the next
+    // one (twice the size, up to "max_size") is requested after it.  so the
+    // window grows only as long as the reader keeps consuming it, and never
+    // runs more than a window and a half ahead.
+    //
+    // a read anywhere else is a seek: it halves the window and starts over.
+    class readahead_window
+    {
+    public:
+      enum { SEQUENTIAL_READS = 2 };
+
+      readahead_window(size_t min_size, size_t max_size);
+
+      // call for each read.  returns true, and sets "ahead_offset" and
+      // "ahead_size", when a range should be requested ahead of the reader.
+      bool on_read(off_t offset, size_t size, off_t *ahead_offset, size_t *ahead_size);
+
+      inline size_t get_size() const { return _size; }
+      inline bool is_sequential() const { return _run >= SEQUENTIAL_READS; }
+
+    private:
+      size_t _min_size, _max_size, _size, _last_size;
+      off_t _next, _ahead_end;
+      int _run;
+    };
+  }
+}
+
+#endif
@@ -433,3 +433,10 @@ void request::run(int timeout_in_s)
   }
 }
 
+void request::replay_response(long response_code, const header_map &headers, time_t last_modified)
+{
+  _output_buffer.clear();
+  _response_headers = headers;
+  _response_code = response_code;
+  _last_modified = last_modified;
+}
@@ -55,6 +55,7 @@ namespace s3
       HTTP_SC_NO_CONTENT = 204,
       HTTP_SC_PARTIAL_CONTENT = 206,
       HTTP_SC_MULTIPLE_CHOICES = 300,
+      HTTP_SC_NOT_MODIFIED = 304,
       HTTP_SC_RESUME = 308,
       HTTP_SC_BAD_REQUEST = 400,
       HTTP_SC_UNAUTHORIZED = 401,
@@ -155,6 +156,11 @@ namespace s3
 
       void run(int timeout_in_s = DEFAULT_REQUEST_TIMEOUT);
 
+      // makes the response look as though the request had returned
+      // "response_code" with "headers", without sending anything.  used to
+      // rebuild objects from previously-saved response headers.
+      void replay_response(long response_code, const header_map &headers, time_t last_modified);
+
     private:
       static size_t header_process(char *data, size_t size, size_t items, void *context);
       static size_t output_write(char *data, size_t size, size_t items, void *context);
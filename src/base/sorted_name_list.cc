@@ -0,0 +1,124 @@
+/*
+ * base/sorted_name_list.cc
+ * -------------------------------------------------------------------------
+ * Immutable, sorted list of names packed into a single buffer.
+ * -------------------------------------------------------------------------
+ *
+ * Copyright (c) 2012, Tarick Bedeir.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <algorithm>
+
+#include "base/sorted_name_list.h"
+
+using std::string;
+using std::vector;
+
+using s3::base::sorted_name_list;
+
+sorted_name_list::sorted_name_list(vector<string> *names)
+{
+  size_t total = 0;
+
+  std::sort(names->begin(), names->end());
+  names->erase(std::unique(names->begin(), names->end()), names->end());
+
+  for (vector<string>::const_iterator itor = names->begin(); itor != names->end(); ++itor)
+    total += itor->size();
+
+  _names.reserve(total);
+  _offsets.reserve(names->size() + 1);
+
+  for (vector<string>::const_iterator itor = names->begin(); itor != names->end(); ++itor) {
+    _offsets.push_back(_names.size());
+    _names += *itor;
+  }
+
+  _offsets.push_back(_names.size());
+}
+
+int sorted_name_list::compare(size_t i, const string &name) const
+{
+  return _names.compare(_offsets[i], _offsets[i + 1] - _offsets[i], name);
+}
+
+size_t sorted_name_list::lower_bound(const string &name) const
+{
+  size_t low = 0, high = get_size();
+
+  while (low < high) {
+    size_t mid = low + (high - low) / 2;
+
+    if (compare(mid, name) < 0)
+      low = mid + 1;
+    else
+      high = mid;
+  }
+
+  return low;
+}
+
+bool sorted_name_list::contains(const string &name) const
+{
+  size_t i = lower_bound(name);
+
+  return i < get_size() && compare(i, name) == 0;
+}
+
+sorted_name_list::ptr sorted_name_list::add(const string &name) const
+{
+  size_t i = lower_bound(name);
+
+  if (i < get_size() && compare(i, name) == 0)
+    return ptr();
+
+  return replace(i, i, &name);
+}
+
+sorted_name_list::ptr sorted_name_list::remove(const string &name) const
+{
+  size_t i = lower_bound(name);
+
+  if (i == get_size() || compare(i, name) != 0)
+    return ptr();
+
+  return replace(i, i + 1, NULL);
+}
+
+sorted_name_list::ptr sorted_name_list::replace(size_t first, size_t last, const string *name) const
+{
+  boost::shared_ptr<sorted_name_list> l(new sorted_name_list());
+  uint32_t removed = _offsets[last] - _offsets[first];
+  uint32_t added = name ? name->size() : 0;
+
+  l->_names.reserve(_names.size() - removed + added);
+  l->_names.append(_names, 0, _offsets[first]);
+
+  if (name)
+    l->_names += *name;
+
+  l->_names.append(_names, _offsets[last], string::npos);
+
+  l->_offsets.reserve(_offsets.size() - (last - first) + (name ? 1 : 0));
+  l->_offsets.assign(_offsets.begin(), _offsets.begin() + first + 1);
+
+  if (name)
+    l->_offsets.push_back(_offsets[first] + added);
+
+  for (size_t i = last + 1; i < _offsets.size(); i++)
+    l->_offsets.push_back(_offsets[i] - removed + added);
+
+  return l;
+}
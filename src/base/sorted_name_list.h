@@ -0,0 +1,87 @@
+/*
+ * base/sorted_name_list.h
+ * -------------------------------------------------------------------------
+ * Immutable, sorted list of names packed into a single buffer.
+ * -------------------------------------------------------------------------
+ *
+ * Copyright (c) 2012, Tarick Bedeir.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef S3_BASE_SORTED_NAME_LIST_H
+#define S3_BASE_SORTED_NAME_LIST_H
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+#include <boost/smart_ptr.hpp>
+#include <boost/utility.hpp>
+
+namespace s3
+{
+  namespace base
+  {
+    // the names are stored back to back in one string, with a table of
+    // offsets, so a list costs two allocations however many names it holds,
+    // and a lookup is a binary search.
+    //
+    // lists don't change once built (add() and remove() return new lists),
+    // so they can be shared between threads without locking.
+    class sorted_name_list : boost::noncopyable
+    {
+    public:
+      typedef boost::shared_ptr<const sorted_name_list> ptr;
+
+      // sorts "names" and drops duplicates (leaving "names" in that state)
+      explicit sorted_name_list(std::vector<std::string> *names);
+
+      inline size_t get_size() const { return _offsets.size() - 1; }
+      inline bool is_empty() const { return _offsets.size() == 1; }
+
+      inline std::string get(size_t i) const
+      {
+        return _names.substr(_offsets[i], _offsets[i + 1] - _offsets[i]);
+      }
+
+      bool contains(const std::string &name) const;
+
+      // copies of this list with "name" added or removed, or an empty
+      // pointer if that wouldn't change the list
+      ptr add(const std::string &name) const;
+      ptr remove(const std::string &name) const;
+
+      inline size_t get_resident_size() const
+      {
+        return sizeof(*this) + _names.capacity() + _offsets.capacity() * sizeof(uint32_t);
+      }
+
+    private:
+      inline sorted_name_list() { }
+
+      int compare(size_t i, const std::string &name) const;
+      size_t lower_bound(const std::string &name) const;
+
+      // a copy with names [first, last) replaced by "name" (if not NULL)
+      ptr replace(size_t first, size_t last, const std::string *name) const;
+
+      std::string _names;
+
+      // name i runs from _offsets[i] to _offsets[i + 1]
+      std::vector<uint32_t> _offsets;
+    };
+  }
+}
+
+#endif
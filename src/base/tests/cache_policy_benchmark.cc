@@ -0,0 +1,152 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "base/cache_policy.h"
+#include "base/hash_lru_cache_map.h"
+#include "base/timer.h"
+
+using std::cerr;
+using std::cout;
+using std::endl;
+using std::ifstream;
+using std::string;
+using std::vector;
+
+using s3::base::default_removable_test;
+using s3::base::hash_lru_cache_map;
+using s3::base::lru_policy;
+using s3::base::timer;
+using s3::base::tiny_lfu_policy;
+
+namespace
+{
+  const size_t WORKING_SET = 20000;
+  const size_t ACCESSES = 2000000;
+  const size_t SCAN_SIZE = 200000;
+  const size_t SCAN_INTERVAL = 500000;
+  const double ZIPF_EXPONENT = 0.9;
+
+  // one path per line, e.g. pulled out of a debug log
+  bool load_trace(const char *file, vector<string> *trace)
+  {
+    ifstream f(file);
+    string line;
+
+    if (!f.good())
+      return false;
+
+    while (getline(f, line))
+      if (!line.empty())
+        trace->push_back(line);
+
+    return true;
+  }
+
+  // zipf-distributed accesses to a working set, with a walk over a large,
+  // otherwise untouched tree (as "find /" or a backup would do) every so
+  // often
+  void build_trace(vector<string> *trace)
+  {
+    vector<double> cdf(WORKING_SET);
+    double sum = 0;
+    unsigned int seed = 1;
+    char buf[64];
+
+    for (size_t i = 0; i < WORKING_SET; i++) {
+      sum += 1.0 / pow(static_cast<double>(i + 1), ZIPF_EXPONENT);
+      cdf[i] = sum;
+    }
+
+    for (size_t i = 0, scans = 0; i < ACCESSES; i++) {
+      double r;
+      size_t lo = 0, hi = WORKING_SET - 1;
+
+      if (i > 0 && i % SCAN_INTERVAL == 0) {
+        for (size_t j = 0; j < SCAN_SIZE; j++) {
+          snprintf(buf, sizeof(buf), "/backup/%zu/file-%zu", scans, j);
+          trace->push_back(buf);
+        }
+
+        scans++;
+      }
+
+      seed = seed * 1103515245 + 12345;
+      r = (static_cast<double>((seed >> 8) & 0xffffff) / 0x1000000) * sum;
+
+      while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+
+        if (cdf[mid] < r)
+          lo = mid + 1;
+        else
+          hi = mid;
+      }
+
+      snprintf(buf, sizeof(buf), "/home/user/file-%zu", lo);
+      trace->push_back(buf);
+    }
+  }
+
+  template <class policy_type>
+  void run(const char *name, size_t size, const vector<string> &trace)
+  {
+    hash_lru_cache_map<string, int, default_removable_test<int>, string, policy_type> m(size);
+    size_t hits = 0;
+    double start = timer::get_current_time(), elapsed;
+
+    for (size_t i = 0; i < trace.size(); i++) {
+      if (m.find(trace[i]))
+        hits++;
+      else
+        m[trace[i]] = 1;
+    }
+
+    elapsed = timer::get_current_time() - start;
+
+    printf(
+      "%-10s %10zu %10.2f %% hits %10.1f ns/op\n",
+      name,
+      size,
+      100.0 * hits / trace.size(),
+      elapsed / trace.size() * 1.0e9);
+  }
+}
+
+int main(int argc, char **argv)
+{
+  vector<string> trace;
+  vector<size_t> sizes;
+
+  if (argc > 1) {
+    if (!load_trace(argv[1], &trace)) {
+      cerr << "failed to read trace from " << argv[1] << endl;
+      return 1;
+    }
+
+    for (int i = 2; i < argc; i++)
+      sizes.push_back(strtoul(argv[i], NULL, 0));
+  } else {
+    build_trace(&trace);
+  }
+
+  if (sizes.empty()) {
+    sizes.push_back(1000);
+    sizes.push_back(5000);
+    sizes.push_back(10000);
+  }
+
+  cout << trace.size() << " accesses" << endl;
+
+  for (size_t i = 0; i < sizes.size(); i++) {
+    run<lru_policy>("lru", sizes[i], trace);
+    run<tiny_lfu_policy>("tiny_lfu", sizes[i], trace);
+  }
+
+  return 0;
+}
@@ -0,0 +1,152 @@
+#include <stdlib.h>
+
+#include <string>
+#include <boost/lexical_cast.hpp>
+#include <gtest/gtest.h>
+
+#include "base/clock_pro_map.h"
+
+using boost::lexical_cast;
+using std::string;
+
+using s3::base::clock_pro_map;
+
+namespace
+{
+  typedef clock_pro_map<string, int> int_map;
+
+  inline string key(int i)
+  {
+    return lexical_cast<string>(i);
+  }
+}
+
+TEST(clock_pro_map, find_and_replace)
+{
+  int_map m(100);
+  int v = 0;
+
+  EXPECT_FALSE(m.find("a", &v));
+
+  m.insert("a", 1, 10);
+  m.insert("b", 2, 10);
+
+  ASSERT_TRUE(m.find("a", &v));
+  EXPECT_EQ(1, v);
+
+  m.insert("a", 3, 20);
+
+  ASSERT_TRUE(m.find("a", &v));
+  EXPECT_EQ(3, v);
+  EXPECT_EQ(static_cast<size_t>(2), m.get_size());
+  EXPECT_EQ(static_cast<size_t>(30), m.get_weight());
+
+  m.erase("a");
+  m.erase("missing");
+
+  EXPECT_FALSE(m.find("a", &v));
+  EXPECT_EQ(static_cast<size_t>(10), m.get_weight());
+}
+
+TEST(clock_pro_map, stays_within_capacity)
+{
+  int_map m(1000);
+
+  srand(12345);
+
+  for (int i = 0; i < 10000; i++) {
+    int v;
+
+    m.insert(key(rand() % 500), i, 1 + rand() % 50);
+    m.find(key(rand() % 500), &v);
+
+    ASSERT_LE(m.get_weight(), m.get_capacity());
+    ASSERT_LE(m.get_cold_target(), m.get_capacity());
+  }
+}
+
+TEST(clock_pro_map, too_heavy)
+{
+  int_map m(100);
+  int v;
+
+  m.insert("a", 1, 10);
+  m.insert("a", 2, 101);
+
+  EXPECT_FALSE(m.find("a", &v));
+  EXPECT_EQ(static_cast<size_t>(0), m.get_weight());
+}
+
+TEST(clock_pro_map, evicts_unused_before_used)
+{
+  int_map m(10);
+  int v;
+
+  for (int i = 0; i < 10; i++)
+    m.insert(key(i), i, 1);
+
+  for (int i = 0; i < 5; i++)
+    m.find(key(i), &v);
+
+  for (int i = 10; i < 15; i++)
+    m.insert(key(i), i, 1);
+
+  for (int i = 0; i < 5; i++)
+    EXPECT_TRUE(m.find(key(i), &v)) << i;
+
+  for (int i = 5; i < 10; i++)
+    EXPECT_FALSE(m.find(key(i), &v)) << i;
+}
+
+TEST(clock_pro_map, refault_comes_back_hot)
+{
+  int_map m(10);
+  int v;
+
+  for (int i = 0; i < 20; i++)
+    m.insert(key(i), i, 1);
+
+  EXPECT_FALSE(m.find(key(5), &v));
+  EXPECT_EQ(static_cast<size_t>(0), m.get_hot_weight());
+
+  // evicted during its test period, so it was needed sooner than the cold
+  // share allowed for
+  m.insert(key(5), 5, 1);
+
+  EXPECT_EQ(static_cast<size_t>(1), m.get_hot_weight());
+  EXPECT_GT(m.get_cold_target(), static_cast<size_t>(1));
+}
+
+TEST(clock_pro_map, survives_scan)
+{
+  const int HOT = 50, CAPACITY = 100;
+  int_map m(CAPACITY);
+  int v, hits = 0;
+
+  // establish a working set, used repeatedly
+  for (int round = 0; round < 10; round++) {
+    for (int i = 0; i < HOT; i++) {
+      if (!m.find(key(i), &v))
+        m.insert(key(i), i, 1);
+    }
+  }
+
+  // a one-time scan, much larger than the map, with the working set used
+  // again after every two capacities' worth of it (which would flush an
+  // LRU map each time)
+  for (int i = 1; i <= 20 * CAPACITY; i++) {
+    m.insert("scan-" + key(i), i, 1);
+
+    if (i % (2 * CAPACITY) == 0) {
+      for (int j = 0; j < HOT; j++) {
+        if (m.find(key(j), &v))
+          hits++;
+        else
+          m.insert(key(j), j, 1);
+      }
+    }
+  }
+
+  // nearly all lookups of the working set should hit
+  EXPECT_GT(hits, 10 * HOT * 9 / 10);
+}
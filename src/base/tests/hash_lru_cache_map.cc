@@ -0,0 +1,364 @@
+#include <stdio.h>
+
+#include <map>
+#include <string>
+#include <boost/bind.hpp>
+#include <gtest/gtest.h>
+
+#include "base/hash_lru_cache_map.h"
+
+using boost::bind;
+using std::map;
+using std::string;
+
+using s3::base::default_removable_test;
+using s3::base::hash_lru_cache_map;
+using s3::base::tiny_lfu_policy;
+
+namespace
+{
+  inline bool remove_if_over_100(const int &i)
+  {
+    return (i > 100);
+  }
+
+  inline bool ptr_over_100(int * const &p)
+  {
+    return (*p > 100);
+  }
+
+  void append_to_string(const string &key, const int &i, string *str)
+  {
+    *str += (str->empty() ? "" : ",");
+    *str += key;
+  }
+
+  void append_ptr_to_string(const string &key, int * const &p, string *str)
+  {
+    append_to_string(key, *p, str);
+  }
+
+  template <class T>
+  string oldest(const T &t)
+  {
+    string s;
+
+    t.for_each_oldest(bind(append_to_string, _1, _2, &s));
+
+    return s;
+  }
+
+  template <class T>
+  string newest(const T &t)
+  {
+    string s;
+
+    t.for_each_newest(bind(append_to_string, _1, _2, &s));
+
+    return s;
+  }
+
+  template <class T>
+  string newest_ptr(const T &t)
+  {
+    string s;
+
+    t.for_each_newest(bind(append_ptr_to_string, _1, _2, &s));
+
+    return s;
+  }
+}
+
+TEST(hash_lru_cache_map, no_remove_condition)
+{
+  hash_lru_cache_map<string, int> c(5);
+
+  c["e1"] = 1;
+  c["e2"] = 2;
+  c["e3"] = 101;
+  c["e4"] = 102;
+
+  EXPECT_EQ(static_cast<size_t>(4), c.get_size());
+
+  EXPECT_EQ(string("e4,e3,e2,e1"), newest(c)) << "init, newest";
+  EXPECT_EQ(string("e1,e2,e3,e4"), oldest(c)) << "init, oldest";
+
+  c["e5"] = 200;
+  c["e6"] = 300;
+
+  EXPECT_EQ(string("e6,e5,e4,e3,e2"), newest(c)) << "add e6, newest";
+  EXPECT_EQ(string("e2,e3,e4,e5,e6"), oldest(c)) << "add e6, oldest";
+
+  EXPECT_EQ(2, c["e2"]);
+
+  EXPECT_EQ(string("e2,e6,e5,e4,e3"), newest(c)) << "get e2, newest";
+
+  c["e7"] = 400;
+
+  EXPECT_EQ(string("e7,e2,e6,e5,e4"), newest(c)) << "add e7, newest";
+
+  c.erase("e1");
+  c.erase("e2");
+
+  EXPECT_EQ(string("e7,e6,e5,e4"), newest(c)) << "erase e2, newest";
+  EXPECT_EQ(static_cast<size_t>(4), c.get_size());
+
+  c["e8"] = 500;
+  c["e1"] = 600;
+
+  EXPECT_EQ(string("e1,e8,e7,e6,e5"), newest(c)) << "re-add e1, newest";
+  EXPECT_EQ(600, c["e1"]);
+}
+
+TEST(hash_lru_cache_map, find_does_not_insert)
+{
+  hash_lru_cache_map<string, int> c(3);
+  int i = 0;
+
+  c["e1"] = 1;
+  c["e2"] = 2;
+  c["e3"] = 3;
+
+  EXPECT_TRUE(c.find("e4") == NULL);
+  EXPECT_FALSE(c.find("e4", &i));
+  EXPECT_EQ(static_cast<size_t>(3), c.get_size());
+  EXPECT_EQ(string("e3,e2,e1"), newest(c)) << "misses leave everything in place";
+
+  ASSERT_TRUE(c.find("e1") != NULL);
+  EXPECT_EQ(1, *c.find("e1"));
+  EXPECT_EQ(string("e1,e3,e2"), newest(c)) << "hit makes e1 newest";
+
+  EXPECT_TRUE(c.find("e2", &i));
+  EXPECT_EQ(2, i);
+}
+
+TEST(hash_lru_cache_map, peek_does_not_touch)
+{
+  hash_lru_cache_map<string, int> c(3);
+
+  c["e1"] = 1;
+  c["e2"] = 2;
+  c["e3"] = 3;
+
+  EXPECT_TRUE(c.peek("e4") == NULL);
+
+  ASSERT_TRUE(c.peek("e1") != NULL);
+  EXPECT_EQ(1, *c.peek("e1"));
+  EXPECT_EQ(string("e3,e2,e1"), newest(c)) << "peek leaves everything in place";
+}
+
+TEST(hash_lru_cache_map, remove_if_over_100)
+{
+  hash_lru_cache_map<string, int, remove_if_over_100> c(5);
+
+  c["e1"] = 1;
+  c["e2"] = 2;
+  c["e3"] = 101;
+  c["e4"] = 102;
+  c["e5"] = 200;
+
+  EXPECT_EQ(string("e5,e4,e3,e2,e1"), newest(c)) << "init, newest";
+
+  // e1 and e2 can't be removed, so they're set aside and e3 goes
+  c["e6"] = 300;
+
+  EXPECT_EQ(static_cast<size_t>(5), c.get_size());
+  EXPECT_EQ(string("e6,e5,e4,e2,e1"), newest(c)) << "add e6, newest";
+  EXPECT_EQ(string("e4,e5,e6,e1,e2"), oldest(c)) << "add e6, oldest";
+
+  // using a pinned entry puts it back in LRU order
+  EXPECT_EQ(2, c["e2"]);
+
+  EXPECT_EQ(string("e2,e6,e5,e4,e1"), newest(c)) << "get e2, newest";
+
+  c["e7"] = 400;
+
+  EXPECT_EQ(string("e7,e2,e6,e5,e1"), newest(c)) << "add e7, newest";
+
+  c["e8"] = 500;
+  c["e9"] = 600;
+
+  EXPECT_EQ(string("e9,e8,e7,e2,e1"), newest(c)) << "add e9, newest";
+
+  // e2 is pinned again on its way out of the LRU list
+  c["e10"] = 700;
+
+  EXPECT_EQ(string("e10,e9,e8,e2,e1"), newest(c)) << "add e10, newest";
+  EXPECT_EQ(string("e8,e9,e10,e1,e2"), oldest(c)) << "add e10, oldest";
+}
+
+TEST(hash_lru_cache_map, recheck_pinned)
+{
+  hash_lru_cache_map<string, int *, ptr_over_100> c(3);
+  int p1 = 1, p2 = 2, e1 = 101, e2 = 102, e3 = 103;
+
+  c["p1"] = &p1;
+  c["p2"] = &p2;
+  c["e1"] = &e1;
+  c["e2"] = &e2; // pins p1 and p2, evicts e1
+
+  EXPECT_EQ(string("e2,p2,p1"), newest_ptr(c)) << "add e2";
+
+  // p1 becomes removable without being touched, so the next insert
+  // should find it and evict it ahead of e2
+  p1 = 150;
+  c["e3"] = &e3;
+
+  EXPECT_EQ(string("e3,e2,p2"), newest_ptr(c)) << "add e3";
+  EXPECT_EQ(static_cast<size_t>(3), c.get_size());
+}
+
+TEST(hash_lru_cache_map, weight_limit)
+{
+  hash_lru_cache_map<string, int> c(100, 1000);
+
+  c["e1"] = 1;
+  c.set_weight("e1", 400);
+  c["e2"] = 2;
+  c.set_weight("e2", 400);
+  c["e3"] = 3;
+
+  EXPECT_EQ(static_cast<size_t>(800), c.get_weight());
+  EXPECT_EQ(string("e3,e2,e1"), newest(c)) << "under budget";
+
+  // puts us over, so e1 goes
+  c.set_weight("e3", 300);
+
+  EXPECT_EQ(static_cast<size_t>(700), c.get_weight());
+  EXPECT_EQ(string("e3,e2"), newest(c)) << "over budget";
+
+  // an entry that's over budget on its own stays
+  c.set_weight("e3", 5000);
+
+  EXPECT_EQ(static_cast<size_t>(5000), c.get_weight());
+  EXPECT_EQ(string("e3"), newest(c)) << "single entry over budget";
+
+  c.erase("e3");
+
+  EXPECT_EQ(static_cast<size_t>(0), c.get_weight());
+  EXPECT_EQ(static_cast<size_t>(0), c.get_size());
+}
+
+template <class map_type>
+void check_against_std_map()
+{
+  const int KEYS = 5000;
+  const size_t MAX_SIZE = 1000;
+
+  map_type c(MAX_SIZE);
+  map<string, int> m;
+  unsigned int seed = 1;
+
+  for (int i = 0; i < 100000; i++) {
+    char key[32];
+    int op;
+
+    seed = seed * 1103515245 + 12345;
+    op = (seed >> 16) % 3;
+
+    seed = seed * 1103515245 + 12345;
+    snprintf(key, sizeof(key), "/dir/%u", (seed >> 16) % KEYS);
+
+    if (op == 0) {
+      c[key] = i;
+      m[key] = i;
+
+    } else if (op == 1) {
+      c.erase(key);
+      m.erase(key);
+
+    } else {
+      int *v = c.find(key);
+
+      // the cache may have dropped the entry, but it mustn't return a stale
+      // or made-up value
+      if (v) {
+        ASSERT_EQ(m[key], *v) << "key " << key;
+      }
+    }
+
+    ASSERT_LE(c.get_size(), MAX_SIZE);
+  }
+}
+
+TEST(hash_lru_cache_map, matches_std_map)
+{
+  check_against_std_map<hash_lru_cache_map<string, int> >();
+}
+
+TEST(hash_lru_cache_map, tiny_lfu_matches_std_map)
+{
+  check_against_std_map<hash_lru_cache_map<string, int, default_removable_test<int>, string, tiny_lfu_policy> >();
+}
+
+namespace
+{
+  // the fraction of accesses to a hot set that hit while a scan, 25 times
+  // the size of the map, runs alongside them
+  template <class map_type>
+  double get_hot_hit_rate_during_scan()
+  {
+    const int HOT = 100;
+    const size_t MAX_SIZE = 200;
+
+    map_type c(MAX_SIZE);
+    char key[32];
+    int hits = 0, accesses = 0;
+
+    for (int pass = 0; pass < 15; pass++) {
+      for (int i = 0; i < HOT; i++) {
+        snprintf(key, sizeof(key), "/hot/%i", i);
+
+        if (!c.find(key))
+          c[key] = i;
+      }
+    }
+
+    for (int i = 0; i < 5000; i++) {
+      snprintf(key, sizeof(key), "/scan/%i", i);
+      c[key] = i;
+
+      if (i % 10 == 0) {
+        snprintf(key, sizeof(key), "/hot/%i", (i / 10) % HOT);
+
+        accesses++;
+
+        if (c.find(key))
+          hits++;
+        else
+          c[key] = i;
+      }
+
+      EXPECT_LE(c.get_size(), MAX_SIZE);
+    }
+
+    return static_cast<double>(hits) / accesses;
+  }
+}
+
+TEST(hash_lru_cache_map, tiny_lfu_resists_scan)
+{
+  double lru = get_hot_hit_rate_during_scan<hash_lru_cache_map<string, int> >();
+  double tiny_lfu = get_hot_hit_rate_during_scan<hash_lru_cache_map<string, int, default_removable_test<int>, string, tiny_lfu_policy> >();
+
+  EXPECT_LT(lru, 0.1) << "the scan flushes the hot set out of the LRU";
+  EXPECT_GT(tiny_lfu, 0.9) << "the hot set survives the scan";
+}
+
+TEST(hash_lru_cache_map, tiny_lfu_weight_limit)
+{
+  typedef hash_lru_cache_map<string, int, default_removable_test<int>, string, tiny_lfu_policy> map_type;
+
+  map_type c(100, 1000);
+  char key[32];
+
+  for (int i = 0; i < 1000; i++) {
+    snprintf(key, sizeof(key), "/e/%i", i);
+    c[key] = i;
+    c.set_weight(key, 100);
+
+    ASSERT_LE(c.get_weight(), static_cast<size_t>(1000));
+  }
+
+  EXPECT_EQ(static_cast<size_t>(10), c.get_size());
+}
@@ -0,0 +1,102 @@
+#include <string>
+#include <boost/bind.hpp>
+#include <boost/functional/hash.hpp>
+#include <boost/thread.hpp>
+#include <gtest/gtest.h>
+
+#include "base/hash_lru_cache_map.h"
+#include "base/interned_string.h"
+
+using std::string;
+
+using s3::base::hash_lru_cache_map;
+using s3::base::interned_string;
+
+TEST(interned_string, shares_storage)
+{
+  size_t base_count = interned_string::get_count();
+
+  {
+    interned_string a(string("/some/path")), b(string("/some/path")), c(string("/other/path"));
+
+    EXPECT_EQ(&a.str(), &b.str());
+    EXPECT_TRUE(a == b);
+    EXPECT_TRUE(a != c);
+    EXPECT_TRUE(a == string("/some/path"));
+    EXPECT_EQ(base_count + 2, interned_string::get_count());
+
+    interned_string d(a);
+
+    d = c;
+
+    EXPECT_TRUE(d == c);
+    EXPECT_EQ(base_count + 2, interned_string::get_count());
+  }
+
+  EXPECT_EQ(base_count, interned_string::get_count()) << "released when last reference goes";
+}
+
+namespace
+{
+  // each round copies a shared string and drops the copy, then interns a
+  // name of its own (often the last reference to it) and drops that too
+  void copy_and_release(const interned_string *shared, int id)
+  {
+    for (int i = 0; i < 10000; i++) {
+      interned_string copy(*shared);
+      interned_string own(string("/thread/") + static_cast<char>('a' + id) + static_cast<char>('a' + i % 8));
+
+      copy = own;
+    }
+  }
+}
+
+TEST(interned_string, concurrent_release)
+{
+  size_t base_count = interned_string::get_count();
+
+  {
+    interned_string shared(string("/shared"));
+    boost::thread_group threads;
+
+    for (int i = 0; i < 8; i++)
+      threads.create_thread(boost::bind(copy_and_release, &shared, i));
+
+    threads.join_all();
+
+    EXPECT_EQ(base_count + 1, interned_string::get_count());
+  }
+
+  EXPECT_EQ(base_count, interned_string::get_count());
+}
+
+TEST(interned_string, empty)
+{
+  interned_string a, b(string(""));
+
+  EXPECT_TRUE(a == b);
+  EXPECT_EQ(string(), a.str());
+  EXPECT_EQ(boost::hash<string>()(string()), a.get_hash());
+}
+
+TEST(interned_string, string_lookup)
+{
+  hash_lru_cache_map<interned_string, int, s3::base::default_removable_test<int>, string> c(10);
+  int i = 0;
+
+  c[interned_string(string("e1"))] = 1;
+  c[interned_string(string("e2"))] = 2;
+
+  EXPECT_EQ(boost::hash<string>()("e1"), interned_string(string("e1")).get_hash());
+
+  ASSERT_TRUE(c.find("e1") != NULL);
+  EXPECT_EQ(1, *c.find("e1"));
+  EXPECT_TRUE(c.find("e2", &i));
+  EXPECT_EQ(2, i);
+  EXPECT_TRUE(c.find("e3") == NULL);
+
+  c.erase("e1");
+
+  EXPECT_TRUE(c.find("e1") == NULL);
+  EXPECT_EQ(static_cast<size_t>(1), c.get_size());
+}
@@ -0,0 +1,121 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "base/hash_lru_cache_map.h"
+#include "base/lru_cache_map.h"
+#include "base/timer.h"
+
+using std::cerr;
+using std::cout;
+using std::endl;
+using std::string;
+using std::vector;
+
+using s3::base::hash_lru_cache_map;
+using s3::base::lru_cache_map;
+using s3::base::timer;
+
+namespace
+{
+  // every 100th entry is pinned (think open files)
+  inline bool is_removable(const int &i)
+  {
+    return (i % 100) != 0;
+  }
+
+  void build_keys(size_t count, size_t offset, vector<string> *keys)
+  {
+    char buf[64];
+
+    keys->resize(count);
+
+    for (size_t i = 0; i < count; i++) {
+      snprintf(buf, sizeof(buf), "/some/directory/tree/file-%zu", i + offset);
+      (*keys)[i] = buf;
+    }
+  }
+
+  void report(const char *name, const char *phase, size_t ops, double elapsed)
+  {
+    printf("%-20s %-10s %10.1f ns/op\n", name, phase, elapsed / ops * 1.0e9);
+  }
+
+  // "lookup" goes through operator [] for lru_cache_map, since that's what
+  // callers had to use with it
+  template <class map_type>
+  inline bool lookup(map_type *m, const string &key, const lru_cache_map<string, int, is_removable> *)
+  {
+    return (*m)[key] != 0;
+  }
+
+  template <class map_type>
+  inline bool lookup(map_type *m, const string &key, const hash_lru_cache_map<string, int, is_removable> *)
+  {
+    return m->find(key) != NULL;
+  }
+
+  template <class map_type>
+  void run(const char *name, size_t size, const vector<string> &keys, const vector<string> &new_keys)
+  {
+    map_type m(size);
+    double start;
+    size_t found = 0;
+
+    start = timer::get_current_time();
+
+    for (size_t i = 0; i < size; i++)
+      m[keys[i]] = i + 1;
+
+    report(name, "fill", size, timer::get_current_time() - start);
+
+    start = timer::get_current_time();
+
+    // stride through the keys so that lookups don't follow insertion order
+    for (size_t i = 0, j = 0; i < size; i++, j = (j + 7919) % size)
+      found += lookup(&m, keys[j], static_cast<const map_type *>(NULL)) ? 1 : 0;
+
+    report(name, "lookup", size, timer::get_current_time() - start);
+
+    start = timer::get_current_time();
+
+    // every insert from here on evicts something
+    for (size_t i = 0; i < new_keys.size(); i++)
+      m[new_keys[i]] = i + 1;
+
+    report(name, "evict", new_keys.size(), timer::get_current_time() - start);
+
+    if (found != size)
+      cerr << name << ": only found " << found << " of " << size << " entries" << endl;
+  }
+}
+
+int main(int argc, char **argv)
+{
+  vector<size_t> sizes;
+
+  if (argc > 1) {
+    for (int i = 1; i < argc; i++)
+      sizes.push_back(strtoul(argv[i], NULL, 0));
+  } else {
+    sizes.push_back(1000000);
+    sizes.push_back(10000000);
+  }
+
+  for (size_t i = 0; i < sizes.size(); i++) {
+    vector<string> keys, new_keys;
+
+    build_keys(sizes[i], 0, &keys);
+    build_keys(sizes[i] / 10, sizes[i], &new_keys);
+
+    cout << sizes[i] << " entries:" << endl;
+
+    run<lru_cache_map<string, int, is_removable> >("lru_cache_map", sizes[i], keys, new_keys);
+    run<hash_lru_cache_map<string, int, is_removable> >("hash_lru_cache_map", sizes[i], keys, new_keys);
+  }
+
+  return 0;
+}
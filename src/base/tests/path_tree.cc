@@ -0,0 +1,218 @@
+#include <string>
+#include <vector>
+#include <gtest/gtest.h>
+
+#include "base/path_tree.h"
+
+using std::string;
+using std::vector;
+
+using s3::base::path_tree;
+using s3::base::PT_ABSENT;
+using s3::base::PT_PRESENT;
+using s3::base::PT_UNKNOWN;
+
+namespace
+{
+  const time_t NOW = 1000;
+  const time_t LATER = 2000;
+
+  vector<string> make_list(const char *a, const char *b = NULL, const char *c = NULL)
+  {
+    vector<string> v;
+
+    v.push_back(a);
+
+    if (b)
+      v.push_back(b);
+
+    if (c)
+      v.push_back(c);
+
+    return v;
+  }
+
+  string children(const path_tree &t, const string &path)
+  {
+    vector<string> names;
+    string s;
+
+    if (!t.get_children(path, NOW, &names))
+      return "(incomplete)";
+
+    for (vector<string>::const_iterator itor = names.begin(); itor != names.end(); ++itor)
+      s += (s.empty() ? "" : ",") + *itor;
+
+    return s;
+  }
+}
+
+TEST(path_tree, insert_creates_ancestors)
+{
+  path_tree t;
+
+  t.insert("a/b/c", LATER);
+
+  EXPECT_EQ(static_cast<size_t>(3), t.get_size());
+  EXPECT_EQ(PT_PRESENT, t.find("", NOW));
+  EXPECT_EQ(PT_PRESENT, t.find("a", NOW));
+  EXPECT_EQ(PT_PRESENT, t.find("a/b", NOW));
+  EXPECT_EQ(PT_PRESENT, t.find("a/b/c", NOW));
+  EXPECT_EQ(PT_UNKNOWN, t.find("a/b/d", NOW)) << "nothing listed, so can't tell";
+  EXPECT_EQ(PT_UNKNOWN, t.find("a/b/c", LATER)) << "expired";
+
+  t.insert("a/b/d", LATER);
+
+  EXPECT_EQ(static_cast<size_t>(4), t.get_size()) << "shares a and b";
+  EXPECT_EQ(PT_PRESENT, t.has_children("a/b", NOW));
+  EXPECT_EQ(PT_UNKNOWN, t.has_children("a/b/c", NOW));
+  EXPECT_EQ("(incomplete)", children(t, "a/b"));
+}
+
+TEST(path_tree, listing_is_authoritative)
+{
+  path_tree t;
+
+  t.set_children("dir", make_list("z", "x", "y"), LATER);
+
+  EXPECT_EQ("x,y,z", children(t, "dir"));
+  EXPECT_EQ(PT_PRESENT, t.find("dir/x", NOW));
+  EXPECT_EQ(PT_ABSENT, t.find("dir/w", NOW));
+  EXPECT_EQ(PT_ABSENT, t.find("dir/w/v", NOW)) << "under a missing name";
+  EXPECT_EQ(PT_UNKNOWN, t.find("dir/w", LATER)) << "listing expired";
+  EXPECT_EQ(PT_UNKNOWN, t.find("other", NOW)) << "root wasn't listed";
+
+  t.set_children("dir/x", vector<string>(), LATER);
+
+  EXPECT_EQ(PT_ABSENT, t.has_children("dir/x", NOW));
+  EXPECT_EQ(PT_UNKNOWN, t.has_children("dir/x", LATER));
+  EXPECT_EQ("", children(t, "dir/x"));
+}
+
+TEST(path_tree, relisting_keeps_surviving_subtrees)
+{
+  path_tree t;
+
+  t.set_children("d", make_list("a", "b", "c"), LATER);
+  t.set_children("d/b", make_list("1", "2"), LATER);
+  t.set_children("d/c", make_list("3"), LATER);
+
+  EXPECT_EQ(static_cast<size_t>(7), t.get_size());
+
+  t.set_children("d", make_list("b", "e", "b"), LATER);
+
+  EXPECT_EQ("b,e", children(t, "d"));
+  EXPECT_EQ("1,2", children(t, "d/b"));
+  EXPECT_EQ(PT_ABSENT, t.find("d/c", NOW));
+  EXPECT_EQ(static_cast<size_t>(5), t.get_size());
+}
+
+TEST(path_tree, erase)
+{
+  path_tree t;
+
+  t.set_children("", make_list("d", "f"), LATER);
+  t.set_children("d", make_list("a", "b"), LATER);
+  t.insert("d/a/deep/er", LATER);
+
+  t.erase("d/a");
+
+  EXPECT_EQ(PT_ABSENT, t.find("d/a", NOW)) << "parent listing still complete";
+  EXPECT_EQ(PT_ABSENT, t.find("d/a/deep/er", NOW));
+  EXPECT_EQ("b", children(t, "d"));
+
+  t.erase("d/missing");
+  t.erase("no/such/parent");
+
+  t.erase_children("d");
+
+  EXPECT_EQ(PT_PRESENT, t.find("d", NOW));
+  EXPECT_EQ(PT_UNKNOWN, t.find("d/b", NOW));
+  EXPECT_EQ(PT_UNKNOWN, t.has_children("d", NOW));
+  EXPECT_EQ(static_cast<size_t>(2), t.get_size());
+
+  t.insert("d/new", LATER);
+
+  EXPECT_EQ(PT_PRESENT, t.has_children("d", NOW));
+
+  t.erase("d");
+
+  EXPECT_EQ(PT_ABSENT, t.find("d", NOW));
+  EXPECT_EQ(static_cast<size_t>(1), t.get_size());
+
+  t.clear();
+
+  EXPECT_EQ(static_cast<size_t>(0), t.get_size());
+  EXPECT_EQ(PT_UNKNOWN, t.find("f", NOW));
+}
+
+TEST(path_tree, subtree_listed)
+{
+  path_tree t;
+
+  t.insert("top/a/1", LATER);
+  t.insert("top/a/2", LATER);
+  t.insert("top/b", LATER);
+
+  EXPECT_EQ(PT_UNKNOWN, t.find("top/c", NOW));
+
+  t.set_subtree_listed("top", LATER);
+
+  EXPECT_EQ(PT_ABSENT, t.find("top/c", NOW));
+  EXPECT_EQ(PT_ABSENT, t.find("top/a/3", NOW));
+  EXPECT_EQ(PT_ABSENT, t.has_children("top/b", NOW));
+  EXPECT_EQ("1,2", children(t, "top/a"));
+  EXPECT_EQ("(incomplete)", children(t, ""));
+}
+
+TEST(path_tree, generations_are_per_directory)
+{
+  path_tree t;
+  uint64_t dir_gen, other_gen;
+
+  t.set_children("", make_list("dir", "other"), LATER);
+
+  dir_gen = t.watch("dir");
+  other_gen = t.watch("other");
+
+  EXPECT_EQ(PT_UNKNOWN, t.find("dir/x", NOW)) << "watching doesn't list";
+
+  t.mark_changed("other");
+  t.insert("other/new", LATER);
+
+  EXPECT_FALSE(t.children_changed_since("dir", dir_gen)) << "change elsewhere";
+  EXPECT_FALSE(t.subtree_changed_since("dir", dir_gen));
+  EXPECT_TRUE(t.children_changed_since("other", other_gen));
+  EXPECT_TRUE(t.subtree_changed_since("", 0)) << "root sees everything";
+
+  dir_gen = t.watch("dir");
+  t.mark_changed("dir/sub");
+
+  EXPECT_FALSE(t.children_changed_since("dir", dir_gen)) << "grandchildren only";
+  EXPECT_TRUE(t.subtree_changed_since("dir", dir_gen));
+}
+
+TEST(path_tree, generation_survives_erase)
+{
+  path_tree t;
+  uint64_t gen;
+
+  gen = t.watch("a/b/c");
+
+  // erasing an ancestor takes c with it; a new c mustn't look unchanged
+  t.mark_changed("a");
+  t.erase("a/b");
+
+  EXPECT_TRUE(t.children_changed_since("a/b/c", gen)) << "erased";
+
+  t.insert("a/b/c", LATER);
+
+  EXPECT_TRUE(t.children_changed_since("a/b/c", gen)) << "recreated";
+  EXPECT_TRUE(t.subtree_changed_since("a/b/c", gen));
+
+  gen = t.watch("a/b/c");
+  t.clear();
+  t.watch("a/b/c");
+
+  EXPECT_TRUE(t.children_changed_since("a/b/c", gen)) << "cleared";
+}
@@ -0,0 +1,117 @@
+#include <gtest/gtest.h>
+
+#include "base/readahead_window.h"
+
+using s3::base::readahead_window;
+
+namespace
+{
+  const size_t KB = 1024;
+  const size_t READ_SIZE = 128 * KB;
+  const size_t MIN_SIZE = 256 * KB, MAX_SIZE = 4096 * KB;
+
+  // reads "count" blocks of READ_SIZE from "offset", and returns the end of
+  // what's been requested ahead
+  off_t read_sequentially(readahead_window *w, off_t offset, int count, off_t ahead_end)
+  {
+    for (int i = 0; i < count; i++) {
+      off_t o = offset + i * READ_SIZE, ahead_offset = 0;
+      size_t ahead_size = 0;
+
+      if (w->on_read(o, READ_SIZE, &ahead_offset, &ahead_size)) {
+        EXPECT_GE(ahead_offset, static_cast<off_t>(o + READ_SIZE));
+        ahead_end = ahead_offset + ahead_size;
+      }
+
+      EXPECT_LE(ahead_end - static_cast<off_t>(o + READ_SIZE), static_cast<off_t>(MAX_SIZE + MAX_SIZE / 2));
+    }
+
+    return ahead_end;
+  }
+}
+
+TEST(readahead_window, detects_sequential)
+{
+  readahead_window w(MIN_SIZE, MAX_SIZE);
+  off_t ahead_offset;
+  size_t ahead_size;
+
+  EXPECT_FALSE(w.on_read(0, READ_SIZE, &ahead_offset, &ahead_size));
+  EXPECT_FALSE(w.is_sequential());
+
+  ASSERT_TRUE(w.on_read(READ_SIZE, READ_SIZE, &ahead_offset, &ahead_size));
+  EXPECT_TRUE(w.is_sequential());
+  EXPECT_EQ(static_cast<off_t>(2 * READ_SIZE), ahead_offset);
+  EXPECT_EQ(MIN_SIZE, ahead_size);
+}
+
+TEST(readahead_window, grows_while_reader_keeps_pace)
+{
+  readahead_window w(MIN_SIZE, MAX_SIZE);
+  off_t ahead_end;
+
+  ahead_end = read_sequentially(&w, 0, 200, 0);
+
+  EXPECT_EQ(MAX_SIZE, w.get_size());
+  EXPECT_GT(ahead_end, static_cast<off_t>(200 * READ_SIZE));
+}
+
+TEST(readahead_window, no_requests_between_triggers)
+{
+  readahead_window w(MIN_SIZE, MAX_SIZE);
+  off_t ahead_offset;
+  size_t ahead_size;
+
+  read_sequentially(&w, 0, 2, 0);
+
+  // the first window (MIN_SIZE past the second read) is still more than
+  // half ahead of this read
+  EXPECT_FALSE(w.on_read(2 * READ_SIZE, 1, &ahead_offset, &ahead_size));
+}
+
+TEST(readahead_window, shrinks_on_seek)
+{
+  readahead_window w(MIN_SIZE, MAX_SIZE);
+  off_t ahead_offset;
+  size_t ahead_size;
+
+  read_sequentially(&w, 0, 200, 0);
+  ASSERT_EQ(MAX_SIZE, w.get_size());
+
+  EXPECT_FALSE(w.on_read(1000 * MAX_SIZE, READ_SIZE, &ahead_offset, &ahead_size));
+  EXPECT_EQ(MAX_SIZE / 2, w.get_size());
+  EXPECT_FALSE(w.is_sequential());
+
+  // picks up again from the new position
+  ASSERT_TRUE(w.on_read(1000 * MAX_SIZE + READ_SIZE, READ_SIZE, &ahead_offset, &ahead_size));
+  EXPECT_EQ(static_cast<off_t>(1000 * MAX_SIZE + 2 * READ_SIZE), ahead_offset);
+  EXPECT_EQ(MAX_SIZE / 2, ahead_size);
+}
+
+TEST(readahead_window, random_reads_never_trigger)
+{
+  readahead_window w(MIN_SIZE, MAX_SIZE);
+  off_t ahead_offset;
+  size_t ahead_size;
+
+  for (int i = 0; i < 100; i++)
+    EXPECT_FALSE(w.on_read(((i * 7919) % 101) * 10 * MAX_SIZE, READ_SIZE, &ahead_offset, &ahead_size));
+
+  EXPECT_EQ(MIN_SIZE, w.get_size());
+}
+
+TEST(readahead_window, tolerates_reordering)
+{
+  readahead_window w(MIN_SIZE, MAX_SIZE);
+  off_t ahead_offset;
+  size_t ahead_size;
+
+  read_sequentially(&w, 0, 4, 0);
+
+  // two reads in flight at once, arriving in the wrong order
+  w.on_read(5 * READ_SIZE, READ_SIZE, &ahead_offset, &ahead_size);
+  w.on_read(4 * READ_SIZE, READ_SIZE, &ahead_offset, &ahead_size);
+
+  EXPECT_TRUE(w.is_sequential());
+  EXPECT_GT(w.get_size(), MIN_SIZE);
+}
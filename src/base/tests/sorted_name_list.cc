@@ -0,0 +1,98 @@
+#include <string>
+#include <vector>
+#include <gtest/gtest.h>
+
+#include "base/sorted_name_list.h"
+
+using std::string;
+using std::vector;
+
+using s3::base::sorted_name_list;
+
+namespace
+{
+  string join(const sorted_name_list &l)
+  {
+    string s;
+
+    for (size_t i = 0; i < l.get_size(); i++)
+      s += (i ? "," : "") + l.get(i);
+
+    return s;
+  }
+
+  sorted_name_list::ptr make(const char *a = NULL, const char *b = NULL, const char *c = NULL)
+  {
+    vector<string> v;
+
+    if (a)
+      v.push_back(a);
+
+    if (b)
+      v.push_back(b);
+
+    if (c)
+      v.push_back(c);
+
+    return sorted_name_list::ptr(new sorted_name_list(&v));
+  }
+}
+
+TEST(sorted_name_list, sorts_and_drops_duplicates)
+{
+  sorted_name_list::ptr l = make("c", "a", "c");
+
+  EXPECT_EQ(static_cast<size_t>(2), l->get_size());
+  EXPECT_EQ("a,c", join(*l));
+
+  EXPECT_TRUE(l->contains("a"));
+  EXPECT_TRUE(l->contains("c"));
+  EXPECT_FALSE(l->contains("b"));
+  EXPECT_FALSE(l->contains(""));
+  EXPECT_FALSE(l->contains("cc"));
+}
+
+TEST(sorted_name_list, empty)
+{
+  sorted_name_list::ptr l = make();
+
+  EXPECT_TRUE(l->is_empty());
+  EXPECT_FALSE(l->contains("a"));
+
+  l = l->add("a");
+
+  ASSERT_TRUE(l);
+  EXPECT_FALSE(l->is_empty());
+  EXPECT_EQ("a", join(*l));
+
+  l = l->remove("a");
+
+  ASSERT_TRUE(l);
+  EXPECT_TRUE(l->is_empty());
+}
+
+TEST(sorted_name_list, add)
+{
+  sorted_name_list::ptr l = make("b", "d");
+
+  EXPECT_EQ("a,b,d", join(*l->add("a")));
+  EXPECT_EQ("b,c,d", join(*l->add("c")));
+  EXPECT_EQ("b,d,e", join(*l->add("e")));
+  EXPECT_EQ("b,bb,d", join(*l->add("bb")));
+
+  EXPECT_FALSE(l->add("b")) << "already there";
+  EXPECT_EQ("b,d", join(*l)) << "original is unchanged";
+}
+
+TEST(sorted_name_list, remove)
+{
+  sorted_name_list::ptr l = make("alpha", "beta", "gamma");
+
+  EXPECT_EQ("beta,gamma", join(*l->remove("alpha")));
+  EXPECT_EQ("alpha,gamma", join(*l->remove("beta")));
+  EXPECT_EQ("alpha,beta", join(*l->remove("gamma")));
+
+  EXPECT_FALSE(l->remove("delta")) << "not there";
+  EXPECT_TRUE(l->remove("beta")->contains("gamma"));
+  EXPECT_FALSE(l->remove("beta")->contains("beta"));
+}
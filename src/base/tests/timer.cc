@@ -31,3 +31,22 @@ TEST(timer, current_time_et)
   EXPECT_GT(diff, 0.9);
   EXPECT_LT(diff, 1.1);
 }
+
+TEST(timer, coarse_time)
+{
+  time_t t;
+
+  // nothing updating it, so it's the same as time()
+  EXPECT_LE(abs(timer::get_coarse_time() - time(NULL)), 1);
+
+  timer::update_coarse_time();
+  t = timer::get_coarse_time();
+
+  sleep(2);
+
+  EXPECT_EQ(t, timer::get_coarse_time());
+
+  timer::stop_coarse_time();
+
+  EXPECT_GT(timer::get_coarse_time(), t);
+}
@@ -0,0 +1,167 @@
+#include <stdlib.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <gtest/gtest.h>
+
+#include "base/timing_wheel.h"
+
+using std::string;
+using std::vector;
+
+using s3::base::timing_wheel;
+
+namespace
+{
+  typedef timing_wheel<string> string_wheel;
+
+  const time_t START = 1000000;
+
+  // advances one second at a time, and returns the time at which "key"
+  // expired (or -1)
+  time_t step_until_expired(string_wheel *w, const string &key, time_t limit)
+  {
+    for (time_t t = w->get_time() + 1; t <= limit; t++) {
+      string_wheel::key_vector expired;
+
+      w->advance(t, &expired);
+
+      if (std::find(expired.begin(), expired.end(), key) != expired.end())
+        return t;
+    }
+
+    return -1;
+  }
+}
+
+TEST(timing_wheel, expires_at_deadline)
+{
+  string_wheel w(START);
+
+  w.schedule("a", START + 5);
+  w.schedule("b", START + 100);
+  w.schedule("c", START + 5000);
+  w.schedule("d", START + 300000);
+
+  EXPECT_EQ(static_cast<size_t>(4), w.get_size());
+
+  EXPECT_EQ(START + 5, step_until_expired(&w, "a", START + 10));
+  EXPECT_EQ(START + 100, step_until_expired(&w, "b", START + 200));
+  EXPECT_EQ(START + 5000, step_until_expired(&w, "c", START + 6000));
+  EXPECT_EQ(START + 300000, step_until_expired(&w, "d", START + 400000));
+
+  EXPECT_EQ(static_cast<size_t>(0), w.get_size());
+}
+
+TEST(timing_wheel, past_deadline_expires_on_next_step)
+{
+  string_wheel w(START);
+  string_wheel::key_vector expired;
+
+  w.schedule("a", START - 10);
+  w.advance(START + 1, &expired);
+
+  ASSERT_EQ(static_cast<size_t>(1), expired.size());
+  EXPECT_EQ("a", expired[0]);
+}
+
+TEST(timing_wheel, reschedule_replaces_deadline)
+{
+  string_wheel w(START);
+
+  w.schedule("a", START + 10);
+  w.schedule("a", START + 90);
+
+  EXPECT_EQ(static_cast<size_t>(1), w.get_size());
+  EXPECT_EQ(START + 90, step_until_expired(&w, "a", START + 200));
+
+  w.schedule("b", START + 5000);
+  w.schedule("b", START + 95);
+
+  EXPECT_EQ(START + 95, step_until_expired(&w, "b", START + 6000));
+}
+
+TEST(timing_wheel, cancel)
+{
+  string_wheel w(START);
+
+  w.schedule("a", START + 10);
+  w.schedule("b", START + 10);
+  w.cancel("a");
+  w.cancel("missing");
+
+  EXPECT_EQ(static_cast<size_t>(1), w.get_size());
+  EXPECT_EQ(-1, step_until_expired(&w, "a", START + 20));
+  EXPECT_EQ(static_cast<size_t>(0), w.get_size());
+}
+
+TEST(timing_wheel, large_jump)
+{
+  string_wheel w(START);
+  string_wheel::key_vector expired;
+
+  w.schedule("a", START + 10);
+  w.schedule("b", START + 100000);
+  w.schedule("c", START + 200000);
+
+  w.advance(START + 150000, &expired);
+
+  std::sort(expired.begin(), expired.end());
+
+  ASSERT_EQ(static_cast<size_t>(2), expired.size());
+  EXPECT_EQ("a", expired[0]);
+  EXPECT_EQ("b", expired[1]);
+
+  EXPECT_EQ(START + 200000, step_until_expired(&w, "c", START + 300000));
+}
+
+TEST(timing_wheel, beyond_last_level)
+{
+  string_wheel w(START);
+  time_t far = START + 400 * 24 * 60 * 60;
+  string_wheel::key_vector expired;
+
+  w.schedule("a", far);
+
+  // just short of the deadline, by way of a large jump
+  w.advance(far - 100, &expired);
+  EXPECT_TRUE(expired.empty());
+
+  EXPECT_EQ(far, step_until_expired(&w, "a", far + 10));
+}
+
+TEST(timing_wheel, matches_brute_force)
+{
+  const int KEYS = 200;
+  string_wheel w(START);
+  vector<time_t> deadlines(KEYS, 0);
+  time_t now = START;
+
+  srand(12345);
+
+  for (int round = 0; round < 2000; round++) {
+    string_wheel::key_vector expired;
+    int k = rand() % KEYS;
+    time_t step;
+
+    deadlines[k] = now + 1 + (rand() % 3 ? rand() % 200 : rand() % 20000);
+    w.schedule(string(1, 'a' + k % 26) + static_cast<char>('0' + k / 26), deadlines[k]);
+
+    // mostly small steps, with the odd large jump
+    step = (round % 500 == 499) ? 10000 : rand() % 5;
+    now += step;
+    w.advance(now, &expired);
+
+    for (string_wheel::key_vector::const_iterator itor = expired.begin(); itor != expired.end(); ++itor) {
+      int i = ((*itor)[1] - '0') * 26 + ((*itor)[0] - 'a');
+
+      EXPECT_NE(0, deadlines[i]);
+      EXPECT_LE(deadlines[i], now);
+      deadlines[i] = 0;
+    }
+
+    for (int i = 0; i < KEYS; i++)
+      EXPECT_TRUE(deadlines[i] == 0 || deadlines[i] > now);
+  }
+}
@@ -21,6 +21,7 @@ namespace
   const char *XML_3 = "<s3:a xmlns:s3=\"uri:something\"><s3:b><s3:c/></s3:b></s3:a>";
   const char *XML_4 = "<a><b>element_b_0</b><c>element_c_0</c><b>element_b_1</b></a>";
   const char *XML_5 = "<a><b><c>ec0</c><c>ec1</c></b><b><c>ec2</c><c>ec3</c></b><c>ec4</c><d><e><f><c>ec5</c></f></e></d></a>";
+  const char *XML_6 = "<a><b><k>k0</k><v>v0</v></b><b><k>k1</k><v>v1</v><w/></b></a>";
 
   void init()
   {
@@ -164,6 +165,30 @@ TEST(xml, find_list_c_multiple)
   }
 }
 
+TEST(xml, find_map_list)
+{
+  xml::document_ptr doc;
+  xml::element_map_list list;
+
+  init();
+
+  doc = xml::parse(XML_6);
+  ASSERT_FALSE(doc.get() == NULL);
+
+  ASSERT_EQ(0, xml::find(doc, "/a/b", &list));
+
+  ASSERT_EQ(static_cast<size_t>(2), list.size());
+
+  EXPECT_EQ(string("k0"), list.front()["k"]);
+  EXPECT_EQ(string("v0"), list.front()["v"]);
+  EXPECT_EQ(static_cast<size_t>(2), list.front().size());
+
+  EXPECT_EQ(string("k1"), list.back()["k"]);
+  EXPECT_EQ(string("v1"), list.back()["v"]);
+  EXPECT_EQ(string(""), list.back()["w"]);
+  EXPECT_EQ(static_cast<size_t>(3), list.back().size());
+}
+
 TEST(xml, find_missing)
 {
   xml::document_ptr doc;
@@ -23,6 +23,7 @@
 #define S3_BASE_TIMER_H
 
 #include <sys/time.h>
+#include <time.h>
 
 #include <string>
 
@@ -55,12 +56,30 @@ namespace s3
         return time_str;
       }
 
+      // seconds since the epoch, as of the last update_coarse_time() (falls
+      // back to time() if nothing is updating it).  for hot paths that check
+      // expiry times and can live with being up to a second behind.
+      inline static time_t get_coarse_time()
+      {
+        time_t t = s_coarse_time;
+
+        return t ? t : time(NULL);
+      }
+
+      inline static void update_coarse_time() { s_coarse_time = time(NULL); }
+      inline static void stop_coarse_time() { s_coarse_time = 0; }
+
       inline static void sleep(int sec)
       {
         struct timespec ts = { sec, 0 };
 
         nanosleep(&ts, NULL);
       }
+
+    private:
+      // written by one thread, and read without a lock -- a torn or stale
+      // read is at worst a second or so off
+      static volatile time_t s_coarse_time;
     };
   }
 }
@@ -0,0 +1,260 @@
+/*
+ * base/timing_wheel.h
+ * -------------------------------------------------------------------------
+ * Hierarchical timing wheel for tracking many deadlines at once.
+ * -------------------------------------------------------------------------
+ *
+ * Copyright (c) 2012, Tarick Bedeir.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef S3_BASE_TIMING_WHEEL_H
+#define S3_BASE_TIMING_WHEEL_H
+
+#include <time.h>
+
+#include <list>
+#include <vector>
+#include <boost/functional/hash.hpp>
+#include <boost/unordered_map.hpp>
+#include <boost/utility.hpp>
+
+namespace s3
+{
+  namespace base
+  {
+    // tracks a deadline (in whole seconds) for each key, and hands back the
+    // keys whose deadlines have passed as the wheel is advanced.
+    //
+    // there are LEVELS wheels of SLOTS slots each.  a slot on level 0 covers
+    // one second, a slot on level 1 covers SLOTS seconds, and so on, so the
+    // four levels together cover about 194 days (deadlines further out than
+    // that are parked in the last slot and re-placed when it comes around).
+    // when a level's slot comes due, its keys move down to the level below
+    // ("cascade"), so each key moves at most LEVELS times before it expires.
+    //
+    // scheduling, rescheduling and cancelling a key are constant-time.
+    // advancing costs one step per second passed, plus the keys that cascade
+    // or expire.  a large jump (a suspended machine, a clock change) re-places
+    // every key instead of stepping.
+    template <class key_type, class hash_type = boost::hash<key_type> >
+    class timing_wheel : boost::noncopyable
+    {
+    public:
+      typedef std::vector<key_type> key_vector;
+
+      inline explicit timing_wheel(time_t now)
+        : _now(now)
+      {
+      }
+
+      inline size_t get_size() const { return _index.size(); }
+      inline time_t get_time() const { return _now; }
+
+      // sets the deadline for "key", replacing any existing one.  a deadline
+      // that isn't after the wheel's current time expires on the next step.
+      inline void schedule(const key_type &key, time_t deadline)
+      {
+        typename index_map::iterator itor = _index.find(key);
+        int level, slot;
+
+        get_position(deadline, &level, &slot);
+
+        if (itor == _index.end()) {
+          slot_list &l = _slots[level][slot];
+
+          l.push_back(node(key, deadline, level, slot));
+          _index[key] = --l.end();
+
+        } else {
+          node_iterator n = itor->second;
+
+          move(n, deadline, level, slot);
+        }
+      }
+
+      inline void cancel(const key_type &key)
+      {
+        typename index_map::iterator itor = _index.find(key);
+
+        if (itor == _index.end())
+          return;
+
+        _slots[itor->second->level][itor->second->slot].erase(itor->second);
+        _index.erase(itor);
+      }
+
+      // moves the wheel forward to "now", appending to "expired" every key
+      // whose deadline is at or before "now".  expired keys are forgotten.
+      inline void advance(time_t now, key_vector *expired)
+      {
+        if (now <= _now)
+          return;
+
+        if (now - _now > MAX_STEPS) {
+          replace_all(now, expired);
+          return;
+        }
+
+        while (_now < now) {
+          _now++;
+
+          // higher levels first, so that their keys land in lower-level
+          // slots that are already in position
+          for (int level = LEVELS - 1; level > 0; level--)
+            if ((_now & (get_span(level) - 1)) == 0)
+              cascade(level, get_slot(_now, level), expired);
+
+          expire_slot(get_slot(_now, 0), expired);
+        }
+      }
+
+    private:
+      enum
+      {
+        LEVELS = 4,
+        SLOT_BITS = 6,
+        SLOTS = 1 << SLOT_BITS,
+        SLOT_MASK = SLOTS - 1,
+
+        // steps per advance() before it's cheaper to re-place every key
+        MAX_STEPS = SLOTS * SLOTS
+      };
+
+      struct node
+      {
+        key_type key;
+        time_t deadline;
+        int level, slot;
+
+        inline node(const key_type &key_, time_t deadline_, int level_, int slot_)
+          : key(key_),
+            deadline(deadline_),
+            level(level_),
+            slot(slot_)
+        {
+        }
+      };
+
+      typedef std::list<node> slot_list;
+      typedef typename slot_list::iterator node_iterator;
+      typedef boost::unordered_map<key_type, node_iterator, hash_type> index_map;
+
+      inline static time_t get_span(int level)
+      {
+        return static_cast<time_t>(1) << (SLOT_BITS * level);
+      }
+
+      inline static int get_slot(time_t t, int level)
+      {
+        return static_cast<int>((t >> (SLOT_BITS * level)) & SLOT_MASK);
+      }
+
+      inline void get_position(time_t deadline, int *level, int *slot) const
+      {
+        time_t delta = deadline - _now;
+
+        if (delta < 1) {
+          deadline = _now + 1;
+          delta = 1;
+        }
+
+        for (int l = 0; l < LEVELS - 1; l++) {
+          if (delta < get_span(l + 1)) {
+            *level = l;
+            *slot = get_slot(deadline, l);
+
+            return;
+          }
+        }
+
+        // beyond the last level, so wait in its furthest slot
+        if (delta >= get_span(LEVELS))
+          deadline = _now + get_span(LEVELS) - 1;
+
+        *level = LEVELS - 1;
+        *slot = get_slot(deadline, LEVELS - 1);
+      }
+
+      inline void move(node_iterator n, time_t deadline, int level, int slot)
+      {
+        slot_list &from = _slots[n->level][n->slot];
+        slot_list &to = _slots[level][slot];
+
+        n->deadline = deadline;
+        n->level = level;
+        n->slot = slot;
+
+        // splice() keeps n (and so the index entry) valid
+        to.splice(to.end(), from, n);
+      }
+
+      inline void expire(node_iterator n, key_vector *expired)
+      {
+        expired->push_back(n->key);
+        _index.erase(n->key);
+        _slots[n->level][n->slot].erase(n);
+      }
+
+      inline void expire_slot(int slot, key_vector *expired)
+      {
+        slot_list &l = _slots[0][slot];
+
+        while (!l.empty())
+          expire(l.begin(), expired);
+      }
+
+      inline void cascade(int level, int slot, key_vector *expired)
+      {
+        slot_list pending;
+
+        pending.splice(pending.end(), _slots[level][slot]);
+
+        while (!pending.empty()) {
+          node_iterator n = pending.begin();
+
+          if (n->deadline <= _now) {
+            expired->push_back(n->key);
+            _index.erase(n->key);
+            pending.erase(n);
+
+          } else {
+            slot_list *to;
+
+            get_position(n->deadline, &n->level, &n->slot);
+            to = &_slots[n->level][n->slot];
+
+            // splice() keeps n (and so the index entry) valid
+            to->splice(to->end(), pending, n);
+          }
+        }
+      }
+
+      inline void replace_all(time_t now, key_vector *expired)
+      {
+        _now = now;
+
+        for (int level = 0; level < LEVELS; level++)
+          for (int slot = 0; slot < SLOTS; slot++)
+            cascade(level, slot, expired);
+      }
+
+      time_t _now;
+      slot_list _slots[LEVELS][SLOTS];
+      index_map _index;
+    };
+  }
+}
+
+#endif
@@ -231,6 +231,46 @@ int xml::find(const xml::document_ptr &doc, const char *xpath, xml::element_list
   return -EIO;
 }
 
+int xml::find(const xml::document_ptr &doc, const char *xpath, xml::element_map_list *list)
+{
+  try {
+    xpath_object_wrapper result;
+
+    if (!doc)
+      throw runtime_error("cannot search empty document");
+
+    result = xpath_find(doc.get(), xpath);
+
+    if (result.is_null())
+      throw runtime_error("invalid xpath expression");
+
+    for (int i = 0; i < result->nodesetval->nodeNr; i++) {
+      element_map &elements = *list->insert(list->end(), element_map());
+
+      for (xmlNodePtr child = result->nodesetval->nodeTab[i]->children; child; child = child->next) {
+        xmlChar *text;
+
+        if (child->type != XML_ELEMENT_NODE)
+          continue;
+
+        text = xmlNodeGetContent(child);
+
+        if (text) {
+          elements[reinterpret_cast<const char *>(child->name)] = reinterpret_cast<const char *>(text);
+          xmlFree(text);
+        }
+      }
+    }
+
+    return 0;
+
+  } catch (const std::exception &e) {
+    S3_LOG(LOG_WARNING, "xml::find", "caught exception while finding [%s]: %s\n", xpath, e.what());
+  }
+
+  return -EIO;
+}
+
 bool xml::match(const string &data, const char *xpath)
 {
   try {
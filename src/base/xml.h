@@ -23,6 +23,7 @@
 #define S3_BASE_XML_H
 
 #include <list>
+#include <map>
 #include <string>
 #include <vector>
 #include <boost/smart_ptr.hpp>
@@ -40,12 +41,17 @@ namespace s3
       typedef boost::shared_ptr<document> document_ptr;
       typedef std::list<std::string> element_list;
 
+      // child element name -> text, for each matching element
+      typedef std::map<std::string, std::string> element_map;
+      typedef std::list<element_map> element_map_list;
+
       static void init();
 
       static document_ptr parse(const std::string &data);
 
       static int find(const document_ptr &doc, const char *xpath, std::string *element);
       static int find(const document_ptr &doc, const char *xpath, element_list *elements);
+      static int find(const document_ptr &doc, const char *xpath, element_map_list *elements);
 
       static bool match(const std::string &data, const char *xpath);
 
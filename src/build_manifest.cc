@@ -0,0 +1,132 @@
+/*
+ * build_manifest.cc
+ * -------------------------------------------------------------------------
+ * Writes a manifest of a bucket for use with use_manifest.
+ * -------------------------------------------------------------------------
+ *
+ * Copyright (c) 2013, Tarick Bedeir.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <getopt.h>
+
+#include <iostream>
+
+#include "init.h"
+#include "base/config.h"
+#include "base/paths.h"
+#include "base/request.h"
+#include "fs/manifest.h"
+#include "services/service.h"
+
+using std::cerr;
+using std::cout;
+using std::endl;
+using std::string;
+
+using s3::init;
+using s3::base::config;
+using s3::base::paths;
+using s3::base::request;
+using s3::fs::manifest;
+using s3::services::service;
+
+namespace
+{
+  const char *SHORT_OPTIONS = ":c:m";
+
+  const option LONG_OPTIONS[] = {
+    { "config-file",    required_argument, NULL, 'c'  },
+    { "fetch-metadata", no_argument,       NULL, 'm'  },
+    { NULL,             0,                 NULL, '\0' } };
+}
+
+void print_usage(const char *arg0)
+{
+  const char *base_name = strrchr(arg0, '/');
+
+  base_name = base_name ? base_name + 1 : arg0;
+
+  cerr <<
+    "Usage: " << base_name << " [options] [output-file]\n"
+    "\n"
+    "Lists the bucket and writes a manifest to [output-file], or to manifest_file\n"
+    "in the configuration if [output-file] is omitted.\n"
+    "\n"
+    "[options] can be:\n"
+    "\n"
+    "  -c, --config-file <path>  Use configuration at <path> rather than the default.\n"
+    "  -m, --fetch-metadata      Request each object's metadata so that modes, owners\n"
+    "                            and types are recorded rather than defaulted.  This\n"
+    "                            sends one request per object.\n"
+    "\n"
+    "See " << base_name << "(1) for a more detailed explanation." << endl;
+
+  exit(1);
+}
+
+int main(int argc, char **argv)
+{
+  int opt = 0, ret = 0;
+  string config_file, out_file;
+  bool fetch_metadata = false;
+
+  while ((opt = getopt_long(argc, argv, SHORT_OPTIONS, LONG_OPTIONS, NULL)) != -1) {
+    switch (opt) {
+      case 'c':
+        config_file = optarg;
+        break;
+
+      case 'm':
+        fetch_metadata = true;
+        break;
+
+      default:
+        print_usage(argv[0]);
+    }
+  }
+
+  if (optind < argc)
+    out_file = argv[optind++];
+
+  if (optind < argc)
+    print_usage(argv[0]);
+
+  try {
+    request::ptr req;
+    size_t count;
+
+    init::base(init::IB_NONE, LOG_ERR, config_file);
+    init::services();
+
+    if (out_file.empty())
+      out_file = paths::transform(config::get_manifest_file());
+
+    if (out_file.empty())
+      print_usage(argv[0]);
+
+    req.reset(new request());
+    req->set_hook(service::get_request_hook());
+
+    count = manifest::build(req, out_file, fetch_metadata);
+
+    cout << "Wrote " << count << " entries to [" << out_file << "]." << endl;
+
+  } catch (const std::exception &e) {
+    cout << "Caught exception: " << e.what() << endl;
+    ret = 1;
+  }
+
+  return ret;
+}
@@ -0,0 +1,402 @@
+/*
+ * fs/block_cache.cc
+ * -------------------------------------------------------------------------
+ * Persistent, size-bounded local cache of file data blocks.
+ * -------------------------------------------------------------------------
+ *
+ * Copyright (c) 2013, Tarick Bedeir.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <utility>
+
+#include <boost/detail/atomic_count.hpp>
+#include <boost/lexical_cast.hpp>
+
+#include "base/config.h"
+#include "base/logger.h"
+#include "base/paths.h"
+#include "crypto/hash.h"
+#include "crypto/hex.h"
+#include "crypto/sha256.h"
+#include "fs/block_cache.h"
+
+using boost::lexical_cast;
+using boost::mutex;
+using boost::detail::atomic_count;
+using std::make_pair;
+using std::ostream;
+using std::pair;
+using std::string;
+using std::vector;
+
+using s3::base::config;
+using s3::base::paths;
+using s3::base::statistics;
+using s3::crypto::hash;
+using s3::crypto::hex;
+using s3::crypto::sha256;
+using s3::fs::block_cache;
+
+bool block_cache::s_enabled(false);
+string block_cache::s_dir;
+size_t block_cache::s_max_size(0);
+size_t block_cache::s_size(0);
+mutex block_cache::s_mutex;
+block_cache::entry_map block_cache::s_entries;
+block_cache::lru_list block_cache::s_lru;
+statistics::writers::entry block_cache::s_writer(block_cache::statistics_writer, 0);
+
+namespace
+{
+  const string TEMP_PREFIX = "tmp.";
+
+  atomic_count s_hits(0), s_misses(0), s_corrupt(0);
+  atomic_count s_stored(0), s_evicted(0);
+
+  // not atomic_count, which is a long, since this can pass 2 GB on 32-bit
+  // machines
+  mutex s_bytes_mutex;
+  uint64_t s_bytes_saved(0);
+
+  inline double percent(uint64_t a, uint64_t b)
+  {
+    return b ? static_cast<double>(a) / static_cast<double>(b) * 100.0 : 0.0;
+  }
+
+  bool is_block_name(const char *name)
+  {
+    size_t len = strlen(name);
+
+    if (len != sha256::HASH_LEN * 2)
+      return false;
+
+    for (size_t i = 0; i < len; i++)
+      if (!isxdigit(name[i]))
+        return false;
+
+    return true;
+  }
+
+  bool write_all(int fd, const char *data, size_t size)
+  {
+    while (size) {
+      ssize_t r = write(fd, data, size);
+
+      if (r < 0) {
+        if (errno == EINTR)
+          continue;
+
+        return false;
+      }
+
+      data += r;
+      size -= r;
+    }
+
+    return true;
+  }
+
+  bool read_all(int fd, char *data, size_t size)
+  {
+    while (size) {
+      ssize_t r = read(fd, data, size);
+
+      if (r < 0 && errno == EINTR)
+        continue;
+
+      if (r <= 0)
+        return false;
+
+      data += r;
+      size -= r;
+    }
+
+    return true;
+  }
+}
+
+void block_cache::init()
+{
+  if (config::get_block_cache_dir().empty())
+    return;
+
+  open_cache(paths::transform(config::get_block_cache_dir()), config::get_max_block_cache_size());
+}
+
+bool block_cache::open_cache(const string &cache_dir, size_t max_size)
+{
+  mutex::scoped_lock lock(s_mutex);
+  vector<pair<time_t, pair<string, size_t> > > found;
+  DIR *dir;
+  struct dirent *de;
+
+  s_dir = cache_dir;
+  s_max_size = max_size;
+
+  if (mkdir(s_dir.c_str(), S_IRWXU) && errno != EEXIST) {
+    S3_LOG(LOG_WARNING, "block_cache::open_cache", "unable to create [%s]: %s. block cache disabled.\n", s_dir.c_str(), strerror(errno));
+    return false;
+  }
+
+  dir = opendir(s_dir.c_str());
+
+  if (!dir) {
+    S3_LOG(LOG_WARNING, "block_cache::open_cache", "unable to open [%s]: %s. block cache disabled.\n", s_dir.c_str(), strerror(errno));
+    return false;
+  }
+
+  while ((de = readdir(dir))) {
+    string file = s_dir + "/" + de->d_name;
+    struct stat s;
+
+    // left behind by a put() that didn't finish
+    if (strncmp(de->d_name, TEMP_PREFIX.c_str(), TEMP_PREFIX.size()) == 0) {
+      unlink(file.c_str());
+      continue;
+    }
+
+    if (!is_block_name(de->d_name) || stat(file.c_str(), &s) || !S_ISREG(s.st_mode))
+      continue;
+
+    found.push_back(make_pair(s.st_atime, make_pair(string(de->d_name), static_cast<size_t>(s.st_size))));
+  }
+
+  closedir(dir);
+
+  // oldest first, so that the most recently used end up at the front
+  std::sort(found.begin(), found.end());
+
+  for (size_t i = 0; i < found.size(); i++)
+    add(found[i].second.first, found[i].second.second, lock);
+
+  trim(lock);
+
+  s_enabled = true;
+
+  S3_LOG(LOG_DEBUG, "block_cache::open_cache", "found %zu blocks (%zu bytes) in [%s].\n", s_entries.size(), s_size, s_dir.c_str());
+
+  return true;
+}
+
+// forgets the blocks, but leaves them on disk for the next open_cache()
+void block_cache::close_cache()
+{
+  mutex::scoped_lock lock(s_mutex);
+
+  s_enabled = false;
+  s_entries.clear();
+  s_lru.clear();
+  s_size = 0;
+}
+
+string block_cache::build_name(const string &url, const string &etag, size_t block_size, size_t index)
+{
+  string key = url + '\n' + etag + '\n' + lexical_cast<string>(block_size) + '\n' + lexical_cast<string>(index);
+
+  return hash::compute<sha256, hex>(reinterpret_cast<const uint8_t *>(key.data()), key.size());
+}
+
+void block_cache::add(const string &name, size_t size, const mutex::scoped_lock &)
+{
+  entry_map::iterator itor = s_entries.find(name);
+
+  if (itor != s_entries.end()) {
+    s_lru.splice(s_lru.begin(), s_lru, itor->second.lru_itor);
+    return;
+  }
+
+  s_lru.push_front(name);
+
+  s_entries[name].size = size;
+  s_entries[name].lru_itor = s_lru.begin();
+  s_size += size;
+}
+
+void block_cache::remove(const string &name, const mutex::scoped_lock &)
+{
+  entry_map::iterator itor = s_entries.find(name);
+
+  if (itor == s_entries.end())
+    return;
+
+  unlink((s_dir + "/" + name).c_str());
+
+  s_size -= itor->second.size;
+  s_lru.erase(itor->second.lru_itor);
+  s_entries.erase(itor);
+}
+
+void block_cache::trim(const mutex::scoped_lock &lock)
+{
+  while (s_size > s_max_size && !s_lru.empty()) {
+    remove(s_lru.back(), lock);
+    ++s_evicted;
+  }
+}
+
+bool block_cache::get(const string &url, const string &etag, size_t block_size, size_t index, size_t size, vector<char> *data)
+{
+  string name = build_name(url, etag, block_size, index);
+  uint8_t stored_hash[sha256::HASH_LEN], computed_hash[sha256::HASH_LEN];
+  bool intact;
+  int fd;
+
+  {
+    mutex::scoped_lock lock(s_mutex);
+    entry_map::iterator itor = s_entries.find(name);
+
+    if (itor == s_entries.end() || itor->second.size != size + sha256::HASH_LEN) {
+      ++s_misses;
+      return false;
+    }
+
+    s_lru.splice(s_lru.begin(), s_lru, itor->second.lru_itor);
+  }
+
+  // if the block is evicted now, the open file stays readable
+  fd = open((s_dir + "/" + name).c_str(), O_RDONLY);
+
+  data->resize(size);
+
+  intact =
+    fd != -1 &&
+    read_all(fd, &(*data)[0], size) &&
+    read_all(fd, reinterpret_cast<char *>(stored_hash), sha256::HASH_LEN);
+
+  if (fd != -1)
+    close(fd);
+
+  if (intact) {
+    hash::compute<sha256>(&(*data)[0], size, computed_hash);
+    intact = (memcmp(stored_hash, computed_hash, sha256::HASH_LEN) == 0);
+  }
+
+  if (!intact) {
+    mutex::scoped_lock lock(s_mutex);
+
+    S3_LOG(LOG_WARNING, "block_cache::get", "dropping damaged block %zu of [%s].\n", index, url.c_str());
+
+    remove(name, lock);
+    ++s_corrupt;
+    ++s_misses;
+
+    return false;
+  }
+
+  ++s_hits;
+
+  {
+    mutex::scoped_lock lock(s_bytes_mutex);
+
+    s_bytes_saved += size;
+  }
+
+  return true;
+}
+
+void block_cache::put(const string &url, const string &etag, size_t block_size, size_t index, const char *data, size_t size)
+{
+  string name = build_name(url, etag, block_size, index);
+  string temp_file = s_dir + "/" + TEMP_PREFIX + "XXXXXX";
+  uint8_t computed_hash[sha256::HASH_LEN];
+  int fd;
+  bool written;
+
+  if (size + sha256::HASH_LEN > s_max_size)
+    return;
+
+  {
+    mutex::scoped_lock lock(s_mutex);
+
+    if (s_entries.find(name) != s_entries.end())
+      return;
+  }
+
+  hash::compute<sha256>(data, size, computed_hash);
+
+  fd = mkstemp(&temp_file[0]);
+
+  if (fd == -1) {
+    S3_LOG(LOG_WARNING, "block_cache::put", "unable to create block in [%s]: %s.\n", s_dir.c_str(), strerror(errno));
+    return;
+  }
+
+  written =
+    write_all(fd, data, size) &&
+    write_all(fd, reinterpret_cast<const char *>(computed_hash), sha256::HASH_LEN);
+
+  close(fd);
+
+  // the rename makes the block appear whole or not at all
+  if (!written || rename(temp_file.c_str(), (s_dir + "/" + name).c_str())) {
+    S3_LOG(LOG_WARNING, "block_cache::put", "unable to write block %zu of [%s]: %s.\n", index, url.c_str(), strerror(errno));
+    unlink(temp_file.c_str());
+
+    return;
+  }
+
+  {
+    mutex::scoped_lock lock(s_mutex);
+
+    add(name, size + sha256::HASH_LEN, lock);
+    trim(lock);
+  }
+
+  ++s_stored;
+}
+
+void block_cache::erase(const string &url, const string &etag, size_t block_size, size_t count)
+{
+  mutex::scoped_lock lock(s_mutex);
+
+  for (size_t i = 0; i < count; i++)
+    remove(build_name(url, etag, block_size, i), lock);
+}
+
+void block_cache::statistics_writer(ostream *o)
+{
+  mutex::scoped_lock lock(s_mutex);
+  uint64_t bytes_saved;
+
+  {
+    mutex::scoped_lock bytes_lock(s_bytes_mutex);
+
+    bytes_saved = s_bytes_saved;
+  }
+
+  o->setf(ostream::fixed);
+  o->precision(2);
+
+  *o <<
+    "block cache:\n"
+    "  blocks: " << s_entries.size() << "\n"
+    "  size (bytes): " << s_size << "\n"
+    "  hits: " << s_hits << "\n"
+    "  misses: " << s_misses << "\n"
+    "  hit rate: " << percent(s_hits, s_hits + s_misses) << " %\n"
+    "  bytes saved: " << bytes_saved << "\n"
+    "  blocks stored: " << s_stored << "\n"
+    "  blocks evicted: " << s_evicted << "\n"
+    "  damaged blocks dropped: " << s_corrupt << "\n";
+}
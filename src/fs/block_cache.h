@@ -0,0 +1,115 @@
+/*
+ * fs/block_cache.h
+ * -------------------------------------------------------------------------
+ * Persistent, size-bounded local cache of file data blocks.
+ * -------------------------------------------------------------------------
+ *
+ * Copyright (c) 2013, Tarick Bedeir.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef S3_FS_BLOCK_CACHE_H
+#define S3_FS_BLOCK_CACHE_H
+
+#include <list>
+#include <string>
+#include <vector>
+
+#include <boost/thread.hpp>
+#include <boost/unordered_map.hpp>
+
+#include "base/statistics.h"
+
+namespace s3
+{
+  namespace fs
+  {
+    // every open downloads into a fresh temporary file, so without this, an
+    // object opened again (by the next step of a job, say) is downloaded
+    // again.  with block_cache_dir set, blocks of object data are also kept
+    // in that directory, keyed by (object URL, etag, block size, block
+    // index), and shared by all opens.  a block is only ever found for the
+    // etag it was fetched with, so an unchanged object reopened costs no
+    // GETs, and a changed one never sees old data.
+    //
+    // blocks are stored as received from the server (so still encrypted, for
+    // encrypted files), one file per block, each followed by its sha256.
+    // the hash is checked on every read, and the data then goes through the
+    // file's hash list like freshly-downloaded data would.
+    //
+    // the least recently used blocks are evicted once the directory holds
+    // more than max_block_cache_size bytes.
+    class block_cache
+    {
+    public:
+      static void init();
+
+      // init() opens the configured directory with these
+      static bool open_cache(const std::string &dir, size_t max_size);
+      static void close_cache();
+
+      inline static bool is_enabled() { return s_enabled; }
+
+      // fills "data" and returns true if the block is cached, intact and
+      // "size" bytes long
+      static bool get(
+        const std::string &url,
+        const std::string &etag,
+        size_t block_size,
+        size_t index,
+        size_t size,
+        std::vector<char> *data);
+
+      static void put(
+        const std::string &url,
+        const std::string &etag,
+        size_t block_size,
+        size_t index,
+        const char *data,
+        size_t size);
+
+      // drops blocks 0 to "count" - 1 (e.g., because the object they came
+      // from failed its hash check)
+      static void erase(const std::string &url, const std::string &etag, size_t block_size, size_t count);
+
+    private:
+      typedef std::list<std::string> lru_list;
+
+      struct entry
+      {
+        size_t size;
+        lru_list::iterator lru_itor;
+      };
+
+      typedef boost::unordered_map<std::string, entry> entry_map;
+
+      static std::string build_name(const std::string &url, const std::string &etag, size_t block_size, size_t index);
+      static void add(const std::string &name, size_t size, const boost::mutex::scoped_lock &);
+      static void remove(const std::string &name, const boost::mutex::scoped_lock &);
+      static void trim(const boost::mutex::scoped_lock &);
+
+      static void statistics_writer(std::ostream *o);
+
+      static bool s_enabled;
+      static std::string s_dir;
+      static size_t s_max_size, s_size;
+      static boost::mutex s_mutex;
+      static entry_map s_entries;
+      static lru_list s_lru;
+      static base::statistics::writers::entry s_writer;
+    };
+  }
+}
+
+#endif
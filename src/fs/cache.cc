@@ -20,32 +20,178 @@
  */
 
 #include <boost/detail/atomic_count.hpp>
+#include <boost/lexical_cast.hpp>
 
 #include "base/config.h"
 #include "base/logger.h"
 #include "base/request.h"
+#include "base/timer.h"
 #include "fs/cache.h"
+#include "fs/change_poller.h"
 #include "fs/directory.h"
+#include "fs/manifest.h"
+#include "fs/metadata_store.h"
+#include "fs/namespace_index.h"
+#include "services/service.h"
+#include "threads/pool.h"
 
+using boost::condition;
+using boost::lexical_cast;
 using boost::mutex;
+using boost::scoped_array;
 using boost::scoped_ptr;
+using boost::static_pointer_cast;
+using boost::thread;
+using boost::thread_specific_ptr;
 using boost::detail::atomic_count;
+using std::list;
 using std::ostream;
 using std::string;
 
 using s3::base::config;
+using s3::base::header_map;
+using s3::base::interned_string;
 using s3::base::request;
 using s3::base::statistics;
+using s3::base::timer;
 using s3::fs::cache;
+using s3::fs::change_poller;
+using s3::fs::directory;
+using s3::fs::list_reader;
+using s3::fs::manifest;
+using s3::fs::metadata_store;
+using s3::fs::namespace_index;
+using s3::fs::object;
+using s3::services::service;
+using s3::threads::pool;
+using s3::threads::wait_async_handle;
 
-boost::mutex cache::s_mutex;
-scoped_ptr<cache::cache_map> cache::s_cache_map;
-uint64_t cache::s_hits(0), cache::s_misses(0), cache::s_expiries(0);
+scoped_array<cache::shard> cache::s_shards;
+size_t cache::s_shard_count(0);
+int cache::s_stale_grace_in_s(0);
+int cache::s_revalidate_hot_after_hits(0);
+int cache::s_max_saved_age_in_s(0);
+int cache::s_follower_timeout_in_s(0);
+bool cache::s_concurrent_type_probes(false);
+scoped_ptr<thread> cache::s_sweeper;
+mutex cache::s_counters_mutex;
+list<cache::counters> cache::s_counters_list;
+cache::counter_totals cache::s_released_counters;
+thread_specific_ptr<cache::counters> cache::s_counters(cache::release_counters);
 statistics::writers::entry cache::s_writer(cache::statistics_writer, 0);
 
+// a lookup that's in flight.  the first thread to miss on a path registers
+// one of these and does the actual fetch; other threads that miss on the same
+// path while it's registered wait for its result instead of sending their own
+// requests, for up to request_timeout_in_s, after which they fetch the path
+// themselves.
+class cache::pending_fetch
+{
+public:
+  inline pending_fetch(int hints)
+    : _hints(hints),
+      _request_count(0),
+      _done(false)
+  {
+  }
+
+  // a fetch made with no hints probes both the directory and the file, so
+  // it'll find whatever a more specific fetch would find
+  inline bool covers(int hints) const
+  {
+    return _hints == HINT_NONE || _hints == hints;
+  }
+
+  inline void complete(const object::ptr &obj, int request_count)
+  {
+    mutex::scoped_lock lock(_mutex);
+
+    _obj = obj;
+    _request_count = request_count;
+    _done = true;
+
+    _condition.notify_all();
+  }
+
+  // returns false if the fetch hasn't completed within "timeout_in_s"
+  inline bool wait(int timeout_in_s, object::ptr *obj, int *request_count)
+  {
+    mutex::scoped_lock lock(_mutex);
+    boost::system_time deadline = boost::get_system_time() + boost::posix_time::seconds(timeout_in_s);
+
+    while (!_done)
+      if (!_condition.timed_wait(lock, deadline))
+        return _done;
+
+    *obj = _obj;
+    *request_count = _request_count;
+
+    return true;
+  }
+
+private:
+  mutex _mutex;
+  condition _condition;
+
+  int _hints, _request_count;
+  bool _done;
+  object::ptr _obj;
+};
+
 namespace
 {
   atomic_count s_get_failures(0);
+  atomic_count s_coalesced_fetches(0), s_coalesced_requests_saved(0), s_follower_timeouts(0);
+  atomic_count s_saved_served(0), s_saved_not_modified(0), s_saved_modified(0), s_saved_stale(0);
+  atomic_count s_list_derived_inserts(0), s_write_through_inserts(0);
+  atomic_count s_revalidated_unchanged(0), s_revalidated_changed(0), s_revalidated_removed(0);
+  atomic_count s_swept(0), s_sweep_revalidations(0);
+  atomic_count s_probes_dir_first(0), s_probes_file_first(0), s_probes_concurrent(0);
+  atomic_count s_probe_round_trips_saved(0), s_probe_round_trips_lost(0);
+
+  // hash table slot, node, interned path header, and the shared_ptr control
+  // block, roughly
+  const size_t ENTRY_OVERHEAD = 128;
+
+  // how long the sweeper waits before looking again at an expired object it
+  // couldn't evict (because it's open, say, or being revalidated)
+  const int SWEEP_RECHECK_IN_S = 10;
+
+  // directories per shard for which we keep type hints
+  const size_t TYPE_HINTS_PER_SHARD = 1024;
+
+  // swept objects per shard whose time-to-live we remember
+  const size_t TTL_HISTORY_PER_SHARD = 4096;
+
+  // a lookup probes only for the likelier type first if it's at least this
+  // many times as common in the directory as the other type
+  const int TYPE_HINT_RATIO = 4;
+
+  inline string get_parent(const string &path)
+  {
+    size_t last_slash = path.rfind('/');
+
+    return (last_slash == string::npos) ? string() : path.substr(0, last_slash);
+  }
+
+  // the parent directory's cached listing (see directory::is_known_missing())
+  // says there's nothing at "path"
+  bool is_missing_from_parent(const string &path)
+  {
+    size_t last_slash = path.rfind('/');
+    object::ptr parent;
+
+    if (path.empty())
+      return false;
+
+    parent = cache::peek(get_parent(path));
+
+    return
+      parent &&
+      parent->get_type() == S_IFDIR &&
+      static_pointer_cast<directory>(parent)->is_known_missing(
+        (last_slash == string::npos) ? path : path.substr(last_slash + 1));
+  }
 
   inline double percent(uint64_t a, uint64_t b)
   {
@@ -55,12 +201,212 @@ namespace
 
 void cache::init()
 {
-  s_cache_map.reset(new cache_map(config::get_max_objects_in_cache()));
+  size_t max_objects_per_shard, max_memory_per_shard, max_negative_per_shard;
+
+  s_shard_count = config::get_cache_shards();
+  s_stale_grace_in_s = config::get_stale_while_revalidate_in_s();
+  s_revalidate_hot_after_hits = config::get_revalidate_hot_after_hits();
+  s_max_saved_age_in_s = config::get_max_saved_metadata_age_in_s();
+  s_follower_timeout_in_s = config::get_request_timeout_in_s();
+  s_concurrent_type_probes = config::get_concurrent_type_probes();
+  s_shards.reset(new shard[s_shard_count]);
+
+  // zero means no limit on the object count
+  if (config::get_max_objects_in_cache())
+    max_objects_per_shard = (config::get_max_objects_in_cache() + s_shard_count - 1) / s_shard_count;
+  else
+    max_objects_per_shard = static_cast<size_t>(-1);
+
+  max_memory_per_shard = (config::get_max_cache_memory() + s_shard_count - 1) / s_shard_count;
+  max_negative_per_shard = (config::get_max_negative_cache_entries() + s_shard_count - 1) / s_shard_count;
+
+  for (size_t i = 0; i < s_shard_count; i++) {
+    s_shards[i].map.reset(new cache_map(max_objects_per_shard, max_memory_per_shard));
+    s_shards[i].negative.reset(new negative_map(max_negative_per_shard));
+    s_shards[i].type_hints.reset(new type_hint_map(TYPE_HINTS_PER_SHARD));
+
+    if (config::get_sweep_expired_objects()) {
+      s_shards[i].expiries.reset(new expiry_wheel(time(NULL)));
+
+      if (config::get_adaptive_cache_expiry())
+        s_shards[i].ttl_history.reset(new ttl_history_map(TTL_HISTORY_PER_SHARD));
+    }
+  }
+}
+
+void cache::start_sweeper()
+{
+  s_sweeper.reset(new thread(&cache::sweeper));
+}
+
+void cache::stop_sweeper()
+{
+  if (!s_sweeper)
+    return;
+
+  s_sweeper->interrupt();
+  s_sweeper->join();
+  s_sweeper.reset();
+
+  timer::stop_coarse_time();
+}
+
+void cache::sweeper()
+{
+  try {
+    while (true) {
+      time_t now;
+
+      timer::update_coarse_time();
+      now = timer::get_coarse_time();
+
+      for (size_t i = 0; i < s_shard_count; i++)
+        if (s_shards[i].expiries)
+          sweep(&s_shards[i], now);
+
+      boost::this_thread::sleep(boost::posix_time::seconds(1));
+    }
+
+  } catch (const boost::thread_interrupted &) {
+    // stop_sweeper()
+  }
+}
+
+void cache::sweep(shard *s, time_t now)
+{
+  mutex::scoped_lock lock(s->mutex);
+  expiry_wheel::key_vector due;
+
+  s->expiries->advance(now, &due);
+
+  for (expiry_wheel::key_vector::const_iterator itor = due.begin(); itor != due.end(); ++itor) {
+    const string &path = itor->str();
+    object::ptr *cached = s->map->peek(path);
+    time_t deadline;
+
+    // evicted or removed since
+    if (!cached || !*cached)
+      continue;
+
+    deadline = (*cached)->get_expiry() + s_stale_grace_in_s;
+
+    // renewed since
+    if ((*cached)->get_expiry() && deadline > now) {
+      s->expiries->schedule(*itor, deadline);
+      continue;
+    }
+
+    if (!(*cached)->is_removable() || s->revalidating.find(path) != s->revalidating.end()) {
+      s->expiries->schedule(*itor, now + SWEEP_RECHECK_IN_S);
+      continue;
+    }
+
+    // if it's popular, check with the server rather than making the next
+    // lookup wait.  an object that still isn't valid when we look again is
+    // evicted.
+    if (
+      s_revalidate_hot_after_hits &&
+      (*cached)->get_expiry() &&
+      now - deadline < SWEEP_RECHECK_IN_S &&
+      s->map->get_policy().get_frequency(itor->get_hash()) >= s_revalidate_hot_after_hits
+    ) {
+      ++s_sweep_revalidations;
+
+      revalidate_async(s, path, *cached, lock);
+      s->expiries->schedule(*itor, now + SWEEP_RECHECK_IN_S);
+
+      continue;
+    }
+
+    if (s->ttl_history)
+      (*cached)->get_ttl_history(&(*s->ttl_history)[path]);
+
+    ++s_swept;
+    s->map->erase(path);
+  }
+}
+
+void cache::inherit_ttl(shard *s, const object::ptr &obj, const object::ptr *previous, const mutex::scoped_lock &)
+{
+  object::ttl_history *history;
+
+  if (previous && *previous) {
+    obj->inherit_ttl(*previous);
+    return;
+  }
+
+  if (!s->ttl_history)
+    return;
+
+  history = s->ttl_history->peek(obj->get_path());
+
+  if (!history)
+    return;
+
+  obj->inherit_ttl(*history);
+  s->ttl_history->erase(obj->get_path());
+}
+
+cache::counters * cache::register_counters()
+{
+  mutex::scoped_lock lock(s_counters_mutex);
+  counters *c;
+
+  // std::list for stable addresses
+  s_counters_list.push_back(counters());
+  c = &s_counters_list.back();
+
+  s_counters.reset(c);
+
+  return c;
+}
+
+void cache::release_counters(counters *c)
+{
+  mutex::scoped_lock lock(s_counters_mutex);
+
+  // fold the exiting thread's counts into the totals, so that the list only
+  // ever holds live threads' counters
+  for (list<counters>::iterator itor = s_counters_list.begin(); itor != s_counters_list.end(); ++itor) {
+    if (&(*itor) == c) {
+      s_released_counters.add(*itor);
+      s_counters_list.erase(itor);
+
+      break;
+    }
+  }
 }
 
 void cache::statistics_writer(ostream *o)
 {
-  uint64_t total = s_hits + s_misses + s_expiries;
+  counter_totals totals;
+  uint64_t total = 0;
+  uint64_t admitted = 0, rejected = 0;
+  size_t size = 0, memory = 0, negative_size = 0, scheduled = 0;
+
+  {
+    mutex::scoped_lock lock(s_counters_mutex);
+
+    totals = s_released_counters;
+
+    for (list<counters>::const_iterator itor = s_counters_list.begin(); itor != s_counters_list.end(); ++itor)
+      totals.add(*itor);
+  }
+
+  for (size_t i = 0; i < s_shard_count; i++) {
+    mutex::scoped_lock lock(s_shards[i].mutex);
+
+    size += s_shards[i].map->get_size();
+    memory += s_shards[i].map->get_weight();
+    admitted += s_shards[i].map->get_policy().get_admitted();
+    rejected += s_shards[i].map->get_policy().get_rejected();
+    negative_size += s_shards[i].negative->get_size();
+
+    if (s_shards[i].expiries)
+      scheduled += s_shards[i].expiries->get_size();
+  }
+
+  total = totals.hits + totals.misses + totals.expiries + totals.stale_hits + totals.list_upgrades;
 
   if (total == 0)
     total = 1; // avoid NaNs below
@@ -70,48 +416,662 @@ void cache::statistics_writer(ostream *o)
 
   *o << 
     "object cache:\n"
-    "  size: " << s_cache_map->get_size() << "\n"
-    "  hits: " << s_hits << " (" << percent(s_hits, total) << " %)\n"
-    "  misses: " << s_misses << " (" << percent(s_misses, total) << " %)\n"
-    "  expiries: " << s_expiries << " (" << percent(s_expiries, total) << " %)\n"
-    "  get failures: " << s_get_failures << "\n";
+    "  shards: " << s_shard_count << "\n"
+    "  size: " << size << "\n"
+    "  memory (estimated bytes): " << memory << "\n"
+    "  interned strings: " << interned_string::get_count() << "\n"
+    "  hits: " << totals.hits << " (" << percent(totals.hits, total) << " %)\n"
+    "  misses: " << totals.misses << " (" << percent(totals.misses, total) << " %)\n"
+    "  expiries: " << totals.expiries << " (" << percent(totals.expiries, total) << " %)\n"
+    "  stale hits: " << totals.stale_hits << " (" << percent(totals.stale_hits, total) << " %)\n"
+    "  list-derived objects upgraded: " << totals.list_upgrades << " (" << percent(totals.list_upgrades, total) << " %)\n"
+    "  hit rate: " << percent(totals.hits + totals.stale_hits, total) << " %\n"
+    "  admitted past eviction candidates: " << admitted << "\n"
+    "  rejected by admission policy: " << rejected << "\n"
+    "  get failures: " << s_get_failures << "\n"
+    "  negative entries: " << negative_size << "\n"
+    "  negative hits: " << totals.negative_hits << "\n"
+    "  coalesced lookups: " << s_coalesced_fetches << "\n"
+    "  requests saved by coalescing: " << s_coalesced_requests_saved << "\n"
+    "  coalesced lookups timed out: " << s_follower_timeouts << "\n"
+    "  list-derived objects cached: " << s_list_derived_inserts << "\n"
+    "  objects cached on write: " << s_write_through_inserts << "\n"
+    "  saved metadata served before revalidation: " << s_saved_served << "\n"
+    "  saved metadata not modified: " << s_saved_not_modified << "\n"
+    "  saved metadata modified: " << s_saved_modified << "\n"
+    "  saved metadata stale: " << s_saved_stale << "\n"
+    "  background revalidations, unchanged: " << s_revalidated_unchanged << "\n"
+    "  background revalidations, changed: " << s_revalidated_changed << "\n"
+    "  background revalidations, removed: " << s_revalidated_removed << "\n"
+    "  expired objects swept: " << s_swept << "\n"
+    "  popular objects revalidated on expiry: " << s_sweep_revalidations << "\n"
+    "  objects scheduled for sweeping: " << scheduled << "\n"
+    "  type probes, directory first: " << s_probes_dir_first << "\n"
+    "  type probes, file first: " << s_probes_file_first << "\n"
+    "  type probes, concurrent: " << s_probes_concurrent << "\n"
+    "  round trips saved by type probing: " << s_probe_round_trips_saved << "\n"
+    "  round trips lost to wrong type hints: " << s_probe_round_trips_lost << "\n";
 }
 
-int cache::fetch(const request::ptr &req, const string &path, int hints, object::ptr *obj)
+bool cache::is_known_missing(shard *s, const string &path, const mutex::scoped_lock &)
 {
-  if (!path.empty()) {
-    req->init(base::HTTP_HEAD);
+  time_t expiry;
+
+  if (!s->negative->find(path, &expiry))
+    return false;
+
+  if (timer::get_coarse_time() >= expiry) {
+    s->negative->erase(path);
+    return false;
+  }
+
+  get_counters()->negative_hits++;
+
+  return true;
+}
+
+uint64_t cache::get_creations(const string &path)
+{
+  shard *s = get_shard(path);
+  mutex::scoped_lock lock(s->mutex);
+
+  return s->creations;
+}
 
-    if (hints == HINT_NONE || hints & HINT_IS_DIR) {
-      // see if the path is a directory (trailing /) first
-      req->set_url(directory::build_url(path));
-      req->run();
+bool cache::set_missing(const string &path, uint64_t creations)
+{
+  shard *s = get_shard(path);
+  mutex::scoped_lock lock(s->mutex);
+
+  // something in the shard was created after our lookup started, and it may
+  // have been "path"
+  if (s->creations != creations)
+    return false;
+
+  // same clock as is_known_missing()
+  if (config::get_negative_cache_expiry_in_s() > 0)
+    (*s->negative)[path] = timer::get_coarse_time() + config::get_negative_cache_expiry_in_s();
+
+  return true;
+}
+
+object::ptr cache::coalesced_fetch(const request::ptr &req, const string &path, int hints)
+{
+  shard *s = get_shard(path);
+  boost::shared_ptr<pending_fetch> pf;
+  object::ptr obj;
+  int request_count = 0;
+  bool leader = false;
+
+  // not in a directory we've recently listed
+  if (namespace_index::is_known_missing(path) || is_missing_from_parent(path))
+    return obj;
+
+  // not in the bucket when the manifest was built
+  if (manifest::is_enabled() && !manifest::contains(path))
+    return obj;
+
+  {
+    mutex::scoped_lock lock(s->mutex);
+    pending_fetch_map::iterator itor;
+
+    if (is_known_missing(s, path, lock))
+      return obj;
+
+    itor = s->pending.find(path);
+
+    if (itor == s->pending.end()) {
+      pf.reset(new pending_fetch(hints));
+      s->pending[path] = pf;
+
+      leader = true;
+
+    } else if (itor->second->covers(hints)) {
+      pf = itor->second;
+    }
+  }
+
+  if (!pf) {
+    // there's a lookup in flight, but it might not find what we're looking
+    // for, so don't wait for it
+    run_fetch(req, path, hints, &obj, &request_count);
+    return obj;
+  }
+
+  if (!leader) {
+    // the leader may be stuck behind a queue that we (or our caller) are
+    // keeping full, so don't wait for it forever
+    if (!pf->wait(s_follower_timeout_in_s, &obj, &request_count)) {
+      ++s_follower_timeouts;
+
+      run_fetch(req, path, hints, &obj, &request_count);
+      return obj;
     }
 
-    if (hints & HINT_IS_FILE || req->get_response_code() != base::HTTP_SC_OK) {
-      // it's not a directory
-      req->set_url(object::build_url(path));
-      req->run();
+    ++s_coalesced_fetches;
+
+    for (int i = 0; i < request_count; i++)
+      ++s_coalesced_requests_saved;
+
+    return obj;
+  }
+
+  try {
+    run_fetch(req, path, hints, &obj, &request_count);
+
+  } catch (...) {
+    // don't leave waiters hanging
+    {
+      mutex::scoped_lock lock(s->mutex);
+
+      s->pending.erase(path);
     }
 
-    if (req->get_response_code() != base::HTTP_SC_OK) {
+    pf->complete(object::ptr(), 0);
+    throw;
+  }
+
+  {
+    mutex::scoped_lock lock(s->mutex);
+
+    s->pending.erase(path);
+  }
+
+  pf->complete(obj, request_count);
+
+  return obj;
+}
+
+void cache::run_fetch(const request::ptr &req, const string &path, int hints, object::ptr *obj, int *request_count)
+{
+  if (req)
+    fetch(req, path, hints, obj, request_count);
+  else
+    pool::call(
+      threads::PR_REQ_0,
+      bind(&cache::fetch, _1, path, hints, obj, request_count));
+}
+
+int cache::fetch(const request::ptr &req, const string &path, int hints, object::ptr *obj, int *request_count)
+{
+  bool is_saved = false;
+  size_t weight = 0;
+  uint64_t creations = get_creations(path);
+
+  if (path.empty() || revalidate_saved(req, path, request_count, &is_saved)) {
+    *obj = object::create(path, req);
+
+    if (!path.empty() && !is_saved)
+      metadata_store::put(path, req);
+
+  } else {
+    long code = probe_type(req, path, hints, obj, request_count);
+
+    if (code != base::HTTP_SC_OK) {
       ++s_get_failures;
+
+      // only a lookup that probed for both a directory and a file can say
+      // that nothing exists at "path"
+      if (hints == HINT_NONE && code == base::HTTP_SC_NOT_FOUND && set_missing(path, creations))
+        namespace_index::remove(path);
+
       return 0;
     }
   }
 
-  *obj = object::create(path, req);
+  if (*obj)
+    weight = get_entry_weight(path, *obj);
 
   {
-    mutex::scoped_lock lock(s_mutex);
-    object::ptr &map_obj = (*s_cache_map)[path];
+    shard *s = get_shard(path);
+    mutex::scoped_lock lock(s->mutex);
+    object::ptr *map_obj = s->map->peek(path);
 
-    if (map_obj) {
-      // if the object is already in the map, don't overwrite it
-      *obj = map_obj;
-    } else {
+    s->negative->erase(path);
+    s->creations++;
+
+    if (
+      map_obj && *map_obj && 
+      !((*map_obj)->is_expired() && (*map_obj)->is_removable()) &&
+      !((*map_obj)->is_list_derived() && *obj)
+    ) {
+      // if the object is already in the map (and still valid, and no less
+      // complete than what we fetched), don't overwrite it
+      *obj = *map_obj;
+    } else if (*obj) {
       // otherwise, save it
-      map_obj = *obj;
+      inherit_ttl(s, *obj, map_obj, lock);
+
+      (*s->map)[(*obj)->get_interned_path()] = *obj;
+      s->map->set_weight(path, weight);
+      schedule_sweep(s, *obj, lock);
+
+      if (is_saved)
+        revalidate_async(s, path, *obj, lock);
+    }
+  }
+
+  return 0;
+}
+
+long cache::probe_type(const request::ptr &req, const string &path, int hints, object::ptr *obj, int *request_count)
+{
+  const string parent = get_parent(path);
+  bool probe_dir = (hints == HINT_NONE || hints & HINT_IS_DIR);
+  bool file_first = false, concurrent = false, found_dir = false;
+  long code = base::HTTP_SC_NOT_FOUND;
+  metadata_store::entry saved;
+
+  // a path could be a directory (trailing /) or a file.  the old order
+  // (directory, then file) costs two round trips for every file, so with no
+  // hint from the caller, go by what we've found in the same directory
+  // before: probe for the likelier type first, or, if neither is clearly
+  // likelier, for both at once.
+  if (hints == HINT_NONE) {
+    type_hint hint;
+
+    get_type_hint(parent, &hint);
+
+    if (hint.files > TYPE_HINT_RATIO * hint.dirs)
+      file_first = true;
+    else if (hint.dirs <= TYPE_HINT_RATIO * hint.files)
+      concurrent = s_concurrent_type_probes;
+  }
+
+  if (concurrent) {
+    wait_async_handle::ptr dir_probe;
+    object::ptr dir_obj;
+    long dir_code = 0;
+    metadata_store::entry dir_saved;
+
+    ++s_probes_concurrent;
+
+    // the directory probe goes to PR_REQ_2, which only ever runs probes.  we
+    // may well be running on a PR_REQ_1 worker ourselves, and a worker that
+    // blocks on work queued to its own pool can deadlock it: directory
+    // listings fill PR_REQ_1 with lookups that end up waiting on lookups like
+    // this one.
+    dir_probe = pool::post(
+      threads::PR_REQ_2,
+      bind(&cache::probe, _1, directory::build_url(path), path, &dir_obj, &dir_code, &dir_saved));
+
+    try {
+      probe(req, object::build_url(path), path, obj, &code, &saved);
+
+    } catch (...) {
+      // dir_obj, dir_code, and dir_saved are on our stack
+      dir_probe->wait();
+      throw;
+    }
+
+    (*request_count)++;
+
+    if (dir_probe->wait() == 0)
+      (*request_count)++;
+    else
+      dir_code = 0;
+
+    if (dir_code == 0) {
+      // the directory probe failed, so do it here
+      probe(req, directory::build_url(path), path, &dir_obj, &dir_code, &dir_saved);
+      (*request_count)++;
+    }
+
+    // a directory wins over a file of the same name, as it did when we
+    // probed for directories first
+    if (dir_code == base::HTTP_SC_OK) {
+      *obj = dir_obj;
+      code = dir_code;
+      saved = dir_saved;
+      found_dir = true;
+
+    } else {
+      // nothing's there only if both probes say so
+      if (code == base::HTTP_SC_NOT_FOUND)
+        code = dir_code;
+
+      if (code == base::HTTP_SC_OK || code == base::HTTP_SC_NOT_FOUND)
+        ++s_probe_round_trips_saved;
+    }
+
+  } else {
+    if (file_first)
+      ++s_probes_file_first;
+    else if (hints == HINT_NONE)
+      ++s_probes_dir_first;
+
+    if (probe_dir && !file_first) {
+      probe(req, directory::build_url(path), path, obj, &code, &saved);
+      (*request_count)++;
+
+      found_dir = (code == base::HTTP_SC_OK);
+    }
+
+    if (code != base::HTTP_SC_OK) {
+      probe(req, object::build_url(path), path, obj, &code, &saved);
+      (*request_count)++;
+
+      if (file_first && code == base::HTTP_SC_OK)
+        ++s_probe_round_trips_saved;
+    }
+
+    if (file_first && code != base::HTTP_SC_OK) {
+      long file_code = code;
+
+      probe(req, directory::build_url(path), path, obj, &code, &saved);
+      (*request_count)++;
+
+      found_dir = (code == base::HTTP_SC_OK);
+
+      if (found_dir)
+        ++s_probe_round_trips_lost;
+      else if (code == base::HTTP_SC_NOT_FOUND)
+        code = file_code;
+    }
+  }
+
+  if (code == base::HTTP_SC_OK) {
+    learn_type(parent, found_dir);
+    change_poller::on_used(parent);
+
+    if (metadata_store::is_enabled())
+      metadata_store::put(path, saved);
+  }
+
+  return code;
+}
+
+int cache::probe(const request::ptr &req, const string &url, const string &path, object::ptr *obj, long *code, metadata_store::entry *saved)
+{
+  req->init(base::HTTP_HEAD);
+  req->set_url(url);
+  req->run();
+
+  *code = req->get_response_code();
+
+  if (*code == base::HTTP_SC_OK) {
+    *obj = object::create(path, req);
+
+    // the caller saves only the response that wins
+    if (metadata_store::is_enabled())
+      metadata_store::capture(req, saved);
+  }
+
+  return 0;
+}
+
+bool cache::get_type_hint(const string &parent, type_hint *hint)
+{
+  shard *s = get_shard(parent);
+  mutex::scoped_lock lock(s->mutex);
+
+  return s->type_hints->find(parent, hint);
+}
+
+void cache::learn_type(const string &parent, bool is_dir)
+{
+  shard *s = get_shard(parent);
+  mutex::scoped_lock lock(s->mutex);
+  type_hint &hint = (*s->type_hints)[parent];
+  uint8_t &count = is_dir ? hint.dirs : hint.files;
+
+  // halve both counts when one fills up, so that the hint follows what the
+  // directory holds now
+  if (count == 0xff) {
+    hint.dirs /= 2;
+    hint.files /= 2;
+  }
+
+  count++;
+}
+
+object::ptr cache::peek(const string &path)
+{
+  shard *s = get_shard(path);
+  mutex::scoped_lock lock(s->mutex);
+  object::ptr *cached = s->map->peek(path);
+
+  if (!cached || !*cached || (*cached)->is_expired())
+    return object::ptr();
+
+  return *cached;
+}
+
+bool cache::get_cached_stat(const string &path, struct stat *s)
+{
+  object::ptr obj = peek(path);
+
+  if (!obj)
+    return false;
+
+  obj->copy_stat(s);
+
+  return true;
+}
+
+void cache::insert(const object::ptr &obj)
+{
+  const string &path = obj->get_path();
+  size_t weight = get_entry_weight(path, obj);
+  shard *s = get_shard(path);
+  mutex::scoped_lock lock(s->mutex);
+
+  s->negative->erase(path);
+  s->creations++;
+
+  (*s->map)[obj->get_interned_path()] = obj;
+  s->map->set_weight(path, weight);
+  schedule_sweep(s, obj, lock);
+
+  ++s_write_through_inserts;
+}
+
+void cache::insert_listed(const request::ptr &req, const string &path, const list_reader::entry &e)
+{
+  header_map headers;
+  object::ptr obj;
+  size_t weight;
+  bool is_dir = !e.key.empty() && e.key[e.key.size() - 1] == '/';
+
+  // build the object the same way fetch() would, from the headers that a
+  // HEAD would have returned had the object been created by something
+  // other than us
+  headers["Content-Length"] = lexical_cast<string>(e.size);
+  headers["ETag"] = e.etag;
+
+  if (!e.storage_class.empty() && e.storage_class != "STANDARD")
+    headers[service::get_header_prefix() + "storage-class"] = e.storage_class;
+
+  req->init(base::HTTP_HEAD);
+  req->set_url(is_dir ? directory::build_url(path) : object::build_url(path));
+  req->replay_response(base::HTTP_SC_OK, headers, e.last_modified);
+
+  obj = object::create(path, req);
+  obj->set_list_derived();
+  weight = get_entry_weight(path, obj);
+
+  {
+    shard *s = get_shard(path);
+    mutex::scoped_lock lock(s->mutex);
+    object::ptr *map_obj = s->map->peek(path);
+
+    s->negative->erase(path);
+    s->creations++;
+
+    if (map_obj && *map_obj && !((*map_obj)->is_expired() && (*map_obj)->is_removable()))
+      return;
+
+    inherit_ttl(s, obj, map_obj, lock);
+
+    (*s->map)[obj->get_interned_path()] = obj;
+    s->map->set_weight(path, weight);
+    schedule_sweep(s, obj, lock);
+  }
+
+  ++s_list_derived_inserts;
+}
+
+size_t cache::get_entry_weight(const string &path, const object::ptr &obj)
+{
+  return ENTRY_OVERHEAD + path.size() + obj->get_resident_size();
+}
+
+void cache::update_resident_size(const object::ptr &obj)
+{
+  const string &path = obj->get_path();
+  size_t weight = get_entry_weight(path, obj);
+  shard *s = get_shard(path);
+  mutex::scoped_lock lock(s->mutex);
+  object::ptr *cached = s->map->peek(path);
+
+  // not a use of the object, so this mustn't count toward its frequency
+  if (cached && *cached == obj)
+    s->map->set_weight(path, weight);
+}
+
+bool cache::revalidate_saved(const request::ptr &req, const string &path, int *request_count, bool *is_saved)
+{
+  metadata_store::entry e;
+  header_map::const_iterator etag;
+
+  if (!metadata_store::is_enabled() || !metadata_store::find(path, &e))
+    return false;
+
+  etag = e.headers.find("ETag");
+
+  if (etag == e.headers.end()) {
+    metadata_store::erase(path);
+    return false;
+  }
+
+  // recent enough to serve without waiting on the server.  the caller
+  // revalidates it in the background, as it would a stale object, so a
+  // change made while we weren't looking shows up a round trip later.
+  if (s_max_saved_age_in_s && time(NULL) - e.saved_at < s_max_saved_age_in_s) {
+    ++s_saved_served;
+
+    req->init(base::HTTP_HEAD);
+    req->set_url(e.url);
+    req->replay_response(base::HTTP_SC_OK, e.headers, e.last_modified);
+
+    *is_saved = true;
+
+    return true;
+  }
+
+  // otherwise one request against the URL we found last time, rather than
+  // probing for a directory and then a file.  the object is built from this
+  // response's headers, not the saved ones, which would miss changes that
+  // keep the etag (to metadata alone).  the caller saves the response either
+  // way, so that the next mount can serve it at once.
+  req->init(base::HTTP_HEAD);
+  req->set_url(e.url);
+  req->run();
+
+  (*request_count)++;
+
+  if (
+    req->get_response_code() == base::HTTP_SC_OK &&
+    req->get_response_header("ETag") == etag->second &&
+    req->get_last_modified() == e.last_modified
+  ) {
+    ++s_saved_not_modified;
+    return true;
+  }
+
+  if (req->get_response_code() == base::HTTP_SC_OK) {
+    ++s_saved_modified;
+    return true;
+  }
+
+  // gone, or replaced by an object of a different type (file vs. directory),
+  // so fall back to probing
+  ++s_saved_stale;
+  metadata_store::erase(path);
+
+  return false;
+}
+
+void cache::revalidate_async(shard *s, const string &path, const object::ptr &obj, const mutex::scoped_lock &)
+{
+  // one background request per path is plenty
+  if (!s->revalidating.insert(path).second)
+    return;
+
+  pool::call_async(
+    threads::PR_REQ_1,
+    bind(&cache::revalidate, _1, path, obj));
+}
+
+int cache::revalidate(const request::ptr &req, const string &path, const object::ptr &obj)
+{
+  shard *s = get_shard(path);
+  object::ptr new_obj;
+  size_t weight = 0;
+  long code;
+
+  // a plain HEAD rather than a conditional one: a HEAD has no body to save,
+  // and a 304 only vouches for the etag, which a metadata-only change (a
+  // chmod done as a copy onto itself, say) keeps
+  try {
+    req->init(base::HTTP_HEAD);
+    req->set_url(obj->get_url());
+    req->run();
+
+  } catch (...) {
+    mutex::scoped_lock lock(s->mutex);
+
+    s->revalidating.erase(path);
+    throw;
+  }
+
+  code = req->get_response_code();
+
+  if (code == base::HTTP_SC_OK)
+    new_obj = object::create(path, req);
+
+  // renew obj only if its metadata is as current as its content.  an object
+  // built from a listing has no metadata of ours, so replace it regardless.
+  if (new_obj && !obj->is_list_derived() && obj->is_same_version(new_obj)) {
+    ++s_revalidated_unchanged;
+
+    obj->renew();
+    new_obj.reset();
+
+  } else if (code == base::HTTP_SC_OK) {
+    ++s_revalidated_changed;
+
+    metadata_store::put(path, req);
+
+    if (new_obj) {
+      new_obj->inherit_ttl(obj);
+      weight = get_entry_weight(path, new_obj);
+    }
+
+  } else if (code == base::HTTP_SC_NOT_FOUND) {
+    ++s_revalidated_removed;
+
+    metadata_store::erase(path);
+
+  } else {
+    S3_LOG(LOG_WARNING, "cache::revalidate", "unexpected response %li for [%s]. object will expire.\n", code, path.c_str());
+  }
+
+  {
+    mutex::scoped_lock lock(s->mutex);
+    object::ptr *cached = s->map->peek(path);
+
+    s->revalidating.erase(path);
+
+    // leave the cache alone if someone else has replaced or removed obj
+    if ((new_obj || code == base::HTTP_SC_NOT_FOUND) && cached && *cached == obj && obj->is_removable()) {
+      if (new_obj) {
+        *cached = new_obj;
+        s->map->set_weight(path, weight);
+        schedule_sweep(s, new_obj, lock);
+      } else if (code == base::HTTP_SC_NOT_FOUND) {
+        s->map->erase(path);
+      }
     }
   }
 
@@ -22,13 +22,24 @@
 #ifndef S3_FS_CACHE_H
 #define S3_FS_CACHE_H
 
+#include <list>
+#include <map>
+#include <set>
 #include <string>
+#include <boost/detail/atomic_count.hpp>
+#include <boost/functional/hash.hpp>
 #include <boost/smart_ptr.hpp>
 #include <boost/thread.hpp>
+#include <boost/thread/tss.hpp>
 
 #include "base/logger.h"
-#include "base/lru_cache_map.h"
+#include "base/cache_policy.h"
+#include "base/hash_lru_cache_map.h"
+#include "base/interned_string.h"
 #include "base/statistics.h"
+#include "base/timing_wheel.h"
+#include "fs/list_reader.h"
+#include "fs/metadata_store.h"
 #include "fs/object.h"
 #include "threads/pool.h"
 
@@ -55,14 +66,18 @@ namespace s3
 
       static void init();
 
+      // starts (and stops) the thread that keeps base::timer's coarse clock
+      // up to date and evicts expired objects.  has to be called after
+      // daemonizing, like threads::pool::init().
+      static void start_sweeper();
+      static void stop_sweeper();
+
       inline static object::ptr get(const std::string &path, int hints = HINT_NONE)
       {
         object::ptr obj = find(path);
 
         if (!obj)
-          threads::pool::call(
-            threads::PR_REQ_0,
-            boost::bind(&cache::fetch, _1, path, hints, &obj));
+          obj = coalesced_fetch(boost::shared_ptr<base::request>(), path, hints);
 
         return obj;
       }
@@ -72,32 +87,84 @@ namespace s3
         object::ptr obj = find(path);
 
         if (!obj)
-          fetch(req, path, hints, &obj);
+          obj = coalesced_fetch(req, path, hints);
+
+        return obj;
+      }
+
+      // like get(), but may return a list-derived object (see
+      // object::is_list_derived()).  only for callers that just want stat()
+      // information.
+      inline static object::ptr get_for_stat(const std::string &path)
+      {
+        object::ptr obj = find(path, true);
+
+        if (!obj)
+          obj = coalesced_fetch(boost::shared_ptr<base::request>(), path, HINT_NONE);
 
         return obj;
       }
 
+      // returns the cached object at "path" if there is one and it hasn't
+      // expired (it may be list-derived).  never sends a request, and doesn't
+      // count towards the hit rate.
+      static object::ptr peek(const std::string &path);
+
+      // fills in "s" if there's a valid object (possibly list-derived) for
+      // "path" in the cache.  never sends a request.
+      static bool get_cached_stat(const std::string &path, struct stat *s);
+
+      // caches "obj", which we've just written (see object::mark_written()),
+      // in place of whatever was cached for its path, so that the next lookup
+      // doesn't have to go back to the server.  also clears any negative
+      // entry for the path.
+      static void insert(const object::ptr &obj);
+
+      // caches a list-derived object for "path", built from what a bucket
+      // listing said about it, unless a valid object is already cached.
+      // "req" is only used to build the object; nothing is sent.  a key with
+      // a trailing slash is taken to be a directory.
+      static void insert_listed(const boost::shared_ptr<base::request> &req, const std::string &path, const list_reader::entry &e);
+
       inline static int remove(const std::string &path)
       {
-        boost::mutex::scoped_lock lock(s_mutex);
-        object::ptr o;
+        shard *s = get_shard(path);
+        boost::mutex::scoped_lock lock(s->mutex);
+        object::ptr *o = s->map->peek(path);
 
-        if (!s_cache_map->find(path, &o))
+        if (!o)
           return 0;
 
-        if (!o->is_removable())
+        if (*o && !(*o)->is_removable())
           return -EBUSY;
 
-        s_cache_map->erase(path);
+        s->map->erase(path);
 
         return 0;
       }
 
+      // re-estimates the memory held by "obj" (if it's still the cached object
+      // for its path), for objects that grow after they're cached
+      static void update_resident_size(const object::ptr &obj);
+
+      // forget that "path" was found not to exist.  must be called after
+      // creating an object, otherwise lookups of the new object may fail
+      // until the negative entry expires.
+      inline static void clear_negative(const std::string &path)
+      {
+        shard *s = get_shard(path);
+        boost::mutex::scoped_lock lock(s->mutex);
+
+        s->negative->erase(path);
+        s->creations++;
+      }
+
       // this method is intended to ensure that fn() is called on the one and
       // only cached object at "path"
       inline static void lock_object(const std::string &path, const locked_object_function &fn)
       {
-        boost::mutex::scoped_lock lock(s_mutex, boost::defer_lock);
+        shard *s = get_shard(path);
+        boost::mutex::scoped_lock lock(s->mutex, boost::defer_lock);
         object::ptr obj;
 
         // this puts the object at "path" in the cache if it isn't already there
@@ -118,7 +185,9 @@ namespace s3
         // pointer, which fn() has to check for anyway.
 
         lock.lock();
-        obj = (*s_cache_map)[path];
+
+        if (object::ptr *cached = s->map->peek(path))
+          obj = *cached;
 
         fn(obj);
       }
@@ -129,33 +198,229 @@ namespace s3
         return !obj || obj->is_removable();
       }
 
-      inline static object::ptr find(const std::string &path)
+      inline static object::ptr find(const std::string &path, bool allow_list_derived = false)
       {
-        boost::mutex::scoped_lock lock(s_mutex);
-        object::ptr &obj = (*s_cache_map)[path];
+        shard *s = get_shard(path);
+        counters *c = get_counters();
+        boost::mutex::scoped_lock lock(s->mutex);
+        object::ptr *obj = s->map->find(path);
+
+        if (!obj || !*obj) {
+          c->misses++;
+          return object::ptr();
+        }
+
+        // fetch() will replace it with the real thing
+        if ((*obj)->is_list_derived() && !allow_list_derived) {
+          c->list_upgrades++;
+          return object::ptr();
+        }
 
-        if (!obj) {
-          s_misses++;
+        if ((*obj)->is_expired() && (*obj)->is_removable()) {
+          if (s_stale_grace_in_s && (*obj)->is_within_grace(s_stale_grace_in_s)) {
+            c->stale_hits++;
+            revalidate_async(s, path, *obj, lock);
 
-        } else if (obj->is_expired() && obj->is_removable()) {
-          s_expiries++;
-          obj.reset();
+            return *obj;
+          }
 
-        } else {
-          s_hits++;
+          // leave the expired object in place so that fetch() can tell
+          // whether it changed
+          c->expiries++;
+
+          return object::ptr();
         }
 
-        return obj;
+        c->hits++;
+
+        return *obj;
       }
 
+      class pending_fetch;
+
+      // keyed on the object's own (interned) path, so the key costs a
+      // reference rather than a copy of the path.  W-TinyLFU keeps one-off
+      // scans (find, backups) from flushing out the working set.
+      typedef base::hash_lru_cache_map<
+        base::interned_string,
+        object::ptr,
+        is_object_removable,
+        std::string,
+        base::tiny_lfu_policy> cache_map;
+      typedef base::hash_lru_cache_map<std::string, time_t> negative_map;
+
+      // of the paths in a directory that we've had to probe for, how many
+      // turned out to be directories and how many files (see probe_type())
+      struct type_hint
+      {
+        uint8_t dirs, files;
+
+        inline type_hint()
+          : dirs(0),
+            files(0)
+        {
+        }
+      };
+
+      typedef base::hash_lru_cache_map<std::string, type_hint> type_hint_map;
+      typedef base::hash_lru_cache_map<std::string, object::ttl_history> ttl_history_map;
+      typedef base::timing_wheel<base::interned_string> expiry_wheel;
+      typedef std::map<std::string, boost::shared_ptr<pending_fetch> > pending_fetch_map;
+
       static void statistics_writer(std::ostream *o);
-      static int fetch(const boost::shared_ptr<base::request> &req, const std::string &path, int hints, object::ptr *obj);
 
-      typedef base::lru_cache_map<std::string, object::ptr, is_object_removable> cache_map;
+      static object::ptr coalesced_fetch(const boost::shared_ptr<base::request> &req, const std::string &path, int hints);
+      static void run_fetch(const boost::shared_ptr<base::request> &req, const std::string &path, int hints, object::ptr *obj, int *request_count);
+      static int fetch(const boost::shared_ptr<base::request> &req, const std::string &path, int hints, object::ptr *obj, int *request_count);
+      static long probe_type(const boost::shared_ptr<base::request> &req, const std::string &path, int hints, object::ptr *obj, int *request_count);
+      static int probe(const boost::shared_ptr<base::request> &req, const std::string &url, const std::string &path, object::ptr *obj, long *code, metadata_store::entry *saved);
+      static int revalidate(const boost::shared_ptr<base::request> &req, const std::string &path, const object::ptr &obj);
+      static bool revalidate_saved(const boost::shared_ptr<base::request> &req, const std::string &path, int *request_count, bool *is_saved);
+
+      // each shard holds the objects for a subset of paths (chosen by path
+      // hash) and has its own lock and LRU list, so that lookups on unrelated
+      // paths don't contend with each other
+      struct shard
+      {
+        boost::mutex mutex;
+        boost::scoped_ptr<cache_map> map;
+
+        // paths that were recently found not to exist, mapped to the time at
+        // which we should stop believing that
+        boost::scoped_ptr<negative_map> negative;
+
+        // lookups currently in progress for paths in this shard
+        pending_fetch_map pending;
+
+        // bumped whenever a path in this shard is found or made to exist.  a
+        // lookup that started before the bump may have been answered before
+        // the path existed, so it mustn't record the path as missing.
+        uint64_t creations;
+
+        // paths being revalidated in the background
+        std::set<std::string> revalidating;
+
+        // when the sweeper should next look at each cached object.  entries
+        // aren't removed when objects are, so the sweeper may find nothing (or
+        // a different object) at a path.
+        boost::scoped_ptr<expiry_wheel> expiries;
+
+        // keyed on the parent directory, and kept in the parent's shard
+        boost::scoped_ptr<type_hint_map> type_hints;
+
+        // with adaptive_cache_expiry, the time-to-live (and etag) of objects
+        // the sweeper evicted, so that the next fetch of the path can carry on
+        // from there rather than start over at cache_expiry_in_s
+        boost::scoped_ptr<ttl_history_map> ttl_history;
+
+        inline shard() : creations(0) { }
+      };
+
+      // a counter that only its owning thread writes, and that
+      // statistics_writer() reads from another thread.  an uncontended
+      // atomic_count increment is cheap since no other thread writes the
+      // line, and reads never see a torn value.  atomic_count can't be
+      // copied, but counters live in a std::list, so copying reads the value.
+      class thread_counter
+      {
+      public:
+        inline thread_counter() : _value(0) { }
+        inline thread_counter(const thread_counter &other) : _value(static_cast<long>(other._value)) { }
+
+        inline void operator++(int) { ++_value; }
+        inline operator uint64_t() const { return static_cast<long>(_value); }
+
+      private:
+        thread_counter & operator=(const thread_counter &);
+
+        boost::detail::atomic_count _value;
+      };
+
+      // hit/miss counters are kept per thread so that the hot path doesn't
+      // share a cache line with every other thread.  statistics_writer() sums
+      // them up, along with the totals of threads that have exited.
+      struct counters
+      {
+        thread_counter hits, misses, expiries, negative_hits, stale_hits, list_upgrades;
+      };
+
+      struct counter_totals
+      {
+        uint64_t hits, misses, expiries, negative_hits, stale_hits, list_upgrades;
+
+        inline counter_totals()
+          : hits(0),
+            misses(0),
+            expiries(0),
+            negative_hits(0),
+            stale_hits(0),
+            list_upgrades(0)
+        {
+        }
+
+        inline void add(const counters &c)
+        {
+          hits += c.hits;
+          misses += c.misses;
+          expiries += c.expiries;
+          negative_hits += c.negative_hits;
+          stale_hits += c.stale_hits;
+          list_upgrades += c.list_upgrades;
+        }
+      };
+
+      inline static shard * get_shard(const std::string &path)
+      {
+        return &s_shards[boost::hash<std::string>()(path) % s_shard_count];
+      }
+
+      inline static counters * get_counters()
+      {
+        counters *c = s_counters.get();
+
+        return c ? c : register_counters();
+      }
+
+      static counters * register_counters();
+      static void release_counters(counters *c);
+
+      static size_t get_entry_weight(const std::string &path, const object::ptr &obj);
+
+      // the sweeper evicts objects once they're past their expiry time and
+      // any stale_while_revalidate_in_s grace period
+      inline static void schedule_sweep(shard *s, const object::ptr &obj, const boost::mutex::scoped_lock &)
+      {
+        if (s->expiries)
+          s->expiries->schedule(obj->get_interned_path(), obj->get_expiry() + s_stale_grace_in_s);
+      }
 
-      static boost::mutex s_mutex;
-      static boost::scoped_ptr<cache_map> s_cache_map;
-      static uint64_t s_hits, s_misses, s_expiries;
+      static void sweeper();
+      static void sweep(shard *s, time_t now);
+      static void inherit_ttl(shard *s, const object::ptr &obj, const object::ptr *previous, const boost::mutex::scoped_lock &);
+
+      static void revalidate_async(shard *s, const std::string &path, const object::ptr &obj, const boost::mutex::scoped_lock &);
+      static bool is_known_missing(shard *s, const std::string &path, const boost::mutex::scoped_lock &);
+      static uint64_t get_creations(const std::string &path);
+      static bool set_missing(const std::string &path, uint64_t creations);
+
+      static bool get_type_hint(const std::string &parent, type_hint *hint);
+      static void learn_type(const std::string &parent, bool is_dir);
+
+      static boost::scoped_array<shard> s_shards;
+      static size_t s_shard_count;
+      static int s_stale_grace_in_s;
+      static int s_revalidate_hot_after_hits;
+      static int s_max_saved_age_in_s;
+      static int s_follower_timeout_in_s;
+      static bool s_concurrent_type_probes;
+      static boost::scoped_ptr<boost::thread> s_sweeper;
+
+      // s_counters must be declared (and so constructed) after the mutex and
+      // the list: its destructor releases the calling thread's counters
+      static boost::mutex s_counters_mutex;
+      static std::list<counters> s_counters_list;
+      static counter_totals s_released_counters;
+      static boost::thread_specific_ptr<counters> s_counters;
 
       static base::statistics::writers::entry s_writer;
     };
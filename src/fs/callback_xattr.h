@@ -54,6 +54,8 @@ namespace s3
 
       virtual void to_header(std::string *header, std::string *value);
 
+      virtual size_t get_resident_size() const { return sizeof(*this) + get_key().size(); }
+
     private:
       inline callback_xattr(
         const std::string &key, 
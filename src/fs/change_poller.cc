@@ -0,0 +1,380 @@
+/*
+ * fs/change_poller.cc
+ * -------------------------------------------------------------------------
+ * Background listing of directories to pick up changes by other clients.
+ * -------------------------------------------------------------------------
+ *
+ * Copyright (c) 2013, Tarick Bedeir.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <algorithm>
+#include <boost/detail/atomic_count.hpp>
+
+#include "base/config.h"
+#include "base/logger.h"
+#include "base/request.h"
+#include "base/xml.h"
+#include "fs/cache.h"
+#include "fs/change_poller.h"
+#include "fs/directory.h"
+#include "fs/list_reader.h"
+#include "fs/manifest.h"
+#include "fs/namespace_index.h"
+#include "fs/object.h"
+#include "threads/pool.h"
+
+using boost::mutex;
+using boost::scoped_ptr;
+using boost::static_pointer_cast;
+using boost::thread;
+using boost::detail::atomic_count;
+using std::ostream;
+using std::set;
+using std::string;
+using std::vector;
+
+using s3::base::config;
+using s3::base::request;
+using s3::base::statistics;
+using s3::base::xml;
+using s3::fs::cache;
+using s3::fs::change_poller;
+using s3::fs::directory;
+using s3::fs::list_reader;
+using s3::fs::manifest;
+using s3::fs::namespace_index;
+using s3::fs::object;
+using s3::threads::pool;
+
+int change_poller::s_interval_in_s(0);
+vector<string> change_poller::s_fixed;
+mutex change_poller::s_mutex;
+scoped_ptr<change_poller::recent_map> change_poller::s_recent;
+scoped_ptr<thread> change_poller::s_thread;
+change_poller::snapshot_map change_poller::s_snapshots;
+statistics::writers::entry change_poller::s_writer(change_poller::statistics_writer, 0);
+
+namespace
+{
+  atomic_count s_polls(0), s_failed(0);
+  atomic_count s_changed(0), s_added(0), s_removed(0), s_busy(0);
+
+  inline string join(const string &path, const string &name)
+  {
+    return path.empty() ? name : path + "/" + name;
+  }
+
+  // once nothing from a directory can still be cached, there's no need to
+  // keep polling it
+  void add_recent(vector<string> *dirs, vector<string> *stale, time_t cutoff, const string &path, const time_t &last_used)
+  {
+    if (last_used < cutoff)
+      stale->push_back(path);
+    else
+      dirs->push_back(path);
+  }
+
+  // "a/b/, /c" -> "a/b", "c"
+  void split_directories(const string &list, vector<string> *dirs)
+  {
+    size_t start = 0;
+
+    while (start <= list.size()) {
+      size_t end = list.find(',', start);
+      string dir = list.substr(start, (end == string::npos) ? string::npos : end - start);
+      size_t first = dir.find_first_not_of(" \t/");
+      size_t last = dir.find_last_not_of(" \t/");
+
+      // a lone "/" is the root
+      if (first != string::npos)
+        dirs->push_back(dir.substr(first, last - first + 1));
+      else if (dir.find('/') != string::npos)
+        dirs->push_back(string());
+
+      if (end == string::npos)
+        break;
+
+      start = end + 1;
+    }
+  }
+}
+
+void change_poller::init()
+{
+  s_interval_in_s = config::get_poll_for_changes_in_s();
+
+  // a manifest never changes
+  if (manifest::is_enabled())
+    s_interval_in_s = 0;
+
+  s_fixed.clear();
+  split_directories(config::get_poll_directories(), &s_fixed);
+
+  s_recent.reset(new recent_map(config::get_max_polled_directories()));
+}
+
+void change_poller::start()
+{
+  if (s_interval_in_s == 0)
+    return;
+
+  s_thread.reset(new thread(&change_poller::run));
+}
+
+void change_poller::stop()
+{
+  if (!s_thread)
+    return;
+
+  s_thread->interrupt();
+  s_thread->join();
+  s_thread.reset();
+}
+
+void change_poller::on_used(const string &path)
+{
+  mutex::scoped_lock lock(s_mutex);
+
+  if (s_interval_in_s == 0 || config::get_max_polled_directories() == 0)
+    return;
+
+  (*s_recent)[path] = time(NULL);
+}
+
+void change_poller::statistics_writer(ostream *o)
+{
+  *o <<
+    "change poller:\n"
+    "  directories polled: " << s_polls << "\n"
+    "  failed polls: " << s_failed << "\n"
+    "  changed objects dropped: " << s_changed << "\n"
+    "  new names seen: " << s_added << "\n"
+    "  removed names dropped: " << s_removed << "\n"
+    "  open objects left alone: " << s_busy << "\n";
+}
+
+void change_poller::run()
+{
+  try {
+    while (true) {
+      vector<string> dirs;
+
+      boost::this_thread::sleep(boost::posix_time::seconds(s_interval_in_s));
+
+      get_directories(&dirs);
+
+      // forget directories we no longer poll
+      for (snapshot_map::iterator itor = s_snapshots.begin(); itor != s_snapshots.end(); ) {
+        if (std::find(dirs.begin(), dirs.end(), itor->first) == dirs.end())
+          s_snapshots.erase(itor++);
+        else
+          ++itor;
+      }
+
+      for (vector<string>::const_iterator itor = dirs.begin(); itor != dirs.end(); ++itor) {
+        int r = pool::call(threads::PR_REQ_1, bind(&change_poller::poll, _1, *itor));
+
+        ++s_polls;
+
+        if (r) {
+          S3_LOG(LOG_WARNING, "change_poller::run", "polling [%s] failed with error %i.\n", itor->c_str(), r);
+          ++s_failed;
+        }
+      }
+    }
+
+  } catch (const boost::thread_interrupted &) {
+    // stop()
+  }
+}
+
+void change_poller::get_directories(vector<string> *dirs)
+{
+  mutex::scoped_lock lock(s_mutex);
+  vector<string> stale;
+  time_t cutoff = time(NULL) - config::get_cache_expiry_in_s();
+
+  *dirs = s_fixed;
+
+  s_recent->for_each_newest(bind(add_recent, dirs, &stale, cutoff, _1, _2));
+
+  for (vector<string>::const_iterator itor = stale.begin(); itor != stale.end(); ++itor)
+    s_recent->erase(*itor);
+
+  std::sort(dirs->begin(), dirs->end());
+  dirs->erase(std::unique(dirs->begin(), dirs->end()), dirs->end());
+}
+
+int change_poller::poll(const request::ptr &req, const string &path)
+{
+  string prefix = path.empty() ? string() : path + "/";
+  list_reader reader(prefix);
+  list_reader::entry_list keys;
+  xml::element_list prefixes;
+  snapshot_map::iterator previous = s_snapshots.find(path);
+  bool first = (previous == s_snapshots.end());
+  object::ptr dir = cache::peek(path);
+  uint64_t mutations = 0, generation = namespace_index::get_generation(path);
+  set<string> cached;
+  name_map current;
+  vector<string> names;
+  bool changed = false;
+  int r;
+
+  if (dir && dir->get_type() != S_IFDIR)
+    dir.reset();
+
+  if (dir)
+    mutations = static_pointer_cast<directory>(dir)->get_mutations();
+
+  // with no snapshot of our own yet, other clients' changes are whatever
+  // differs from the listings we hold
+  if (first)
+    get_cached_names(path, dir, &cached);
+
+  while ((r = reader.read(req, &keys, &prefixes)) > 0) {
+    for (xml::element_list::const_iterator itor = prefixes.begin(); itor != prefixes.end(); ++itor)
+      current[itor->substr(prefix.size(), itor->size() - prefix.size() - 1)];
+
+    for (list_reader::entry_list::const_iterator itor = keys.begin(); itor != keys.end(); ++itor) {
+      string name;
+
+      // the directory itself
+      if (itor->key.size() <= prefix.size())
+        continue;
+
+      name = itor->key.substr(prefix.size());
+
+      if (path.empty() && object::is_internal_path(name))
+        continue;
+
+      current[name].etag = itor->etag;
+      current[name].last_modified = itor->last_modified;
+    }
+  }
+
+  if (r)
+    return r;
+
+  for (name_map::const_iterator itor = current.begin(); itor != current.end(); ++itor) {
+    const string p = join(path, itor->first);
+    object::ptr obj = cache::peek(p);
+    name_map::const_iterator before;
+    bool added, modified = false;
+
+    if (first) {
+      added = (cached.find(itor->first) == cached.end());
+
+      // without an earlier listing, the cached mtime is all we have to go
+      // on.  for an object we didn't write, it's no earlier than when the
+      // server last saw a write (see object::init()), so a later listed
+      // time means it's been written since.  our own objects carry the
+      // mtime we gave them, which the listed time is always later than.
+      modified = (obj && !obj->is_intact() && itor->second.last_modified > obj->get_mtime());
+
+    } else {
+      // this also catches our own writes since the last poll, which costs a
+      // refetch each, but metadata-only changes look no different
+      before = previous->second.find(itor->first);
+      added = (before == previous->second.end());
+      modified = (!added && itor->second.last_modified != before->second.last_modified);
+    }
+
+    if (obj && !itor->second.etag.empty() && (obj->get_etag() != itor->second.etag || modified)) {
+      S3_LOG(LOG_DEBUG, "change_poller::poll", "[%s] changed.\n", p.c_str());
+
+      if (invalidate(p))
+        ++s_changed;
+    }
+
+    if (added) {
+      // we may have looked for it before it was created
+      cache::clear_negative(p);
+
+      if (!first || !cached.empty())
+        ++s_added;
+
+      changed = true;
+    }
+
+    names.push_back(itor->first);
+  }
+
+  if (first) {
+    for (set<string>::const_iterator itor = cached.begin(); itor != cached.end(); ++itor) {
+      if (current.find(*itor) == current.end()) {
+        on_removed(join(path, *itor));
+        changed = true;
+      }
+    }
+
+  } else {
+    for (name_map::const_iterator itor = previous->second.begin(); itor != previous->second.end(); ++itor) {
+      if (current.find(itor->first) == current.end()) {
+        on_removed(join(path, itor->first));
+        changed = true;
+      }
+    }
+  }
+
+  s_snapshots[path].swap(current);
+
+  if (!changed)
+    return 0;
+
+  // the listings we hold for the directory are out of date, and what we've
+  // just read is complete -- unless we've added or removed entries
+  // ourselves since we started, in which case we can't tell which is
+  // current, and forget what we hold instead
+  if (namespace_index::is_enabled() && !namespace_index::set_listing(path, names, generation))
+    namespace_index::remove_children(path);
+
+  if (dir)
+    static_pointer_cast<directory>(dir)->replace_listing(&names, mutations);
+
+  return 0;
+}
+
+void change_poller::get_cached_names(const string &path, const object::ptr &dir, set<string> *names)
+{
+  vector<string> v;
+
+  if (dir)
+    static_pointer_cast<directory>(dir)->get_cached_names(&v);
+
+  namespace_index::get_listing(path, &v);
+
+  names->insert(v.begin(), v.end());
+}
+
+void change_poller::on_removed(const string &path)
+{
+  S3_LOG(LOG_DEBUG, "change_poller::poll", "[%s] removed.\n", path.c_str());
+
+  invalidate(path);
+  ++s_removed;
+}
+
+bool change_poller::invalidate(const string &path)
+{
+  if (cache::remove(path) == -EBUSY) {
+    // open, so whoever has it open will see their own version until they
+    // close it
+    ++s_busy;
+    return false;
+  }
+
+  return true;
+}
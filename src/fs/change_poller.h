@@ -0,0 +1,114 @@
+/*
+ * fs/change_poller.h
+ * -------------------------------------------------------------------------
+ * Background listing of directories to pick up changes by other clients.
+ * -------------------------------------------------------------------------
+ *
+ * Copyright (c) 2013, Tarick Bedeir.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef S3_FS_CHANGE_POLLER_H
+#define S3_FS_CHANGE_POLLER_H
+
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+#include <boost/smart_ptr.hpp>
+#include <boost/thread.hpp>
+
+#include "base/hash_lru_cache_map.h"
+#include "base/statistics.h"
+
+namespace s3
+{
+  namespace base
+  {
+    class request;
+  }
+
+  namespace fs
+  {
+    class object;
+
+    // nothing tells us when another client changes the bucket, so cached
+    // metadata is only as fresh as cache_expiry_in_s allows.  with
+    // poll_for_changes_in_s set, the poller lists the directories we've used
+    // recently (and those in poll_directories) once per interval, compares
+    // each listing with the one before it and with the etags and times of
+    // cached objects, and drops only what changed: objects with a new etag or
+    // modification time (a change to metadata alone keeps the etag), names
+    // that have gone, and negative entries for names that have appeared.
+    // directory listings held by the cache and the namespace index are
+    // replaced with the new listing.
+    //
+    // changes are then picked up within one interval, however long
+    // cache_expiry_in_s is.  each poll costs a list request per 1000 names
+    // per directory.
+    class change_poller
+    {
+    public:
+      static void init();
+
+      // start (and stop) the polling thread.  like cache::start_sweeper(),
+      // start() has to be called after daemonizing, and stop() before
+      // threads::pool::terminate().
+      static void start();
+      static void stop();
+
+      // called when we've listed the directory at "path", or cached an
+      // object in it
+      static void on_used(const std::string &path);
+
+    private:
+      // what a listing says about each name in a directory (subdirectories
+      // have no etag)
+      struct listed_name
+      {
+        std::string etag;
+        time_t last_modified;
+
+        inline listed_name() : last_modified(0) { }
+      };
+
+      typedef std::map<std::string, listed_name> name_map;
+      typedef std::map<std::string, name_map> snapshot_map;
+      typedef base::hash_lru_cache_map<std::string, time_t> recent_map;
+
+      static void run();
+      static void get_directories(std::vector<std::string> *dirs);
+      static int poll(const boost::shared_ptr<base::request> &req, const std::string &path);
+      static void get_cached_names(const std::string &path, const boost::shared_ptr<object> &dir, std::set<std::string> *names);
+      static void on_removed(const std::string &path);
+      static bool invalidate(const std::string &path);
+
+      static void statistics_writer(std::ostream *o);
+
+      static int s_interval_in_s;
+      static std::vector<std::string> s_fixed;
+      static boost::mutex s_mutex;
+      static boost::scoped_ptr<recent_map> s_recent;
+      static boost::scoped_ptr<boost::thread> s_thread;
+
+      // only touched by poll(), which runs one directory at a time
+      static snapshot_map s_snapshots;
+
+      static base::statistics::writers::entry s_writer;
+    };
+  }
+}
+
+#endif
@@ -25,10 +25,15 @@
 #include "base/logger.h"
 #include "base/request.h"
 #include "base/statistics.h"
+#include "base/timer.h"
 #include "base/xml.h"
 #include "fs/cache.h"
+#include "fs/callback_xattr.h"
+#include "fs/change_poller.h"
 #include "fs/directory.h"
 #include "fs/list_reader.h"
+#include "fs/namespace_index.h"
+#include "fs/subtree_prefetcher.h"
 #include "threads/parallel_work_queue.h"
 #include "threads/pool.h"
 
@@ -43,12 +48,19 @@ using std::vector;
 
 using s3::base::config;
 using s3::base::request;
+using s3::base::sorted_name_list;
 using s3::base::statistics;
+using s3::base::timer;
 using s3::base::xml;
 using s3::fs::cache;
+using s3::fs::callback_xattr;
+using s3::fs::change_poller;
 using s3::fs::directory;
 using s3::fs::list_reader;
+using s3::fs::namespace_index;
 using s3::fs::object;
+using s3::fs::subtree_prefetcher;
+using s3::fs::xattr;
 using s3::threads::parallel_work_queue;
 using s3::threads::pool;
 
@@ -56,6 +68,7 @@ namespace
 {
   atomic_count s_internal_objects_skipped_in_list(0);
   atomic_count s_copy_retries(0), s_delete_retries(0);
+  atomic_count s_listing_missing_hits(0), s_listing_empty_hits(0), s_listings_discarded(0);
 
   void statistics_writer(ostream *o)
   {
@@ -63,7 +76,10 @@ namespace
       "directories:\n"
       "  internal objects skipped in list: " << s_internal_objects_skipped_in_list << "\n"
       "  rename retries (copy step): " << s_copy_retries << "\n"
-      "  rename retries (delete step): " << s_delete_retries << "\n";
+      "  rename retries (delete step): " << s_delete_retries << "\n"
+      "  lookups answered as missing from cached listings: " << s_listing_missing_hits << "\n"
+      "  emptiness checks answered from cached listings: " << s_listing_empty_hits << "\n"
+      "  listings discarded (entries changed while listing): " << s_listings_discarded << "\n";
   }
 
   int precache_object(const request::ptr &req, const string &path, int hints)
@@ -71,7 +87,10 @@ namespace
     // we need to wrap cache::get because it returns an object::ptr, and the
     // thread pool expects a function that returns an int
 
-    cache::get(req, path, hints);
+    // a list-derived object (from a subtree prefetch, say) is enough for
+    // stat(), which is what we're precaching for
+    if (!cache::peek(path))
+      cache::get(req, path, hints);
 
     return 0;
   }
@@ -86,6 +105,8 @@ namespace
 
     S3_LOG(LOG_DEBUG, "directory::copy_object", "[%s] -> [%s]\n", old_name.c_str(), new_name.c_str());
 
+    cache::clear_negative(new_name);
+
     return object::copy_by_path(req, old_name, new_name);
   }
 
@@ -101,6 +122,20 @@ namespace
     return object::remove_by_url(req, object::build_url(old_name));
   }
 
+  int get_prefetch_value(string *out)
+  {
+    *out = "set-to-1-to-prefetch-subtree";
+
+    return 0;
+  }
+
+  int set_prefetch_value(const string &path, const string & /* ignored */)
+  {
+    subtree_prefetcher::prefetch(path);
+
+    return 0;
+  }
+
   object * checker(const string &path, const request::ptr &req)
   {
     const string &url = req->get_url();
@@ -140,9 +175,10 @@ void directory::get_internal_objects(const request::ptr &req, vector<string> *ob
 }
 
 directory::directory(const string &path)
-  : object(path)
+  : object(path),
+    _listing_expiry(0),
+    _mutations(0)
 {
-  set_url(build_url(path));
   set_type(S_IFDIR);
 }
 
@@ -150,13 +186,31 @@ directory::~directory()
 {
 }
 
+void directory::init(const request::ptr &req)
+{
+  object::init(req);
+
+  // not visible, so that tools copying xattrs (rsync -X) leave it alone
+  get_metadata()->replace(callback_xattr::create(
+    PACKAGE_NAME "_prefetch_subtree",
+    get_prefetch_value,
+    bind(set_prefetch_value, get_path(), _1),
+    xattr::XM_WRITABLE));
+}
+
 int directory::read(const request::ptr &req, const filler_function &filler)
 {
   string path = get_path();
   size_t path_len;
-  cache_list_ptr cache;
+  bool keep = config::get_cache_directories();
+  time_t expiry = time(NULL) + config::get_cache_expiry_in_s();
   list_reader::ptr reader;
-  xml::element_list prefixes, keys;
+  list_reader::entry_list keys;
+  xml::element_list prefixes;
+  vector<string> names;
+  bool index = namespace_index::is_enabled();
+  uint64_t mutations = get_mutations();
+  uint64_t generation = namespace_index::get_generation(path);
   int r;
 
   if (!path.empty())
@@ -164,45 +218,47 @@ int directory::read(const request::ptr &req, const filler_function &filler)
 
   path_len = path.size();
 
-  if (config::get_cache_directories())
-    cache.reset(new cache_list());
-
   reader.reset(new list_reader(path));
 
   // for POSIX compliance
-  filler(".");
-  filler("..");
+  filler(".", NULL);
+  filler("..", NULL);
 
   while ((r = reader->read(req, &keys, &prefixes)) > 0) {
     for (xml::element_list::const_iterator itor = prefixes.begin(); itor != prefixes.end(); ++itor) {
       // strip trailing slash
       string relative_path = itor->substr(path_len, itor->size() - path_len - 1);
 
-      filler(relative_path);
+      fill(relative_path, S_IFDIR, filler);
 
       if (config::get_precache_on_readdir())
         pool::call_async(threads::PR_REQ_1, bind(precache_object, _1, path + relative_path, HINT_IS_DIR));
 
-      if (cache)
-        cache->push_back(relative_path);
+      if (keep || index)
+        names.push_back(relative_path);
     }
 
-    for (xml::element_list::const_iterator itor = keys.begin(); itor != keys.end(); ++itor) {
-      if (path != *itor) {
-        string relative_path = itor->substr(path_len);
+    for (list_reader::entry_list::const_iterator itor = keys.begin(); itor != keys.end(); ++itor) {
+      if (path != itor->key) {
+        string relative_path = itor->key.substr(path_len);
 
         if (object::is_internal_path(relative_path)) {
           ++s_internal_objects_skipped_in_list;
           continue;
         }
 
-        filler(relative_path);
+        if (config::get_precache_on_readdir()) {
+          // the listing already has what stat() needs, so skip the HEAD
+          if (config::get_list_derived_metadata())
+            cache::insert_listed(req, itor->key, *itor);
+          else
+            pool::call_async(threads::PR_REQ_1, bind(precache_object, _1, path + relative_path, HINT_IS_FILE));
+        }
 
-        if (config::get_precache_on_readdir())
-          pool::call_async(threads::PR_REQ_1, bind(precache_object, _1, path + relative_path, HINT_IS_FILE));
+        fill(relative_path, 0, filler);
 
-        if (cache)
-          cache->push_back(relative_path);
+        if (keep || index)
+          names.push_back(relative_path);
       }
     }
   }
@@ -210,24 +266,241 @@ int directory::read(const request::ptr &req, const filler_function &filler)
   if (r)
     return r;
 
-  if (cache) {
+  if (index)
+    namespace_index::set_listing(get_path(), names, generation);
+
+  subtree_prefetcher::on_listed(get_path());
+  change_poller::on_used(get_path());
+
+  // the listing holds from when we started it
+  if (keep)
+    set_listing(sorted_name_list::ptr(new sorted_name_list(&names)), expiry, mutations);
+
+  return 0;
+}
+
+void directory::fill_from_listing(const sorted_name_list &listing, const filler_function &filler)
+{
+  // for POSIX compliance
+  filler(".", NULL);
+  filler("..", NULL);
+
+  for (size_t i = 0; i < listing.get_size(); i++)
+    fill(listing.get(i), 0, filler);
+}
+
+bool directory::fill_from_index(const filler_function &filler)
+{
+  vector<string> names;
+
+  if (!namespace_index::get_listing(get_path(), &names))
+    return false;
+
+  // for POSIX compliance
+  filler(".", NULL);
+  filler("..", NULL);
+
+  for (vector<string>::const_iterator itor = names.begin(); itor != names.end(); ++itor)
+    fill(*itor, 0, filler);
+
+  return true;
+}
+
+void directory::fill(const string &relative_path, mode_t type, const filler_function &filler)
+{
+  struct stat s;
+
+  // pass along whatever we already know, which at least gets the entry type
+  // to the kernel.  the stat() calls that usually follow will find the same
+  // cached objects.
+  if (cache::get_cached_stat(get_path().empty() ? relative_path : get_path() + "/" + relative_path, &s)) {
+    filler(relative_path, &s);
+  } else if (type) {
+    memset(&s, 0, sizeof(s));
+    s.st_mode = type;
+
+    filler(relative_path, &s);
+  } else {
+    filler(relative_path, NULL);
+  }
+}
+
+size_t directory::get_resident_size()
+{
+  size_t size = object::get_resident_size() + sizeof(*this) - sizeof(object);
+  sorted_name_list::ptr listing;
+
+  {
     mutex::scoped_lock lock(_mutex);
 
-    _cache = cache;
+    listing = _listing;
   }
 
-  return 0;
+  if (listing)
+    size += listing->get_resident_size();
+
+  return size;
+}
+
+void directory::set_listing(const sorted_name_list::ptr &listing, time_t expiry)
+{
+  {
+    mutex::scoped_lock lock(_mutex);
+
+    _listing = listing;
+    _listing_expiry = expiry;
+  }
+
+  // the listing can be much larger than the rest of the object
+  cache::update_resident_size(shared_from_this());
+}
+
+void directory::set_listing(const sorted_name_list::ptr &listing, time_t expiry, uint64_t mutations)
+{
+  {
+    mutex::scoped_lock lock(_mutex);
+
+    if (_mutations != mutations) {
+      ++s_listings_discarded;
+      return;
+    }
+
+    _listing = listing;
+    _listing_expiry = expiry;
+  }
+
+  cache::update_resident_size(shared_from_this());
+}
+
+void directory::add_cached_entry(const string &relative_path)
+{
+  sorted_name_list::ptr listing;
+
+  {
+    mutex::scoped_lock lock(_mutex);
+
+    // even without a listing, since one may be being read
+    _mutations++;
+
+    if (!_listing)
+      return;
+
+    listing = _listing->add(relative_path);
+
+    if (!listing)
+      return;
+
+    _listing = listing;
+  }
+
+  cache::update_resident_size(shared_from_this());
+}
+
+void directory::remove_cached_entry(const string &relative_path)
+{
+  sorted_name_list::ptr listing;
+
+  {
+    mutex::scoped_lock lock(_mutex);
+
+    _mutations++;
+
+    if (!_listing)
+      return;
+
+    listing = _listing->remove(relative_path);
+
+    if (!listing)
+      return;
+
+    _listing = listing;
+  }
+
+  cache::update_resident_size(shared_from_this());
+}
+
+void directory::set_empty_listing()
+{
+  vector<string> none;
+
+  if (!config::get_cache_directories())
+    return;
+
+  set_listing(
+    sorted_name_list::ptr(new sorted_name_list(&none)),
+    time(NULL) + config::get_cache_expiry_in_s());
+}
+
+void directory::replace_listing(vector<string> *names, uint64_t mutations)
+{
+  sorted_name_list::ptr listing(new sorted_name_list(names));
+
+  {
+    mutex::scoped_lock lock(_mutex);
+
+    if (!_listing || timer::get_coarse_time() >= _listing_expiry)
+      return;
+
+    if (_mutations == mutations) {
+      _listing = listing;
+      _listing_expiry = time(NULL) + config::get_cache_expiry_in_s();
+
+    } else {
+      ++s_listings_discarded;
+      _listing.reset();
+    }
+  }
+
+  cache::update_resident_size(shared_from_this());
+}
+
+bool directory::get_cached_names(vector<string> *names)
+{
+  sorted_name_list::ptr listing = get_listing();
+
+  if (!listing)
+    return false;
+
+  for (size_t i = 0; i < listing->get_size(); i++)
+    names->push_back(listing->get(i));
+
+  return true;
+}
+
+bool directory::is_known_missing(const string &name)
+{
+  sorted_name_list::ptr listing = get_listing();
+
+  if (!listing || listing->contains(name))
+    return false;
+
+  ++s_listing_missing_hits;
+
+  return true;
 }
 
 bool directory::is_empty(const request::ptr &req)
 {
   list_reader::ptr reader;
   xml::element_list keys;
+  bool empty = false;
 
   // root directory isn't removable
   if (get_path().empty())
     return false;
 
+  if (namespace_index::is_empty(get_path(), &empty))
+    return empty;
+
+  {
+    sorted_name_list::ptr listing = get_listing();
+
+    if (listing) {
+      ++s_listing_empty_hits;
+      return listing->is_empty();
+    }
+  }
+
   // set max_keys to two because GET will always return the path we request
   reader.reset(new list_reader(get_path() + "/", false, 2));
 
@@ -266,6 +539,12 @@ int directory::rename(const request::ptr &req, const string &to_)
 
   cache::remove(get_path());
 
+  // until we're done, neither listing can be trusted.  "to" exists as soon
+  // as the first object is copied.
+  namespace_index::remove_children(get_path());
+  namespace_index::remove_children(to_);
+  namespace_index::add(to_);
+
   while ((r = reader->read(req, &keys, NULL)) > 0) {
     for (xml::element_list::const_iterator itor = keys.begin(); itor != keys.end(); ++itor) {
       int rm_r;
@@ -22,6 +22,7 @@
 #ifndef S3_FS_DIRECTORY_H
 #define S3_FS_DIRECTORY_H
 
+#include "base/sorted_name_list.h"
 #include "fs/object.h"
 #include "threads/pool.h"
 
@@ -33,7 +34,8 @@ namespace s3
     {
     public:
       typedef boost::shared_ptr<directory> ptr;
-      typedef boost::function1<void, const std::string &> filler_function;
+      // the stat pointer is NULL if nothing is known about the entry yet
+      typedef boost::function2<void, const std::string &, const struct stat *> filler_function;
 
       static std::string build_url(const std::string &path);
       static void get_internal_objects(const boost::shared_ptr<base::request> &req, std::vector<std::string> *objects);
@@ -48,20 +50,13 @@ namespace s3
 
       inline int read(const filler_function &filler)
       {
-        boost::mutex::scoped_lock lock(_mutex);
-        cache_list_ptr cache;
-
-        cache = _cache;
-        lock.unlock();
-
-        if (cache) {
-          // for POSIX compliance
-          filler(".");
-          filler("..");
+        base::sorted_name_list::ptr listing = get_listing();
 
-          for (cache_list::const_iterator itor = cache->begin(); itor != cache->end(); ++itor)
-            filler(*itor);
+        if (listing) {
+          fill_from_listing(*listing, filler);
 
+          return 0;
+        } else if (fill_from_index(filler)) {
           return 0;
         } else {
           return threads::pool::call(
@@ -82,14 +77,73 @@ namespace s3
       virtual int remove(const boost::shared_ptr<base::request> &req);
       virtual int rename(const boost::shared_ptr<base::request> &req, const std::string &to);
 
+      virtual size_t get_resident_size();
+
+      // keep the cached listing (if there is one) in step with entries we've
+      // created or removed ourselves, rather than dropping it
+      void add_cached_entry(const std::string &relative_path);
+      void remove_cached_entry(const std::string &relative_path);
+
+      // for a directory we've just created, with cache_directories set
+      void set_empty_listing();
+
+      // "names" is a complete listing we've just read elsewhere (see
+      // change_poller), started when get_mutations() returned "mutations".
+      // replaces the cached listing, if there is one.  if entries were added
+      // or removed since, neither can be trusted, so the cached listing is
+      // dropped instead.
+      void replace_listing(std::vector<std::string> *names, uint64_t mutations);
+
+      // returns false if there's no cached listing
+      bool get_cached_names(std::vector<std::string> *names);
+
+      inline uint64_t get_mutations()
+      {
+        boost::mutex::scoped_lock lock(_mutex);
+
+        return _mutations;
+      }
+
+      // true if we have a fresh listing of this directory, and "name" isn't
+      // in it.  a fresh listing is taken to be complete, so that looking up
+      // a name that isn't there doesn't go to the server.
+      bool is_known_missing(const std::string &name);
+
+    protected:
+      virtual void init(const boost::shared_ptr<base::request> &req);
+
     private:
-      typedef std::list<std::string> cache_list;
-      typedef boost::shared_ptr<cache_list> cache_list_ptr;
+      // the cached listing, if there is one and it hasn't expired
+      inline base::sorted_name_list::ptr get_listing()
+      {
+        boost::mutex::scoped_lock lock(_mutex);
+
+        if (!_listing || base::timer::get_coarse_time() >= _listing_expiry)
+          return base::sorted_name_list::ptr();
+
+        return _listing;
+      }
+
+      void set_listing(const base::sorted_name_list::ptr &listing, time_t expiry);
+
+      // for a listing read from the server: "mutations" is get_mutations() as
+      // of when the read started.  if entries were added or removed since, the
+      // listing may be missing them (or still hold them), so it's dropped.
+      void set_listing(const base::sorted_name_list::ptr &listing, time_t expiry, uint64_t mutations);
 
       int read(const boost::shared_ptr<base::request> &req, const filler_function &filler);
+      void fill_from_listing(const base::sorted_name_list &listing, const filler_function &filler);
+      bool fill_from_index(const filler_function &filler);
+      void fill(const std::string &relative_path, mode_t type, const filler_function &filler);
 
+      // readers use the listing without holding _mutex, which is why it's
+      // replaced rather than changed
       boost::mutex _mutex;
-      cache_list_ptr _cache;
+      base::sorted_name_list::ptr _listing;
+      time_t _listing_expiry;
+
+      // bumped by add_cached_entry() and remove_cached_entry()
+      uint64_t _mutations;
     };
   }
 }
@@ -117,7 +117,7 @@ void encrypted_file::init(const request::ptr &req)
   // always has size == 0.
 
   if (!is_intact()) {
-    if (get_stat()->st_size > 0) {
+    if (get_size() > 0) {
       S3_LOG(
         LOG_DEBUG,
         "encrypted_file::init",
@@ -19,6 +19,7 @@
  * limitations under the License.
  */
 
+#include <algorithm>
 #include <boost/detail/atomic_count.hpp>
 
 #include "base/config.h"
@@ -29,10 +30,12 @@
 #include "crypto/hex.h"
 #include "crypto/hex_with_quotes.h"
 #include "crypto/md5.h"
+#include "fs/block_cache.h"
 #include "fs/cache.h"
 #include "fs/metadata.h"
 #include "fs/mime_types.h"
 #include "fs/file.h"
+#include "fs/memory_block_cache.h"
 #include "fs/static_xattr.h"
 #include "services/file_transfer.h"
 #include "services/service.h"
@@ -43,9 +46,11 @@ using boost::detail::atomic_count;
 using std::ostream;
 using std::runtime_error;
 using std::string;
+using std::vector;
 
 using s3::base::char_vector_ptr;
 using s3::base::config;
+using s3::base::readahead_window;
 using s3::base::request;
 using s3::base::statistics;
 using s3::crypto::hash;
@@ -54,11 +59,14 @@ using s3::crypto::hex;
 using s3::crypto::hex_with_quotes;
 using s3::crypto::md5;
 using s3::crypto::sha256;
+using s3::fs::block_cache;
 using s3::fs::file;
+using s3::fs::memory_block_cache;
 using s3::fs::metadata;
 using s3::fs::mime_types;
 using s3::fs::object;
 using s3::fs::static_xattr;
+using s3::services::download_priority;
 using s3::services::service;
 using s3::threads::pool;
 
@@ -70,6 +78,18 @@ namespace
 
   atomic_count s_sha256_mismatches(0), s_md5_mismatches(0), s_no_hash_checks(0);
   atomic_count s_non_dirty_flushes(0), s_reopens(0);
+  atomic_count s_reads_during_download(0), s_prioritized_chunks(0);
+  atomic_count s_on_demand_opens(0), s_on_demand_chunks(0), s_on_demand_complete(0);
+  atomic_count s_readahead_windows(0), s_readahead_chunks(0);
+
+  // on-demand chunks and block_cache blocks are the same size, so that a
+  // chunk always maps to whole blocks
+  inline size_t get_block_size()
+  {
+    size_t chunk_size = service::get_file_transfer()->get_download_chunk_size();
+
+    return chunk_size ? chunk_size : hash_list<sha256>::CHUNK_SIZE;
+  }
 
   object * checker(const string &path, const request::ptr &req)
   {
@@ -82,7 +102,14 @@ namespace
       "files:\n"
       "  sha256 mismatches: " << s_sha256_mismatches << ", md5 mismatches: " << s_md5_mismatches << ", no hash checks: " << s_no_hash_checks << "\n"
       "  non-dirty flushes: " << s_non_dirty_flushes << "\n"
-      "  reopens: " << s_reopens << "\n";
+      "  reopens: " << s_reopens << "\n"
+      "  reads answered during download: " << s_reads_during_download << "\n"
+      "  chunk prioritizations for waiting reads: " << s_prioritized_chunks << "\n"
+      "  opened on demand: " << s_on_demand_opens << "\n"
+      "  chunks fetched on demand: " << s_on_demand_chunks << "\n"
+      "  on-demand files fetched in full: " << s_on_demand_complete << "\n"
+      "  readahead windows: " << s_readahead_windows << "\n"
+      "  chunks requested ahead: " << s_readahead_chunks << "\n";
   }
 
   object::type_checker_list::entry s_checker_reg(checker, 1000);
@@ -133,7 +160,12 @@ file::file(const string &path)
     _fd(-1),
     _status(0),
     _async_error(0),
-    _ref_count(0)
+    _ref_count(0),
+    _ready_chunk_size(0),
+    _missing_chunks(0),
+    _download_size(0),
+    _on_demand(false),
+    _written_locally(false)
 {
   set_type(S_IFREG);
 
@@ -204,9 +236,277 @@ void file::on_download_complete(int ret)
 
   _async_error = ret;
   _status = 0;
+  _ready_chunks.clear();
+  _download_priority.reset();
+  _condition.notify_all();
+}
+
+void file::init_chunks(off_t size, size_t chunk_size, const mutex::scoped_lock &)
+{
+  _ready_chunk_size = (chunk_size == 0 || static_cast<off_t>(chunk_size) > size) ? size : chunk_size;
+  _download_size = size;
+  _missing_chunks = (size + _ready_chunk_size - 1) / _ready_chunk_size;
+  _ready_chunks.assign(_missing_chunks, false);
+}
+
+void file::mark_chunks_ready(size_t size, off_t offset)
+{
+  mutex::scoped_lock lock(_fs_mutex);
+  off_t end = offset + size;
+
+  if (_ready_chunks.empty())
+    return;
+
+  // only chunks that this write covers completely
+  for (size_t i = (offset + _ready_chunk_size - 1) / _ready_chunk_size; i < _ready_chunks.size(); i++) {
+    off_t chunk_end = std::min(static_cast<off_t>((i + 1) * _ready_chunk_size), _download_size);
+
+    if (chunk_end > end)
+      break;
+
+    if (!_ready_chunks[i]) {
+      _ready_chunks[i] = true;
+      _missing_chunks--;
+    }
+  }
+
   _condition.notify_all();
 }
 
+bool file::is_range_ready(size_t size, off_t offset, const mutex::scoped_lock &)
+{
+  off_t end = std::min(static_cast<off_t>(offset + size), _download_size);
+
+  if (_ready_chunks.empty())
+    return false;
+
+  for (off_t o = offset - offset % _ready_chunk_size; o < end; o += _ready_chunk_size) {
+    if (!_ready_chunks[o / _ready_chunk_size]) {
+      // nothing happens if the chunk is already on its way
+      if (_download_priority) {
+        _download_priority->prioritize(o);
+        ++s_prioritized_chunks;
+      }
+
+      return false;
+    }
+  }
+
+  return true;
+}
+
+int file::fetch_range(size_t size, off_t offset, mutex::scoped_lock &lock, bool wait)
+{
+  while (_on_demand) {
+    off_t end = std::min(static_cast<off_t>(offset + size), _download_size);
+    size_t first, last, run_start, run_end;
+    off_t run_offset;
+    bool waiting = false;
+    int r;
+
+    if (end <= offset)
+      return 0;
+
+    first = offset / _ready_chunk_size;
+    last = (end - 1) / _ready_chunk_size;
+
+    // the first chunk that no one is fetching yet
+    for (run_start = first; run_start <= last; run_start++) {
+      if (_ready_chunks[run_start])
+        continue;
+
+      if (!_fetching_chunks[run_start])
+        break;
+
+      waiting = true;
+    }
+
+    if (run_start > last) {
+      if (!waiting || !wait)
+        return 0;
+
+      _condition.wait(lock);
+      continue;
+    }
+
+    // and the chunks after it that no one has or is fetching, so that they
+    // all come in one go
+    for (run_end = run_start; run_end <= last && !_ready_chunks[run_end] && !_fetching_chunks[run_end]; run_end++)
+      _fetching_chunks[run_end] = true;
+
+    run_offset = run_start * _ready_chunk_size;
+
+    lock.unlock();
+
+    try {
+      r = fetch_blocks(
+        run_offset,
+        std::min(static_cast<off_t>(run_end * _ready_chunk_size), _download_size) - run_offset);
+
+    } catch (...) {
+      lock.lock();
+
+      for (size_t i = run_start; i < run_end; i++)
+        _fetching_chunks[i] = false;
+
+      _condition.notify_all();
+      throw;
+    }
+
+    lock.lock();
+
+    for (size_t i = run_start; i < run_end; i++)
+      _fetching_chunks[i] = false;
+
+    _condition.notify_all();
+
+    if (r)
+      return r;
+
+    for (size_t i = run_start; i < run_end; i++)
+      ++s_on_demand_chunks;
+
+    r = check_fetched(lock);
+
+    if (r)
+      return r;
+  }
+
+  return 0;
+}
+
+int file::prepare_on_demand_write(size_t size, off_t offset, bool *ready, mutex::scoped_lock &lock)
+{
+  off_t end = std::min(static_cast<off_t>(offset + size), _download_size);
+  size_t first, last;
+
+  *ready = true;
+
+  if (end <= offset)
+    return 0;
+
+  first = offset / _ready_chunk_size;
+  last = (end - 1) / _ready_chunk_size;
+
+  // a chunk that the write covers only partly needs the rest of its data
+  if (!_ready_chunks[first] && offset > static_cast<off_t>(first * _ready_chunk_size)) {
+    *ready = false;
+    return fetch_range(1, offset, lock);
+  }
+
+  if (!_ready_chunks[last] && end < std::min(static_cast<off_t>((last + 1) * _ready_chunk_size), _download_size)) {
+    *ready = false;
+    return fetch_range(1, end - 1, lock);
+  }
+
+  // and a fetch that lands after the write would undo it
+  for (size_t i = first; i <= last; i++) {
+    if (_fetching_chunks[i]) {
+      *ready = false;
+      _condition.wait(lock);
+
+      return 0;
+    }
+  }
+
+  return 0;
+}
+
+void file::claim_range(size_t size, off_t offset, const mutex::scoped_lock &)
+{
+  off_t end = std::min(static_cast<off_t>(offset + size), _download_size);
+
+  _written_locally = true;
+
+  if (end <= offset)
+    return;
+
+  for (size_t i = offset / _ready_chunk_size; i <= (end - 1) / _ready_chunk_size; i++) {
+    if (!_ready_chunks[i]) {
+      _ready_chunks[i] = true;
+      _missing_chunks--;
+    }
+  }
+}
+
+int file::check_fetched(mutex::scoped_lock &lock)
+{
+  int r;
+
+  if (_missing_chunks || _written_locally || (_status & FS_DOWNLOADING))
+    return 0;
+
+  ++s_on_demand_complete;
+
+  // everything has arrived as it was on the server, so it can be checked.
+  // FS_DOWNLOADING keeps writers out meanwhile, but since every chunk is
+  // ready, readers carry on.
+  _status |= FS_DOWNLOADING;
+  lock.unlock();
+
+  try {
+    r = finalize_download();
+
+    if (r)
+      drop_cached_blocks();
+
+  } catch (...) {
+    lock.lock();
+    _status &= ~FS_DOWNLOADING;
+    _condition.notify_all();
+    throw;
+  }
+
+  lock.lock();
+
+  _status &= ~FS_DOWNLOADING;
+  _on_demand = false;
+  _async_error = r;
+  _condition.notify_all();
+
+  return r;
+}
+
+void file::start_read_ahead(size_t size, off_t offset, const mutex::scoped_lock &)
+{
+  off_t ahead_offset = 0;
+  size_t ahead_size = 0;
+
+  if (!_readahead->on_read(offset, size, &ahead_offset, &ahead_size) || ahead_offset >= _download_size)
+    return;
+
+  ++s_readahead_windows;
+
+  for (off_t o = ahead_offset - ahead_offset % _ready_chunk_size; o < std::min(static_cast<off_t>(ahead_offset + ahead_size), _download_size); o += _ready_chunk_size)
+    ++s_readahead_chunks;
+
+  // the fetch writes to _fd, so it holds the file open until it's done
+  _ref_count++;
+
+  pool::post(
+    threads::PR_0,
+    bind(&file::read_ahead, shared_from_this(), _1, ahead_size, ahead_offset),
+    bind(&file::on_read_ahead_complete, shared_from_this(), _1));
+}
+
+int file::read_ahead(const request::ptr & /* ignored */, size_t size, off_t offset)
+{
+  mutex::scoped_lock lock(_fs_mutex);
+
+  // chunks already on their way (because the reader caught up, say) are
+  // left to whoever's fetching them
+  return fetch_range(size, offset, lock, false);
+}
+
+void file::on_read_ahead_complete(int ret)
+{
+  // the reader will fetch for itself whatever didn't arrive
+  if (ret)
+    S3_LOG(LOG_DEBUG, "file::on_read_ahead_complete", "reading ahead in [%s] failed with error %i.\n", get_path().c_str(), ret);
+
+  release();
+}
+
 int file::is_downloadable()
 {
   return 0;
@@ -218,7 +518,7 @@ int file::open(file_open_mode mode, uint64_t *handle)
 
   if (_ref_count == 0) {
     char temp_name[] = TEMP_NAME_TEMPLATE;
-    off_t size = get_stat()->st_size;
+    off_t size = get_size();
 
     _fd = mkstemp(temp_name);
     unlink(temp_name);
@@ -247,12 +547,43 @@ int file::open(file_open_mode mode, uint64_t *handle)
         if (r)
           return r;
 
-        _status = FS_DOWNLOADING;
-
-        pool::post(
-          threads::PR_0,
-          bind(&file::download, shared_from_this(), _1),
-          bind(&file::on_download_complete, shared_from_this(), _1));
+        if (config::get_on_demand_min_size() && static_cast<size_t>(size) >= config::get_on_demand_min_size()) {
+          // data read on demand is unverified: the hash is only checked if
+          // the whole file ends up fetched without changes
+          r = prepare_download();
+
+          if (r)
+            return r;
+
+          init_chunks(size, get_block_size(), lock);
+          _fetching_chunks.assign(_ready_chunks.size(), false);
+          _on_demand = true;
+          _written_locally = false;
+
+          // the first window keeps every parallel transfer busy
+          if (config::get_max_readahead_size())
+            _readahead.reset(new readahead_window(
+              std::min(config::get_max_parts_in_progress() * _ready_chunk_size, config::get_max_readahead_size()),
+              config::get_max_readahead_size()));
+
+          ++s_on_demand_opens;
+
+        } else {
+          _status = FS_DOWNLOADING;
+          _download_size = size;
+
+          // matches file_transfer::download(), which fetches in one piece
+          // files no larger than a chunk
+          if (config::get_read_during_download()) {
+            init_chunks(size, service::get_file_transfer()->get_download_chunk_size(), lock);
+            _download_priority.reset(new download_priority());
+          }
+
+          pool::post(
+            threads::PR_0,
+            bind(&file::download, shared_from_this(), _1),
+            bind(&file::on_download_complete, shared_from_this(), _1));
+        }
       }
     }
   } else {
@@ -289,7 +620,15 @@ int file::release()
     close(_fd);
     _fd = -1;
 
-    expire();
+    _on_demand = false;
+    _ready_chunks.clear();
+    _fetching_chunks.clear();
+    _readahead.reset();
+
+    // after a successful upload we hold what's on the server, so there's no
+    // need to fetch it again
+    if (_async_error)
+      expire();
   }
 
   return 0;
@@ -299,17 +638,31 @@ int file::flush()
 {
   mutex::scoped_lock lock(_fs_mutex);
 
-  while (_status & (FS_DOWNLOADING | FS_UPLOADING | FS_WRITING))
-    _condition.wait(lock);
+  while (true) {
+    int r;
 
-  if (_async_error)
-    return _async_error;
+    while (_status & (FS_DOWNLOADING | FS_UPLOADING | FS_WRITING))
+      _condition.wait(lock);
 
-  if (!(_status & FS_DIRTY)) {
-    ++s_non_dirty_flushes;
+    if (_async_error)
+      return _async_error;
 
-    S3_LOG(LOG_DEBUG, "file::flush", "skipping flush for non-dirty file [%s].\n", get_path().c_str());
-    return 0;
+    if (!(_status & FS_DIRTY)) {
+      ++s_non_dirty_flushes;
+
+      S3_LOG(LOG_DEBUG, "file::flush", "skipping flush for non-dirty file [%s].\n", get_path().c_str());
+      return 0;
+    }
+
+    if (!_on_demand || _missing_chunks == 0)
+      break;
+
+    // the upload sends the whole file, so fetch whatever's still missing
+    // (and then check again, since we let go of the lock)
+    r = fetch_range(_download_size, 0, lock);
+
+    if (r)
+      return r;
   }
 
   _status |= FS_UPLOADING;
@@ -318,6 +671,9 @@ int file::flush()
   _async_error = pool::call(threads::PR_0, bind(&file::upload, shared_from_this(), _1));
   lock.lock();
 
+  if (!_async_error)
+    mark_written();
+
   _status = 0;
   _condition.notify_all();
 
@@ -329,11 +685,28 @@ int file::write(const char *buffer, size_t size, off_t offset)
   mutex::scoped_lock lock(_fs_mutex);
   int r;
 
-  while (_status & (FS_DOWNLOADING | FS_UPLOADING))
-    _condition.wait(lock);
+  while (true) {
+    bool ready = true;
 
-  if (_async_error)
-    return _async_error;
+    while (_status & (FS_DOWNLOADING | FS_UPLOADING))
+      _condition.wait(lock);
+
+    if (_async_error)
+      return _async_error;
+
+    if (_on_demand) {
+      r = prepare_on_demand_write(size, offset, &ready, lock);
+
+      if (r)
+        return r;
+    }
+
+    if (ready)
+      break;
+  }
+
+  if (_on_demand)
+    claim_range(size, offset, lock);
 
   _status |= FS_DIRTY | FS_WRITING;
 
@@ -350,18 +723,103 @@ int file::write(const char *buffer, size_t size, off_t offset)
 int file::read(char *buffer, size_t size, off_t offset)
 {
   mutex::scoped_lock lock(_fs_mutex);
+  string etag;
+
+  // the blocks are keyed by etag, so unless we've changed the file, they're
+  // good even while it's still downloading
+  if (memory_block_cache::is_enabled() && !(_status & FS_DIRTY) && !get_etag().empty()) {
+    ssize_t r;
+
+    etag = get_etag();
+
+    lock.unlock();
+    r = memory_block_cache::read(get_url(), etag, buffer, size, offset);
+
+    if (r >= 0)
+      return r;
+
+    lock.lock();
+  }
+
+  while (_status & FS_DOWNLOADING) {
+    if (is_range_ready(size, offset, lock)) {
+      ++s_reads_during_download;
+
+      lock.unlock();
+
+      return pread(_fd, buffer, size, offset);
+    }
 
-  while (_status & FS_DOWNLOADING)
     _condition.wait(lock);
+  }
 
   if (_async_error)
     return _async_error;
 
+  if (_on_demand) {
+    int r;
+
+    if (_readahead)
+      start_read_ahead(size, offset, lock);
+
+    r = fetch_range(size, offset, lock);
+
+    if (r)
+      return r;
+  }
+
+  // only checked, unmodified data goes into the memory cache
+  if (!etag.empty() && _status == 0 && !_on_demand && etag == get_etag()) {
+    lock.unlock();
+
+    return read_through_memory(buffer, size, offset, etag);
+  }
+
   lock.unlock();
 
   return pread(_fd, buffer, size, offset);
 }
 
+int file::read_through_memory(char *buffer, size_t size, off_t offset, const string &etag)
+{
+  const size_t block_size = memory_block_cache::BLOCK_SIZE;
+  const off_t start = offset - offset % block_size;
+  const off_t end = ((offset + size + block_size - 1) / block_size) * block_size;
+  vector<char> data(end - start);
+  ssize_t r;
+  size_t skip = offset - start;
+  bool unchanged;
+
+  if (data.empty())
+    return 0;
+
+  // whole blocks, so that they can be cached
+  r = pread(_fd, &data[0], data.size(), start);
+
+  if (r < 0)
+    return -errno;
+
+  {
+    mutex::scoped_lock lock(_fs_mutex);
+
+    // a write may have started (or even been flushed) since
+    unchanged = (_status == 0 && get_etag() == etag);
+  }
+
+  // a short block can only be the object's last
+  if (unchanged)
+    for (ssize_t pos = 0; pos < r; pos += block_size)
+      memory_block_cache::put(get_url(), etag, (start + pos) / block_size, &data[pos], std::min(static_cast<size_t>(r - pos), block_size));
+
+  if (static_cast<size_t>(r) <= skip)
+    return 0;
+
+  size = std::min(size, r - skip);
+  memcpy(buffer, &data[skip], size);
+
+  return size;
+}
+
 int file::truncate(off_t length)
 {
   mutex::scoped_lock lock(_fs_mutex);
@@ -370,11 +828,25 @@ int file::truncate(off_t length)
   if (length > TRUNCATE_LIMIT)
     return -EINVAL;
 
-  while (_status & (FS_DOWNLOADING | FS_UPLOADING))
-    _condition.wait(lock);
+  while (true) {
+    while (_status & (FS_DOWNLOADING | FS_UPLOADING))
+      _condition.wait(lock);
 
-  if (_async_error)
-    return _async_error;
+    if (_async_error)
+      return _async_error;
+
+    if (!_on_demand || _missing_chunks == 0)
+      break;
+
+    // rare enough that it isn't worth working out which chunks survive
+    r = fetch_range(_download_size, 0, lock);
+
+    if (r)
+      return r;
+  }
+
+  if (_on_demand)
+    _written_locally = true;
 
   _status |= FS_DIRTY | FS_WRITING;
 
@@ -400,6 +872,8 @@ int file::write_chunk(const char *buffer, size_t size, off_t offset)
   if (_hash_list)
     _hash_list->compute_hash(offset, reinterpret_cast<const uint8_t *>(buffer), size);
 
+  mark_chunks_ready(size, offset);
+
   return 0;
 }
 
@@ -446,7 +920,7 @@ void file::update_stat()
 void file::update_stat(const mutex::scoped_lock &)
 {
   if (_fd != -1)
-    get_stat()->st_size = get_local_size();
+    set_size(get_local_size());
 }
 
 int file::download(const request::ptr & /* ignored */)
@@ -458,15 +932,106 @@ int file::download(const request::ptr & /* ignored */)
   if (r)
     return r;
 
-  r = service::get_file_transfer()->download(
-    get_url(),
-    get_local_size(),
-    bind(&file::write_chunk, shared_from_this(), _1, _2, _3));
+  r = fetch_blocks(0, _download_size);
 
   if (r)
     return r;
 
-  return finalize_download();
+  r = finalize_download();
+
+  if (r)
+    drop_cached_blocks();
+
+  return r;
+}
+
+int file::fetch_blocks(off_t offset, size_t size)
+{
+  const size_t block_size = get_block_size();
+  const off_t end = offset + size;
+  off_t run_start = -1;
+  vector<char> data;
+  int r;
+
+  if (!block_cache::is_enabled() || get_etag().empty())
+    return download_blocks(offset, size);
+
+  for (off_t o = offset; o < end; o += block_size) {
+    size_t len = std::min(static_cast<off_t>(o + block_size), end) - o;
+
+    if (!block_cache::get(get_url(), get_etag(), block_size, o / block_size, len, &data)) {
+      if (run_start == -1)
+        run_start = o;
+
+      continue;
+    }
+
+    // download what we skipped over before this block
+    if (run_start != -1) {
+      r = download_blocks(run_start, o - run_start);
+
+      if (r)
+        return r;
+
+      run_start = -1;
+    }
+
+    r = write_chunk(&data[0], len, o);
+
+    if (r)
+      return r;
+  }
+
+  return (run_start == -1) ? 0 : download_blocks(run_start, end - run_start);
+}
+
+int file::download_blocks(off_t offset, size_t size)
+{
+  if (offset == 0 && static_cast<off_t>(size) == _download_size)
+    return service::get_file_transfer()->download(
+      get_url(),
+      size,
+      bind(&file::write_fetched, shared_from_this(), _1, _2, _3),
+      _download_priority);
+
+  return service::get_file_transfer()->download_range(
+    get_url(),
+    offset,
+    size,
+    bind(&file::write_fetched, shared_from_this(), _1, _2, _3));
+}
+
+int file::write_fetched(const char *buffer, size_t size, off_t offset)
+{
+  const size_t block_size = get_block_size();
+  const off_t end = offset + size;
+  int r;
+
+  r = write_chunk(buffer, size, offset);
+
+  if (r || !block_cache::is_enabled() || get_etag().empty())
+    return r;
+
+  // only the blocks this write covers completely (the last block of the
+  // object may be short)
+  for (off_t o = offset + (block_size - offset % block_size) % block_size; o < end; o += block_size) {
+    size_t len = std::min(static_cast<off_t>(o + block_size), _download_size) - o;
+
+    if (o + static_cast<off_t>(len) > end)
+      break;
+
+    block_cache::put(get_url(), get_etag(), block_size, o / block_size, buffer + (o - offset), len);
+  }
+
+  return 0;
+}
+
+void file::drop_cached_blocks()
+{
+  const size_t block_size = get_block_size();
+
+  if (block_cache::is_enabled())
+    block_cache::erase(get_url(), get_etag(), block_size, (_download_size + block_size - 1) / block_size);
 }
 
 int file::prepare_download()
@@ -22,10 +22,16 @@
 #ifndef S3_FS_FILE_H
 #define S3_FS_FILE_H
 
+#include <vector>
+
+#include <boost/smart_ptr.hpp>
+
+#include "base/readahead_window.h"
 #include "base/request.h"
 #include "crypto/hash_list.h"
 #include "crypto/sha256.h"
 #include "fs/object.h"
+#include "services/file_transfer.h"
 #include "threads/async_handle.h"
 
 namespace s3
@@ -121,6 +127,13 @@ namespace s3
       int download_multi();
       int download_part(const boost::shared_ptr<base::request> &req, const transfer_part *part);
 
+      // fetch the object's bytes from "offset" (which must fall on a block
+      // boundary) to "offset" + "size", taking what we can from block_cache
+      int fetch_blocks(off_t offset, size_t size);
+      int download_blocks(off_t offset, size_t size);
+      int write_fetched(const char *buffer, size_t size, off_t offset);
+      void drop_cached_blocks();
+
       int upload(const boost::shared_ptr<base::request> &);
 
       int upload_single(const boost::shared_ptr<base::request> &req, std::string *returned_etag);
@@ -138,6 +151,25 @@ namespace s3
 
       void on_download_complete(int ret);
 
+      void init_chunks(off_t size, size_t chunk_size, const boost::mutex::scoped_lock &);
+      void mark_chunks_ready(size_t size, off_t offset);
+      bool is_range_ready(size_t size, off_t offset, const boost::mutex::scoped_lock &);
+
+      // with "wait" false, returns rather than wait for chunks others are
+      // fetching
+      int fetch_range(size_t size, off_t offset, boost::mutex::scoped_lock &lock, bool wait = true);
+      int prepare_on_demand_write(size_t size, off_t offset, bool *ready, boost::mutex::scoped_lock &lock);
+      void claim_range(size_t size, off_t offset, const boost::mutex::scoped_lock &);
+      int check_fetched(boost::mutex::scoped_lock &lock);
+
+      void start_read_ahead(size_t size, off_t offset, const boost::mutex::scoped_lock &);
+      int read_ahead(const boost::shared_ptr<base::request> &req, size_t size, off_t offset);
+      void on_read_ahead_complete(int ret);
+
+      // a pread() of the whole blocks around the range, which also adds them
+      // to memory_block_cache
+      int read_through_memory(char *buffer, size_t size, off_t offset, const std::string &etag);
+
       void update_stat(const boost::mutex::scoped_lock &);
 
       boost::mutex _fs_mutex;
@@ -148,6 +180,26 @@ namespace s3
       // protected by _fs_mutex
       int _fd, _status, _async_error;
       uint64_t _ref_count;
+
+      // while downloading (with read_during_download), or for a file opened
+      // on demand, which chunks of the local file hold the object's data (or
+      // data we've written over it), so that reads of those don't have to
+      // wait for the rest
+      std::vector<bool> _ready_chunks;
+      size_t _ready_chunk_size, _missing_chunks;
+      off_t _download_size;
+      services::download_priority::ptr _download_priority;
+
+      // opened on demand (on_demand_min_size): the local file starts out
+      // sparse, and chunks are fetched as reads reach them.  _fetching_chunks
+      // marks chunks on their way, and _written_locally is set once a write
+      // or truncate has replaced some of the object's data.
+      bool _on_demand, _written_locally;
+      std::vector<bool> _fetching_chunks;
+
+      // decides what to fetch ahead of sequential reads of a file opened on
+      // demand (with max_readahead_size set)
+      boost::scoped_ptr<base::readahead_window> _readahead;
     };
   }
 }
@@ -20,6 +20,9 @@
  */
 
 #include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
 
 #include <boost/lexical_cast.hpp>
 
@@ -39,9 +42,22 @@ using s3::services::service;
 namespace
 {
   const char *IS_TRUNCATED_XPATH = "/ListBucketResult/IsTruncated";
-  const char *         KEY_XPATH = "/ListBucketResult/Contents/Key";
+  const char *    CONTENTS_XPATH = "/ListBucketResult/Contents";
   const char * NEXT_MARKER_XPATH = "/ListBucketResult/NextMarker";
   const char *      PREFIX_XPATH = "/ListBucketResult/CommonPrefixes/Prefix";
+
+  // e.g., "2009-10-12T17:50:30.000Z"; always UTC
+  time_t parse_last_modified(const string &s)
+  {
+    struct tm t;
+
+    memset(&t, 0, sizeof(t));
+
+    if (!strptime(s.c_str(), "%Y-%m-%dT%H:%M:%S", &t))
+      return 0;
+
+    return timegm(&t);
+  }
 }
 
 list_reader::list_reader(const string &prefix, bool group_common_prefixes, int max_keys)
@@ -53,9 +69,28 @@ list_reader::list_reader(const string &prefix, bool group_common_prefixes, int m
 }
 
 int list_reader::read(const request::ptr &req, xml::element_list *keys, xml::element_list *prefixes)
+{
+  entry_list entries;
+  int r;
+
+  if (!keys)
+    return -EINVAL;
+
+  keys->clear();
+
+  r = read(req, &entries, prefixes);
+
+  for (entry_list::const_iterator itor = entries.begin(); itor != entries.end(); ++itor)
+    keys->push_back(itor->key);
+
+  return r;
+}
+
+int list_reader::read(const request::ptr &req, entry_list *keys, xml::element_list *prefixes)
 {
   int r;
   xml::document_ptr doc;
+  xml::element_map_list contents;
   string temp;
   string query;
 
@@ -72,7 +107,7 @@ int list_reader::read(const request::ptr &req, xml::element_list *keys, xml::ele
   if (!_truncated)
     return 0;
 
-  query = string("prefix=") + request::url_encode(_prefix) + "&marker=" + _marker;
+  query = string("prefix=") + request::url_encode(_prefix) + "&marker=" + request::url_encode(_marker);
 
   if (_group_common_prefixes)
     query += "&delimiter=/";
@@ -101,19 +136,61 @@ int list_reader::read(const request::ptr &req, xml::element_list *keys, xml::ele
   if (prefixes && (r = xml::find(doc, PREFIX_XPATH, prefixes)))
     return r;
 
-  if ((r = xml::find(doc, KEY_XPATH, keys)))
+  if ((r = xml::find(doc, CONTENTS_XPATH, &contents)))
     return r;
 
-  if (_truncated) {
-    if (service::is_next_marker_supported()) {
-      if ((r = xml::find(doc, NEXT_MARKER_XPATH, &_marker)))
-        return r;
-    } else {
-      _marker = keys->back();
-    }
+  for (xml::element_map_list::iterator itor = contents.begin(); itor != contents.end(); ++itor) {
+    entry &e = *keys->insert(keys->end(), entry());
+
+    e.key = (*itor)["Key"];
+    e.etag = (*itor)["ETag"];
+    e.storage_class = (*itor)["StorageClass"];
+    e.size = strtoll((*itor)["Size"].c_str(), NULL, 0);
+    e.last_modified = parse_last_modified((*itor)["LastModified"]);
   }
 
+  if (_truncated && (r = get_next_marker(doc, service::is_next_marker_supported(), *keys, prefixes, &_marker)))
+    return r;
+
   return keys->size() + (prefixes ? prefixes->size() : 0);
 }
 
+int list_reader::get_next_marker(
+  const xml::document_ptr &doc, 
+  bool use_next_marker, 
+  const entry_list &keys, 
+  const xml::element_list *prefixes, 
+  string *marker)
+{
+  xml::element_list next_marker;
+  string last;
+  int r;
+
+  // S3 only includes NextMarker when the request has a delimiter, so when it's
+  // missing the next page starts after the last key (or prefix) in this one
+  if (use_next_marker) {
+    if ((r = xml::find(doc, NEXT_MARKER_XPATH, &next_marker)))
+      return r;
+
+    if (!next_marker.empty() && !next_marker.front().empty()) {
+      *marker = next_marker.front();
+      return 0;
+    }
+  }
+
+  if (!keys.empty())
+    last = keys.back().key;
+
+  if (prefixes && !prefixes->empty() && prefixes->back() > last)
+    last = prefixes->back();
+
+  if (last.empty()) {
+    S3_LOG(LOG_WARNING, "list_reader::get_next_marker", "truncated response has no marker and no keys.\n");
+    return -EIO;
+  }
+
+  *marker = last;
+  return 0;
+}
+
 
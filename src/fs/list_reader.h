@@ -22,6 +22,10 @@
 #ifndef S3_FS_LIST_READER_H
 #define S3_FS_LIST_READER_H
 
+#include <time.h>
+#include <sys/types.h>
+
+#include <list>
 #include <string>
 #include <boost/smart_ptr.hpp>
 
@@ -41,6 +45,24 @@ namespace s3
     public:
       typedef boost::shared_ptr<list_reader> ptr;
 
+      // what the list response says about each key
+      struct entry
+      {
+        std::string key;
+        std::string etag;
+        std::string storage_class;
+        off_t size;
+        time_t last_modified;
+
+        inline entry()
+          : size(0),
+            last_modified(0)
+        {
+        }
+      };
+
+      typedef std::list<entry> entry_list;
+
       list_reader(
         const std::string &prefix, 
         bool group_common_prefixes = true,
@@ -51,6 +73,19 @@ namespace s3
         base::xml::element_list *keys, 
         base::xml::element_list *prefixes);
 
+      int read(
+        const boost::shared_ptr<base::request> &req, 
+        entry_list *keys, 
+        base::xml::element_list *prefixes);
+
+      // picks the marker for the page after "doc"
+      static int get_next_marker(
+        const base::xml::document_ptr &doc, 
+        bool use_next_marker, 
+        const entry_list &keys, 
+        const base::xml::element_list *prefixes, 
+        std::string *marker);
+
     private:
       bool _truncated;
       std::string _prefix, _marker;
@@ -0,0 +1,694 @@
+/*
+ * fs/manifest.cc
+ * -------------------------------------------------------------------------
+ * Read-only snapshot of a bucket's namespace and attributes.
+ * -------------------------------------------------------------------------
+ *
+ * Copyright (c) 2012, Tarick Bedeir.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <stdexcept>
+
+#include <boost/detail/atomic_count.hpp>
+
+#include "base/config.h"
+#include "base/logger.h"
+#include "base/paths.h"
+#include "base/request.h"
+#include "fs/directory.h"
+#include "fs/list_reader.h"
+#include "fs/manifest.h"
+#include "fs/object.h"
+#include "services/service.h"
+
+using boost::detail::atomic_count;
+using std::ostream;
+using std::runtime_error;
+using std::string;
+
+using s3::base::config;
+using s3::base::paths;
+using s3::base::request;
+using s3::base::statistics;
+using s3::fs::directory;
+using s3::fs::list_reader;
+using s3::fs::manifest;
+using s3::fs::object;
+using s3::services::service;
+
+const char *manifest::s_base(NULL);
+const char *manifest::s_mapping(NULL);
+size_t manifest::s_size(0);
+const manifest::record *manifest::s_records(NULL);
+uint64_t manifest::s_count(0);
+statistics::writers::entry manifest::s_writer(manifest::statistics_writer, 0);
+
+namespace
+{
+  const char FILE_MAGIC[] = "s3fuse-manifest-1\n";
+  const size_t MAGIC_FIELD_LEN = 24;
+  const size_t WRITE_BUFFER_SIZE = 1024 * 1024;
+
+  // the most keys a single list request can return (for S3, at least)
+  const int PAGE_SIZE = 1000;
+
+  struct file_header
+  {
+    char magic[MAGIC_FIELD_LEN];
+    uint64_t count;
+    uint64_t records_offset;
+    uint64_t strings_offset;
+    uint64_t strings_size;
+    uint64_t bucket_url_offset;
+    uint32_t bucket_url_len;
+    uint32_t reserved;
+  };
+
+  atomic_count s_lookups(0), s_misses(0), s_listings(0);
+
+  inline size_t get_parent_len(const string &path)
+  {
+    size_t last_slash = path.rfind('/');
+
+    return (last_slash == string::npos) ? 0 : last_slash;
+  }
+
+  inline size_t get_name_start(size_t parent_len)
+  {
+    return parent_len ? parent_len + 1 : 0;
+  }
+
+  // orders by parent, then by name, so that siblings are adjacent
+  inline int compare(
+    const char *a, size_t a_parent_len, size_t a_len,
+    const char *b, size_t b_parent_len, size_t b_len)
+  {
+    size_t a_name = get_name_start(a_parent_len), b_name = get_name_start(b_parent_len);
+    int r = memcmp(a, b, std::min(a_parent_len, b_parent_len));
+
+    if (r)
+      return r;
+
+    if (a_parent_len != b_parent_len)
+      return (a_parent_len < b_parent_len) ? -1 : 1;
+
+    r = memcmp(a + a_name, b + b_name, std::min(a_len - a_name, b_len - b_name));
+
+    if (r)
+      return r;
+
+    if (a_len - a_name != b_len - b_name)
+      return (a_len - a_name < b_len - b_name) ? -1 : 1;
+
+    return 0;
+  }
+
+  // sorts records by path, with strings in "strings".  directories sort
+  // ahead of files with the same path (a key "x" alongside keys under "x/"),
+  // and directories we listed ahead of those implied by other keys (which
+  // have no etag), so that the first of each path is the one we keep.
+  template <class record_type>
+  struct record_less
+  {
+    const char *strings;
+
+    inline record_less(const char *strings_) : strings(strings_) { }
+
+    inline bool operator ()(const record_type &a, const record_type &b) const
+    {
+      int r = compare(
+        strings + a.path_offset, a.parent_len, a.path_len,
+        strings + b.path_offset, b.parent_len, b.path_len);
+
+      if (r)
+        return r < 0;
+
+      if (S_ISDIR(a.mode) != S_ISDIR(b.mode))
+        return S_ISDIR(a.mode);
+
+      return a.etag_len > b.etag_len;
+    }
+  };
+
+  template <class record_type>
+  struct record_same_path
+  {
+    const char *strings;
+
+    inline record_same_path(const char *strings_) : strings(strings_) { }
+
+    inline bool operator ()(const record_type &a, const record_type &b) const
+    {
+      return
+        a.path_len == b.path_len &&
+        memcmp(strings + a.path_offset, strings + b.path_offset, a.path_len) == 0;
+    }
+  };
+
+  void set_default_stat(mode_t type, time_t mtime, struct stat *s)
+  {
+    memset(s, 0, sizeof(*s));
+
+    s->st_mode = type | (config::get_default_mode() & ~S_IFMT);
+    s->st_uid = config::get_default_uid();
+    s->st_gid = config::get_default_gid();
+    s->st_mtime = mtime;
+    s->st_ctime = mtime;
+
+    if (s->st_uid == UID_MAX)
+      s->st_uid = getuid();
+
+    if (s->st_gid == GID_MAX)
+      s->st_gid = getgid();
+  }
+
+  bool write_all(int fd, const char *p, size_t remaining, off_t offset)
+  {
+
+    while (remaining) {
+      ssize_t r = pwrite(fd, p, remaining, offset);
+
+      if (r < 0) {
+        if (errno == EINTR)
+          continue;
+
+        return false;
+      }
+
+      p += r;
+      offset += r;
+      remaining -= r;
+    }
+
+    return true;
+  }
+
+  inline bool write_all(int fd, const string &data, off_t offset)
+  {
+    return write_all(fd, data.data(), data.size(), offset);
+  }
+
+  bool add_entry(
+    const request::ptr &req,
+    const list_reader::entry &e,
+    bool fetch_metadata,
+    manifest::builder *b)
+  {
+    bool is_dir = !e.key.empty() && e.key[e.key.size() - 1] == '/';
+    string path = is_dir ? e.key.substr(0, e.key.size() - 1) : e.key;
+    struct stat st;
+
+    if (path.empty() || object::is_internal_path(path))
+      return false;
+
+    if (fetch_metadata) {
+      object::ptr obj;
+
+      req->init(s3::base::HTTP_HEAD);
+      req->set_url(is_dir ? directory::build_url(path) : object::build_url(path));
+      req->run();
+
+      if (req->get_response_code() != s3::base::HTTP_SC_OK) {
+        S3_LOG(LOG_WARNING, "manifest::build", "skipping [%s]: HEAD returned %li.\n", path.c_str(), req->get_response_code());
+        return false;
+      }
+
+      obj = object::create(path, req);
+
+      if (!obj)
+        return false;
+
+      obj->copy_stat(&st);
+
+    } else {
+      set_default_stat(is_dir ? S_IFDIR : S_IFREG, e.last_modified, &st);
+      st.st_size = is_dir ? 0 : e.size;
+    }
+
+    b->add(path, st, e.etag);
+
+    return true;
+  }
+}
+
+void manifest::init()
+{
+  string file;
+  bool temporary;
+
+  if (!config::get_use_manifest())
+    return;
+
+  file = paths::transform(config::get_manifest_file());
+  temporary = file.empty();
+
+  if (temporary) {
+    char name[] = "/tmp/" PACKAGE_NAME "-manifest-XXXXXX";
+    int fd = mkstemp(name);
+
+    if (fd == -1)
+      throw runtime_error("unable to create temporary manifest file.");
+
+    close(fd);
+    file = name;
+  }
+
+  if (temporary || access(file.c_str(), F_OK) != 0) {
+    request::ptr req(new request());
+    size_t count;
+
+    req->set_hook(service::get_request_hook());
+
+    S3_LOG(LOG_INFO, "manifest::init", "listing bucket to build manifest [%s].\n", file.c_str());
+    count = build(req, file, false);
+    S3_LOG(LOG_INFO, "manifest::init", "manifest has %zu entries.\n", count);
+  }
+
+  if (!map(file, service::get_bucket_url()))
+    throw runtime_error("unable to load manifest.");
+
+  // the mapping stays valid
+  if (temporary)
+    unlink(file.c_str());
+}
+
+size_t manifest::build(const request::ptr &req, const string &file, bool fetch_metadata)
+{
+  list_reader reader("", false, PAGE_SIZE);
+  list_reader::entry_list keys;
+  builder b(file, service::get_bucket_url());
+  int r;
+
+  while ((r = reader.read(req, &keys, NULL)) > 0)
+    for (list_reader::entry_list::const_iterator itor = keys.begin(); itor != keys.end(); ++itor)
+      add_entry(req, *itor, fetch_metadata, &b);
+
+  if (r)
+    throw runtime_error("failed to list bucket objects.");
+
+  return b.commit();
+}
+
+manifest::builder::builder(const string &file, const string &bucket_url)
+  : _file(file),
+    _strings_file(file + ".strings"),
+    _strings_fd(-1),
+    _strings_size(0),
+    _bucket_url_len(bucket_url.size())
+{
+  _strings_fd = open(_strings_file.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0600);
+
+  if (_strings_fd == -1)
+    throw runtime_error("unable to create manifest string spool.");
+
+  _buffer.reserve(WRITE_BUFFER_SIZE);
+
+  // the bucket url goes first in the string table
+  append_string(bucket_url);
+}
+
+manifest::builder::~builder()
+{
+  if (_strings_fd != -1) {
+    close(_strings_fd);
+    unlink(_strings_file.c_str());
+  }
+}
+
+void manifest::builder::append_string(const string &s)
+{
+  _buffer += s;
+  _strings_size += s.size();
+
+  if (_buffer.size() >= WRITE_BUFFER_SIZE)
+    flush_strings();
+}
+
+void manifest::builder::flush_strings()
+{
+  if (!write_all(_strings_fd, _buffer, _strings_size - _buffer.size()))
+    throw runtime_error("failed to write manifest string spool.");
+
+  _buffer.clear();
+}
+
+void manifest::builder::add_record(const string &path, const struct stat &st, const string &etag)
+{
+  record rec;
+
+  memset(&rec, 0, sizeof(rec));
+
+  rec.path_offset = _strings_size;
+  rec.path_len = path.size();
+  rec.parent_len = get_parent_len(path);
+  rec.size = st.st_size;
+  rec.mtime = st.st_mtime;
+  rec.mode = st.st_mode;
+  rec.uid = st.st_uid;
+  rec.gid = st.st_gid;
+  rec.etag_offset = _strings_size + path.size();
+  rec.etag_len = etag.size();
+
+  append_string(path);
+  append_string(etag);
+
+  _records.push_back(rec);
+}
+
+void manifest::builder::add(const string &path, const struct stat &st, const string &etag)
+{
+  size_t depth = 0;
+
+  // every prefix of a path is a directory, whether or not it has an object
+  // of its own.  keys under a prefix are adjacent in a listing, so comparing
+  // with the directories of the last path is enough to add each once -- and
+  // not at all if it has an object, which comes ahead of the keys under it.
+  for (size_t slash = path.find('/'); slash != string::npos; slash = path.find('/', slash + 1), depth++) {
+    struct stat dir_st;
+
+    if (depth < _dirs.size() && _dirs[depth].size() == slash && path.compare(0, slash, _dirs[depth]) == 0)
+      continue;
+
+    _dirs.resize(depth);
+    _dirs.push_back(path.substr(0, slash));
+
+    set_default_stat(S_IFDIR, time(NULL), &dir_st);
+    add_record(_dirs.back(), dir_st, string());
+  }
+
+  _dirs.resize(depth);
+
+  if (S_ISDIR(st.st_mode))
+    _dirs.push_back(path);
+
+  add_record(path, st, etag);
+}
+
+size_t manifest::builder::commit()
+{
+  string temp_file = _file + ".tmp";
+  file_header header;
+  void *strings;
+  int fd;
+
+  flush_strings();
+
+  // the records refer to their strings by offset, so they can be sorted in
+  // place against the mapped spool
+  strings = _strings_size ? mmap(NULL, _strings_size, PROT_READ, MAP_SHARED, _strings_fd, 0) : NULL;
+
+  if (strings == MAP_FAILED)
+    throw runtime_error("unable to map manifest string spool.");
+
+  std::sort(_records.begin(), _records.end(), record_less<record>(static_cast<const char *>(strings)));
+
+  _records.erase(
+    std::unique(_records.begin(), _records.end(), record_same_path<record>(static_cast<const char *>(strings))),
+    _records.end());
+
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, FILE_MAGIC, sizeof(FILE_MAGIC) - 1);
+
+  header.count = _records.size();
+  header.records_offset = sizeof(header);
+  header.strings_offset = header.records_offset + header.count * sizeof(record);
+  header.strings_size = _strings_size;
+  header.bucket_url_offset = 0;
+  header.bucket_url_len = _bucket_url_len;
+
+  // the strings of duplicates we dropped stay in the table, unreferenced
+  fd = open(temp_file.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0600);
+
+  if (fd == -1) {
+    if (strings)
+      munmap(strings, _strings_size);
+
+    throw runtime_error("unable to create manifest file.");
+  }
+
+  try {
+    if (
+      (!_records.empty() && !write_all(fd, reinterpret_cast<const char *>(&_records[0]), _records.size() * sizeof(record), header.records_offset)) ||
+      (strings && !write_all(fd, static_cast<const char *>(strings), _strings_size, header.strings_offset)) ||
+      !write_all(fd, reinterpret_cast<const char *>(&header), sizeof(header), 0) ||
+      fsync(fd)
+    )
+      throw runtime_error("failed to write manifest.");
+
+  } catch (...) {
+    if (strings)
+      munmap(strings, _strings_size);
+
+    close(fd);
+    unlink(temp_file.c_str());
+    throw;
+  }
+
+  if (strings)
+    munmap(strings, _strings_size);
+
+  close(fd);
+
+  if (rename(temp_file.c_str(), _file.c_str())) {
+    unlink(temp_file.c_str());
+    throw runtime_error("unable to rename manifest file.");
+  }
+
+  return _records.size();
+}
+
+bool manifest::map(const string &file, const string &bucket_url)
+{
+  struct stat s;
+  const file_header *header;
+  void *base;
+  int fd;
+
+  unmap();
+
+  fd = open(file.c_str(), O_RDONLY);
+
+  if (fd == -1) {
+    S3_LOG(LOG_ERR, "manifest::map", "unable to open [%s]: %s.\n", file.c_str(), strerror(errno));
+    return false;
+  }
+
+  if (fstat(fd, &s) || static_cast<size_t>(s.st_size) < sizeof(file_header)) {
+    S3_LOG(LOG_ERR, "manifest::map", "[%s] is too short.\n", file.c_str());
+    close(fd);
+    return false;
+  }
+
+  base = mmap(NULL, s.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+
+  if (base == MAP_FAILED) {
+    S3_LOG(LOG_ERR, "manifest::map", "unable to map [%s]: %s.\n", file.c_str(), strerror(errno));
+    return false;
+  }
+
+  header = static_cast<const file_header *>(base);
+
+  if (
+    memcmp(header->magic, FILE_MAGIC, sizeof(FILE_MAGIC) - 1) != 0 ||
+    header->records_offset != sizeof(file_header) ||
+    header->strings_offset != header->records_offset + header->count * sizeof(record) ||
+    header->strings_offset + header->strings_size != static_cast<uint64_t>(s.st_size) ||
+    header->bucket_url_offset + header->bucket_url_len > header->strings_size
+  ) {
+    S3_LOG(LOG_ERR, "manifest::map", "[%s] is not a valid manifest.\n", file.c_str());
+    munmap(base, s.st_size);
+    return false;
+  }
+
+  if (string(static_cast<const char *>(base) + header->strings_offset + header->bucket_url_offset, header->bucket_url_len) != bucket_url) {
+    S3_LOG(LOG_ERR, "manifest::map", "[%s] was built for a different bucket.\n", file.c_str());
+    munmap(base, s.st_size);
+    return false;
+  }
+
+  s_mapping = static_cast<const char *>(base);
+  s_size = s.st_size;
+  s_records = reinterpret_cast<const record *>(s_mapping + header->records_offset);
+  s_count = header->count;
+
+  // everything after the records is string data, so offsets can be checked
+  // once here rather than on every lookup
+  for (uint64_t i = 0; i < s_count; i++) {
+    const record &r = s_records[i];
+
+    if (
+      r.path_offset + r.path_len > header->strings_size ||
+      r.etag_offset + r.etag_len > header->strings_size ||
+      (r.parent_len && r.parent_len >= r.path_len)
+    ) {
+      S3_LOG(LOG_ERR, "manifest::map", "[%s] has a bad record at %" PRIu64 ".\n", file.c_str(), i);
+
+      unmap();
+
+      return false;
+    }
+  }
+
+  // the strings table's offsets are relative to its start
+  s_base = s_mapping + header->strings_offset;
+
+  S3_LOG(LOG_DEBUG, "manifest::map", "mapped %" PRIu64 " entries from [%s].\n", s_count, file.c_str());
+
+  return true;
+}
+
+void manifest::unmap()
+{
+  if (s_mapping)
+    munmap(const_cast<char *>(s_mapping), s_size);
+
+  s_base = NULL;
+  s_mapping = NULL;
+  s_size = 0;
+  s_records = NULL;
+  s_count = 0;
+}
+
+void manifest::statistics_writer(ostream *o)
+{
+  if (!is_enabled())
+    return;
+
+  *o <<
+    "manifest:\n"
+    "  entries: " << s_count << "\n"
+    "  lookups: " << s_lookups << "\n"
+    "  lookups for missing paths: " << s_misses << "\n"
+    "  listings: " << s_listings << "\n";
+}
+
+const manifest::record * manifest::find(const string &path)
+{
+  size_t parent_len = get_parent_len(path);
+  uint64_t low = 0, high = s_count;
+
+  ++s_lookups;
+
+  while (low < high) {
+    uint64_t mid = low + (high - low) / 2;
+    const record &r = s_records[mid];
+    int c = compare(
+      s_base + r.path_offset, r.parent_len, r.path_len,
+      path.data(), parent_len, path.size());
+
+    if (c == 0)
+      return &r;
+
+    if (c < 0)
+      low = mid + 1;
+    else
+      high = mid;
+  }
+
+  ++s_misses;
+
+  return NULL;
+}
+
+void manifest::fill_stat(const record *r, struct stat *s)
+{
+  memset(s, 0, sizeof(*s));
+
+  s->st_nlink = 1;
+  s->st_blksize = object::get_block_size();
+  s->st_size = r->size;
+  s->st_blocks = (r->size + s->st_blksize - 1) / s->st_blksize;
+  s->st_ctime = r->mtime;
+  s->st_mtime = r->mtime;
+  s->st_mode = r->mode;
+  s->st_uid = r->uid;
+  s->st_gid = r->gid;
+}
+
+bool manifest::contains(const string &path)
+{
+  return path.empty() || find(path) != NULL;
+}
+
+bool manifest::get_stat(const string &path, struct stat *s)
+{
+  const record *r = find(path);
+
+  if (!r)
+    return false;
+
+  fill_stat(r, s);
+
+  return true;
+}
+
+int manifest::read_directory(const string &path, const filler_function &filler)
+{
+  size_t name_start = get_name_start(path.size());
+  uint64_t low = 0, high = s_count;
+
+  if (!path.empty()) {
+    const record *dir = find(path);
+
+    if (!dir)
+      return -ENOENT;
+
+    if (!S_ISDIR(dir->mode))
+      return -ENOTDIR;
+  }
+
+  ++s_listings;
+
+  // find the first record whose parent is "path" (i.e., the lower bound of
+  // ("path", ""))
+  while (low < high) {
+    uint64_t mid = low + (high - low) / 2;
+    const record &r = s_records[mid];
+
+    if (compare(s_base + r.path_offset, r.parent_len, r.path_len, path.data(), path.size(), name_start) < 0)
+      low = mid + 1;
+    else
+      high = mid;
+  }
+
+  // for POSIX compliance
+  filler(".", NULL);
+  filler("..", NULL);
+
+  for (; low < s_count; low++) {
+    const record *r = &s_records[low];
+    const char *p = s_base + r->path_offset;
+    size_t start = get_name_start(r->parent_len);
+    struct stat s;
+
+    if (r->parent_len != path.size() || memcmp(p, path.data(), path.size()) != 0)
+      break;
+
+    fill_stat(r, &s);
+    filler(string(p + start, r->path_len - start), &s);
+  }
+
+  return 0;
+}
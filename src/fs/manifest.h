@@ -0,0 +1,147 @@
+/*
+ * fs/manifest.h
+ * -------------------------------------------------------------------------
+ * Read-only snapshot of a bucket's namespace and attributes.
+ * -------------------------------------------------------------------------
+ *
+ * Copyright (c) 2012, Tarick Bedeir.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef S3_FS_MANIFEST_H
+#define S3_FS_MANIFEST_H
+
+#include <stdint.h>
+#include <sys/stat.h>
+
+#include <string>
+#include <vector>
+#include <boost/function.hpp>
+#include <boost/smart_ptr.hpp>
+#include <boost/utility.hpp>
+
+#include "base/statistics.h"
+
+namespace s3
+{
+  namespace base
+  {
+    class request;
+  }
+
+  namespace fs
+  {
+    // for buckets that don't change while mounted (use_manifest), the
+    // manifest holds every path in the bucket with its attributes, so that
+    // getattr, readdir and lookups of missing paths never reach the server.
+    //
+    // the file is a header, an array of fixed-size records sorted by
+    // (parent directory, name), and a string table.  it's mapped read-only,
+    // so opening it costs no more than an mmap however large the bucket is,
+    // and a lookup is a binary search.  the children of a directory are
+    // adjacent, so a listing is one search and a scan.
+    class manifest
+    {
+    private:
+      // strings are stored as offsets into the string table, which follows
+      // the records
+      struct record
+      {
+        uint64_t path_offset;
+        uint64_t size;
+        int64_t mtime;
+        uint64_t etag_offset;
+        uint32_t path_len;
+        uint32_t parent_len;
+        uint32_t mode;
+        uint32_t uid;
+        uint32_t gid;
+        uint32_t etag_len;
+      };
+
+    public:
+      typedef boost::function2<void, const std::string &, const struct stat *> filler_function;
+
+      // writes a manifest without holding the bucket in memory: path and
+      // etag strings go to a spool file as they're added, and only the
+      // fixed-size records are kept until commit() sorts them.
+      class builder : boost::noncopyable
+      {
+      public:
+        builder(const std::string &file, const std::string &bucket_url);
+        ~builder();
+
+        // "path" has no trailing slash.  directories that exist only as
+        // prefixes of added paths get records of their own.  paths should be
+        // added in listing (i.e., byte) order, or such directories may be
+        // recorded more than once before commit() drops the duplicates.
+        void add(const std::string &path, const struct stat &st, const std::string &etag);
+
+        // writes the manifest to "file", and returns the number of entries
+        size_t commit();
+
+      private:
+        void add_record(const std::string &path, const struct stat &st, const std::string &etag);
+        void append_string(const std::string &s);
+        void flush_strings();
+
+        std::string _file, _strings_file, _buffer;
+        int _strings_fd;
+        uint64_t _strings_size;
+        uint32_t _bucket_url_len;
+        std::vector<record> _records;
+
+        // the directories leading to (and including, if it's a directory)
+        // the last path added
+        std::vector<std::string> _dirs;
+      };
+
+      // maps manifest_file, building it first (by listing the bucket) if it
+      // doesn't exist
+      static void init();
+
+      // lists the bucket and writes a manifest to "file".  with
+      // "fetch_metadata", sends a HEAD for each object so that modes, owners
+      // and types are recorded rather than defaulted.  returns the number of
+      // entries written.
+      static size_t build(const boost::shared_ptr<base::request> &req, const std::string &file, bool fetch_metadata);
+
+      // returns false if "file" isn't a valid manifest for "bucket_url"
+      static bool map(const std::string &file, const std::string &bucket_url);
+      static void unmap();
+
+      inline static bool is_enabled() { return s_base != NULL; }
+
+      static bool contains(const std::string &path);
+      static bool get_stat(const std::string &path, struct stat *s);
+
+      // returns -ENOENT or -ENOTDIR if "path" isn't a directory
+      static int read_directory(const std::string &path, const filler_function &filler);
+
+    private:
+      static const record * find(const std::string &path);
+      static void fill_stat(const record *r, struct stat *s);
+
+      static void statistics_writer(std::ostream *o);
+
+      static const char *s_base, *s_mapping;
+      static size_t s_size;
+      static const record *s_records;
+      static uint64_t s_count;
+      static base::statistics::writers::entry s_writer;
+    };
+  }
+}
+
+#endif
@@ -0,0 +1,172 @@
+/*
+ * fs/memory_block_cache.cc
+ * -------------------------------------------------------------------------
+ * In-memory cache of file data blocks, in front of the local files.
+ * -------------------------------------------------------------------------
+ *
+ * Copyright (c) 2013, Tarick Bedeir.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <string.h>
+
+#include <algorithm>
+
+#include <boost/functional/hash.hpp>
+#include <boost/lexical_cast.hpp>
+
+#include "base/config.h"
+#include "base/logger.h"
+#include "fs/memory_block_cache.h"
+
+using boost::lexical_cast;
+using boost::mutex;
+using std::ostream;
+using std::string;
+using std::vector;
+
+using s3::base::char_vector;
+using s3::base::char_vector_ptr;
+using s3::base::config;
+using s3::base::statistics;
+using s3::fs::memory_block_cache;
+
+vector<memory_block_cache::shard_ptr> memory_block_cache::s_shards;
+statistics::writers::entry memory_block_cache::s_writer(memory_block_cache::statistics_writer, 0);
+
+namespace
+{
+  const size_t SHARDS = 16;
+
+  inline double percent(uint64_t a, uint64_t b)
+  {
+    return b ? static_cast<double>(a) / static_cast<double>(b) * 100.0 : 0.0;
+  }
+}
+
+void memory_block_cache::init()
+{
+  size_t capacity = config::get_max_block_cache_memory();
+
+  s_shards.clear();
+
+  if (capacity == 0)
+    return;
+
+  if (capacity / SHARDS < BLOCK_SIZE)
+    S3_LOG(LOG_WARNING, "memory_block_cache::init", "max_block_cache_memory is too small to hold any blocks.\n");
+
+  for (size_t i = 0; i < SHARDS; i++) {
+    shard_ptr s(new shard());
+
+    s->blocks.reset(new block_map(capacity / SHARDS));
+    s_shards.push_back(s);
+  }
+}
+
+string memory_block_cache::build_key(const string &url, const string &etag, size_t index)
+{
+  return url + '\n' + etag + '\n' + lexical_cast<string>(index);
+}
+
+memory_block_cache::shard & memory_block_cache::get_shard(const string &key)
+{
+  return *s_shards[boost::hash<string>()(key) % s_shards.size()];
+}
+
+ssize_t memory_block_cache::read(const string &url, const string &etag, char *buffer, size_t size, off_t offset)
+{
+  size_t copied = 0;
+
+  while (copied < size) {
+    off_t o = offset + copied;
+    size_t in_block = o % BLOCK_SIZE, len;
+    string key = build_key(url, etag, o / BLOCK_SIZE);
+    shard &s = get_shard(key);
+    char_vector_ptr block;
+
+    {
+      mutex::scoped_lock lock(s.mutex);
+
+      if (!s.blocks->find(key, &block)) {
+        s.misses++;
+        return -1;
+      }
+
+      len = (in_block < block->size()) ? std::min(size - copied, block->size() - in_block) : 0;
+      s.bytes_served += len;
+
+      if (copied + len == size || block->size() < BLOCK_SIZE)
+        s.hits++;
+    }
+
+    // blocks never change once they're in, so this needs no lock
+    if (len)
+      memcpy(buffer + copied, &(*block)[in_block], len);
+
+    copied += len;
+
+    // the object ends in this block
+    if (block->size() < BLOCK_SIZE)
+      break;
+  }
+
+  return copied;
+}
+
+void memory_block_cache::put(const string &url, const string &etag, size_t index, const char *data, size_t size)
+{
+  string key = build_key(url, etag, index);
+  shard &s = get_shard(key);
+  char_vector_ptr block(new char_vector(data, data + size));
+
+  {
+    mutex::scoped_lock lock(s.mutex);
+
+    s.blocks->insert(key, block, size);
+    s.fills++;
+  }
+}
+
+void memory_block_cache::statistics_writer(ostream *o)
+{
+  size_t blocks = 0, bytes = 0, hot_bytes = 0;
+  uint64_t hits = 0, misses = 0, fills = 0, bytes_served = 0;
+
+  for (vector<shard_ptr>::const_iterator itor = s_shards.begin(); itor != s_shards.end(); ++itor) {
+    mutex::scoped_lock lock((*itor)->mutex);
+
+    blocks += (*itor)->blocks->get_size();
+    bytes += (*itor)->blocks->get_weight();
+    hot_bytes += (*itor)->blocks->get_hot_weight();
+    hits += (*itor)->hits;
+    misses += (*itor)->misses;
+    fills += (*itor)->fills;
+    bytes_served += (*itor)->bytes_served;
+  }
+
+  o->setf(ostream::fixed);
+  o->precision(2);
+
+  *o <<
+    "memory block cache:\n"
+    "  blocks: " << blocks << "\n"
+    "  size (bytes): " << bytes << "\n"
+    "  hot (bytes): " << hot_bytes << "\n"
+    "  read hits: " << hits << "\n"
+    "  read misses: " << misses << "\n"
+    "  hit rate: " << percent(hits, hits + misses) << " %\n"
+    "  bytes served: " << bytes_served << "\n"
+    "  blocks added: " << fills << "\n";
+}
@@ -0,0 +1,110 @@
+/*
+ * fs/memory_block_cache.h
+ * -------------------------------------------------------------------------
+ * In-memory cache of file data blocks, in front of the local files.
+ * -------------------------------------------------------------------------
+ *
+ * Copyright (c) 2013, Tarick Bedeir.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef S3_FS_MEMORY_BLOCK_CACHE_H
+#define S3_FS_MEMORY_BLOCK_CACHE_H
+
+#include <string>
+#include <vector>
+
+#include <boost/smart_ptr.hpp>
+#include <boost/thread.hpp>
+
+#include "base/clock_pro_map.h"
+#include "base/request.h"
+#include "base/statistics.h"
+
+namespace s3
+{
+  namespace fs
+  {
+    // every read of an open file is a pread() on its local copy.  with
+    // max_block_cache_memory set, blocks of BLOCK_SIZE bytes of what those
+    // reads return are also kept in memory, keyed by (object URL, etag,
+    // block index), and reads are copied straight from there.  since the
+    // key includes the etag, the blocks outlive the open and serve the
+    // next one, even before its download finishes.
+    //
+    // only data that's been checked (a complete, unmodified download) goes
+    // in, and a file with unflushed changes bypasses the cache.
+    //
+    // the blocks are split over SHARDS maps, each with its own lock and an
+    // equal share of the memory, and are evicted with CLOCK-Pro (see
+    // base/clock_pro_map.h) so that a file read once doesn't push out the
+    // blocks read over and over.
+    class memory_block_cache
+    {
+    public:
+      enum { BLOCK_SIZE = 64 * 1024 };
+
+      static void init();
+
+      inline static bool is_enabled() { return !s_shards.empty(); }
+
+      // copies "size" bytes at "offset" into "buffer", and returns the
+      // number of bytes copied (short only at the end of the object), or -1
+      // if any block isn't cached
+      static ssize_t read(
+        const std::string &url,
+        const std::string &etag,
+        char *buffer,
+        size_t size,
+        off_t offset);
+
+      // adds block "index", which must be BLOCK_SIZE bytes unless it's the
+      // object's last block
+      static void put(
+        const std::string &url,
+        const std::string &etag,
+        size_t index,
+        const char *data,
+        size_t size);
+
+    private:
+      typedef base::clock_pro_map<std::string, base::char_vector_ptr> block_map;
+
+      struct shard
+      {
+        boost::mutex mutex;
+        boost::scoped_ptr<block_map> blocks;
+
+        // kept here rather than in global counters, which every read would
+        // contend on.  a read counts as a hit or a miss in the shard of the
+        // last block it looked at.
+        uint64_t hits, misses, fills, bytes_served;
+
+        inline shard() : hits(0), misses(0), fills(0), bytes_served(0) { }
+      };
+
+      typedef boost::shared_ptr<shard> shard_ptr;
+
+      static std::string build_key(const std::string &url, const std::string &etag, size_t index);
+      static shard & get_shard(const std::string &key);
+
+      static void statistics_writer(std::ostream *o);
+
+      static std::vector<shard_ptr> s_shards;
+      static base::statistics::writers::entry s_writer;
+    };
+  }
+}
+
+#endif
@@ -0,0 +1,806 @@
+/*
+ * fs/metadata_store.cc
+ * -------------------------------------------------------------------------
+ * Persists object metadata (response headers) across mounts.
+ * -------------------------------------------------------------------------
+ *
+ * Copyright (c) 2012, Tarick Bedeir.
+ * 
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <utility>
+#include <vector>
+
+#include <boost/detail/atomic_count.hpp>
+
+#include "base/config.h"
+#include "base/logger.h"
+#include "base/paths.h"
+#include "fs/metadata_store.h"
+#include "services/service.h"
+
+using boost::mutex;
+using boost::scoped_ptr;
+using boost::thread;
+using boost::detail::atomic_count;
+using std::make_pair;
+using std::ostream;
+using std::pair;
+using std::string;
+using std::vector;
+
+using s3::base::config;
+using s3::base::header_map;
+using s3::base::paths;
+using s3::base::request;
+using s3::base::statistics;
+using s3::fs::metadata_store;
+using s3::services::service;
+
+mutex metadata_store::s_mutex;
+string metadata_store::s_file;
+int metadata_store::s_fd(-1);
+metadata_store::descriptor::ptr metadata_store::s_descriptor;
+off_t metadata_store::s_file_size(0);
+off_t metadata_store::s_live_size(0);
+off_t metadata_store::s_max_size(0);
+bool metadata_store::s_compact_due(false);
+uint64_t metadata_store::s_use_counter(0);
+metadata_store::index_map metadata_store::s_index;
+scoped_ptr<thread> metadata_store::s_compactor;
+statistics::writers::entry metadata_store::s_writer(metadata_store::statistics_writer, 0);
+
+namespace
+{
+  const char FILE_MAGIC[] = "s3fuse-metadata-store-2\n";
+  const size_t FILE_MAGIC_LEN = sizeof(FILE_MAGIC) - 1;
+
+  const uint32_t RECORD_PUT = 1;
+  const uint32_t RECORD_ERASE = 2;
+
+  // type, payload size, payload checksum
+  const size_t RECORD_HEADER_LEN = 3 * sizeof(uint32_t);
+
+  // headers besides those with the service prefix that object::init() and
+  // friends look at
+  const char *SAVED_HEADERS[] = {
+    "Cache-Control",
+    "Content-Length",
+    "Content-Type",
+    "ETag",
+    "Last-Modified",
+    NULL };
+
+  atomic_count s_compactions(0), s_evictions(0), s_bad_records(0);
+
+  // FNV-1a, only to catch torn writes at the end of the log
+  uint32_t checksum(const char *data, size_t size)
+  {
+    uint32_t h = 2166136261u;
+
+    for (size_t i = 0; i < size; i++) {
+      h ^= static_cast<uint8_t>(data[i]);
+      h *= 16777619u;
+    }
+
+    return h;
+  }
+
+  inline void put_u32(string *s, uint32_t v)
+  {
+    s->append(reinterpret_cast<const char *>(&v), sizeof(v));
+  }
+
+  inline void put_string(string *s, const string &v)
+  {
+    put_u32(s, v.size());
+    s->append(v);
+  }
+
+  inline bool get_u32(const char **p, const char *end, uint32_t *v)
+  {
+    if (end - *p < static_cast<ptrdiff_t>(sizeof(*v)))
+      return false;
+
+    memcpy(v, *p, sizeof(*v));
+    *p += sizeof(*v);
+
+    return true;
+  }
+
+  inline bool get_string(const char **p, const char *end, string *v)
+  {
+    uint32_t size;
+
+    if (!get_u32(p, end, &size) || end - *p < static_cast<ptrdiff_t>(size))
+      return false;
+
+    v->assign(*p, size);
+    *p += size;
+
+    return true;
+  }
+
+  bool is_saved_header(const string &name)
+  {
+    const string &prefix = service::get_header_prefix();
+
+    if (strncasecmp(name.c_str(), prefix.c_str(), prefix.size()) == 0)
+      return true;
+
+    for (const char **h = SAVED_HEADERS; *h; h++)
+      if (strcasecmp(name.c_str(), *h) == 0)
+        return true;
+
+    return false;
+  }
+
+  string build_record(const string &path, uint32_t type, const string &body)
+  {
+    string payload, record;
+
+    put_string(&payload, path);
+    payload += body;
+
+    put_u32(&record, type);
+    put_u32(&record, payload.size());
+    put_u32(&record, checksum(payload.data(), payload.size()));
+    record += payload;
+
+    return record;
+  }
+
+  string build_file_header(const string &bucket_url)
+  {
+    string header(FILE_MAGIC, FILE_MAGIC_LEN);
+
+    put_string(&header, bucket_url);
+
+    return header;
+  }
+
+  bool write_all(int fd, const string &data, off_t offset)
+  {
+    const char *p = data.data();
+    size_t remaining = data.size();
+
+    while (remaining) {
+      ssize_t r = pwrite(fd, p, remaining, offset);
+
+      if (r < 0) {
+        if (errno == EINTR)
+          continue;
+
+        return false;
+      }
+
+      p += r;
+      offset += r;
+      remaining -= r;
+    }
+
+    return true;
+  }
+
+  bool parse_entry(const string &body, metadata_store::entry *e)
+  {
+    const char *p = body.data(), *end = p + body.size();
+    uint32_t lm_low, lm_high, sa_low, sa_high, count;
+
+    if (
+      !get_string(&p, end, &e->url) ||
+      !get_u32(&p, end, &lm_low) ||
+      !get_u32(&p, end, &lm_high) ||
+      !get_u32(&p, end, &sa_low) ||
+      !get_u32(&p, end, &sa_high) ||
+      !get_u32(&p, end, &count))
+      return false;
+
+    e->last_modified = static_cast<time_t>((static_cast<uint64_t>(lm_high) << 32) | lm_low);
+    e->saved_at = static_cast<time_t>((static_cast<uint64_t>(sa_high) << 32) | sa_low);
+    e->headers.clear();
+
+    for (uint32_t i = 0; i < count; i++) {
+      string key, value;
+
+      if (!get_string(&p, end, &key) || !get_string(&p, end, &value))
+        return false;
+
+      e->headers[key] = value;
+    }
+
+    return true;
+  }
+}
+
+void metadata_store::init()
+{
+  if (config::get_metadata_store_file().empty())
+    return;
+
+  open_store(paths::transform(config::get_metadata_store_file()), config::get_max_metadata_store_size());
+}
+
+bool metadata_store::open_store(const string &file, off_t max_size)
+{
+  mutex::scoped_lock lock(s_mutex);
+  string header;
+  off_t dead_size;
+
+  s_file = file;
+  s_max_size = max_size;
+
+  set_fd(open(s_file.c_str(), O_RDWR | O_CREAT, S_IRUSR | S_IWUSR));
+
+  if (s_fd == -1) {
+    S3_LOG(LOG_WARNING, "metadata_store::open_store", "unable to open [%s]: %s. metadata store disabled.\n", s_file.c_str(), strerror(errno));
+    return false;
+  }
+
+  header = build_file_header(service::get_bucket_url());
+
+  if (!load(service::get_bucket_url())) {
+    // start over
+    s_index.clear();
+    s_live_size = 0;
+
+    if (ftruncate(s_fd, 0) || !write_all(s_fd, header, 0)) {
+      S3_LOG(LOG_WARNING, "metadata_store::open_store", "unable to initialize [%s]. metadata store disabled.\n", s_file.c_str());
+
+      set_fd(-1);
+
+      return false;
+    }
+
+    s_file_size = header.size();
+  }
+
+  S3_LOG(LOG_DEBUG, "metadata_store::open_store", "loaded %zu entries from [%s].\n", s_index.size(), s_file.c_str());
+
+  // records that have been replaced or erased
+  dead_size = s_file_size - static_cast<off_t>(header.size()) - s_live_size;
+
+  // the compactor thread compacts
+  s_compact_due = (s_file_size > s_max_size || dead_size > s_live_size);
+
+  return true;
+}
+
+void metadata_store::close_store()
+{
+  mutex::scoped_lock lock(s_mutex);
+
+  set_fd(-1);
+
+  s_index.clear();
+  s_file_size = 0;
+  s_live_size = 0;
+  s_compact_due = false;
+}
+
+void metadata_store::set_fd(int fd)
+{
+  s_descriptor.reset(fd == -1 ? NULL : new descriptor(fd));
+  s_fd = fd;
+}
+
+bool metadata_store::load(const string &bucket_url)
+{
+  string header = build_file_header(bucket_url);
+  struct stat s;
+  const char *base, *p, *end, *good_end;
+
+  if (fstat(s_fd, &s))
+    return false;
+
+  if (s.st_size < static_cast<off_t>(header.size()))
+    return false;
+
+  base = static_cast<const char *>(mmap(NULL, s.st_size, PROT_READ, MAP_PRIVATE, s_fd, 0));
+
+  if (base == MAP_FAILED)
+    return false;
+
+  if (memcmp(base, header.data(), header.size()) != 0) {
+    S3_LOG(LOG_WARNING, "metadata_store::load", "[%s] belongs to a different bucket or version. discarding.\n", s_file.c_str());
+    munmap(const_cast<char *>(base), s.st_size);
+
+    return false;
+  }
+
+  p = base + header.size();
+  end = base + s.st_size;
+  good_end = p;
+
+  while (p < end) {
+    const char *payload, *payload_end;
+    uint32_t type, size, sum;
+    string path;
+
+    if (!get_u32(&p, end, &type) || !get_u32(&p, end, &size) || !get_u32(&p, end, &sum))
+      break;
+
+    if (end - p < static_cast<ptrdiff_t>(size) || checksum(p, size) != sum)
+      break;
+
+    payload = p;
+    payload_end = p + size;
+
+    if (!get_string(&payload, payload_end, &path))
+      break;
+
+    if (type == RECORD_PUT) {
+      index_entry &ie = s_index[path];
+
+      if (ie.size)
+        s_live_size -= ie.size;
+
+      ie.offset = good_end - base;
+      ie.size = RECORD_HEADER_LEN + size;
+      ie.last_used = 0;
+
+      s_live_size += ie.size;
+
+    } else if (type == RECORD_ERASE) {
+      index_map::iterator itor = s_index.find(path);
+
+      if (itor != s_index.end()) {
+        s_live_size -= itor->second.size;
+        s_index.erase(itor);
+      }
+
+    } else {
+      break;
+    }
+
+    p = payload_end;
+    good_end = p;
+  }
+
+  if (good_end < end) {
+    // most likely a write that was cut short.  everything before it is fine.
+    ++s_bad_records;
+    S3_LOG(LOG_WARNING, "metadata_store::load", "truncating [%s] at bad record.\n", s_file.c_str());
+  }
+
+  s_file_size = good_end - base;
+
+  munmap(const_cast<char *>(base), s.st_size);
+
+  if (s_file_size != s.st_size && ftruncate(s_fd, s_file_size))
+    return false;
+
+  return true;
+}
+
+void metadata_store::append(const string &path, uint32_t type, const string &body)
+{
+  string record = build_record(path, type, body);
+
+  if (!write_all(s_fd, record, s_file_size)) {
+    S3_LOG(LOG_WARNING, "metadata_store::append", "write failed for [%s]: %s\n", path.c_str(), strerror(errno));
+
+    // a partial record is caught by the checksum at load, but anything after
+    // it would be lost, so leave s_file_size alone and let the next record
+    // overwrite it.  the previous record for this path is now out of date,
+    // though.
+    if (type == RECORD_PUT) {
+      index_map::iterator itor = s_index.find(path);
+
+      if (itor != s_index.end()) {
+        s_live_size -= itor->second.size;
+        s_index.erase(itor);
+      }
+    }
+
+    return;
+  }
+
+  if (type == RECORD_PUT) {
+    index_entry &ie = s_index[path];
+
+    if (ie.size)
+      s_live_size -= ie.size;
+
+    ie.offset = s_file_size;
+    ie.size = record.size();
+    ie.last_used = ++s_use_counter;
+
+    s_live_size += ie.size;
+  }
+
+  s_file_size += record.size();
+}
+
+bool metadata_store::read(int fd, const index_entry &ie, string *path, string *body)
+{
+  string record(ie.size, '\0');
+  const char *p, *end;
+  uint32_t type, size, sum;
+  ssize_t r;
+
+  do {
+    r = pread(fd, &record[0], ie.size, ie.offset);
+  } while (r < 0 && errno == EINTR);
+
+  if (r != static_cast<ssize_t>(ie.size))
+    return false;
+
+  p = record.data();
+  end = p + record.size();
+
+  if (!get_u32(&p, end, &type) || !get_u32(&p, end, &size) || !get_u32(&p, end, &sum))
+    return false;
+
+  if (type != RECORD_PUT || end - p != static_cast<ptrdiff_t>(size) || checksum(p, size) != sum)
+    return false;
+
+  if (!get_string(&p, end, path))
+    return false;
+
+  body->assign(p, end - p);
+
+  return true;
+}
+
+bool metadata_store::find(const string &path, entry *e)
+{
+  mutex::scoped_lock lock(s_mutex);
+  index_map::iterator itor;
+  index_entry ie;
+  descriptor::ptr fd;
+  string record_path, body;
+  bool ok;
+
+  if (s_fd == -1)
+    return false;
+
+  itor = s_index.find(path);
+
+  if (itor == s_index.end())
+    return false;
+
+  ie = itor->second;
+  fd = s_descriptor;
+
+  // every lookup that misses the cache comes through here, so don't make
+  // them all wait on the disk
+  lock.unlock();
+
+  ok = read(fd->get(), ie, &record_path, &body) && record_path == path && parse_entry(body, e);
+
+  lock.lock();
+
+  itor = s_index.find(path);
+
+  // erased since
+  if (itor == s_index.end())
+    return false;
+
+  if (ok) {
+    itor->second.last_used = ++s_use_counter;
+    return true;
+  }
+
+  // a compaction (or a failed one, which clears the store) may have moved
+  // the record since we read it, so only drop the entry if it still points
+  // at what we read
+  if (fd == s_descriptor && itor->second.offset == ie.offset) {
+    ++s_bad_records;
+    S3_LOG(LOG_WARNING, "metadata_store::find", "bad record for [%s]. dropping.\n", path.c_str());
+
+    s_live_size -= itor->second.size;
+    s_index.erase(itor);
+  }
+
+  return false;
+}
+
+void metadata_store::capture(const request::ptr &req, entry *e)
+{
+  const header_map &headers = req->get_response_headers();
+
+  e->url = req->get_url();
+  e->last_modified = req->get_last_modified();
+  e->saved_at = time(NULL);
+  e->headers.clear();
+
+  for (header_map::const_iterator itor = headers.begin(); itor != headers.end(); ++itor)
+    if (is_saved_header(itor->first))
+      e->headers[itor->first] = itor->second;
+}
+
+void metadata_store::put(const string &path, const request::ptr &req)
+{
+  entry e;
+
+  if (s_fd == -1)
+    return;
+
+  capture(req, &e);
+  put(path, e);
+}
+
+void metadata_store::put(const string &path, const entry &e)
+{
+  mutex::scoped_lock lock(s_mutex);
+  uint64_t last_modified = static_cast<uint64_t>(e.last_modified);
+  uint64_t saved_at = static_cast<uint64_t>(e.saved_at);
+  string body, saved;
+  uint32_t count = 0;
+
+  if (s_fd == -1)
+    return;
+
+  for (header_map::const_iterator itor = e.headers.begin(); itor != e.headers.end(); ++itor) {
+    if (!is_saved_header(itor->first))
+      continue;
+
+    put_string(&saved, itor->first);
+    put_string(&saved, itor->second);
+    count++;
+  }
+
+  put_string(&body, e.url);
+  put_u32(&body, static_cast<uint32_t>(last_modified));
+  put_u32(&body, static_cast<uint32_t>(last_modified >> 32));
+  put_u32(&body, static_cast<uint32_t>(saved_at));
+  put_u32(&body, static_cast<uint32_t>(saved_at >> 32));
+  put_u32(&body, count);
+  body += saved;
+
+  append(path, RECORD_PUT, body);
+
+  if (s_file_size > s_max_size)
+    s_compact_due = true;
+}
+
+void metadata_store::erase(const string &path)
+{
+  mutex::scoped_lock lock(s_mutex);
+  index_map::iterator itor;
+
+  if (s_fd == -1)
+    return;
+
+  itor = s_index.find(path);
+
+  if (itor == s_index.end())
+    return;
+
+  s_live_size -= itor->second.size;
+  s_index.erase(itor);
+
+  append(path, RECORD_ERASE, string());
+}
+
+void metadata_store::start_compactor()
+{
+  if (s_fd == -1)
+    return;
+
+  s_compactor.reset(new thread(&metadata_store::compactor));
+}
+
+void metadata_store::stop_compactor()
+{
+  if (!s_compactor)
+    return;
+
+  s_compactor->interrupt();
+  s_compactor->join();
+  s_compactor.reset();
+}
+
+void metadata_store::compactor()
+{
+  try {
+    while (true) {
+      compact_if_due();
+
+      boost::this_thread::sleep(boost::posix_time::seconds(1));
+    }
+
+  } catch (const boost::thread_interrupted &) {
+    // stop_compactor()
+  }
+}
+
+void metadata_store::compact_if_due()
+{
+  {
+    mutex::scoped_lock lock(s_mutex);
+
+    if (s_fd == -1 || !s_compact_due)
+      return;
+
+    s_compact_due = false;
+  }
+
+  compact();
+}
+
+// compaction rewrites the live records from a snapshot of the index without
+// holding s_mutex, so that puts and erases only ever wait for an append.
+// records appended while the rewrite ran are carried over when the new file
+// is swapped in.  only one thread compacts, so s_fd stays open until then.
+void metadata_store::compact()
+{
+  mutex::scoped_lock lock(s_mutex);
+  string temp_file = s_file + ".compact";
+  string header = build_file_header(service::get_bucket_url());
+  index_map snapshot, new_index, final_index;
+  off_t snapshot_size, live_size, new_size = 0, final_live_size = 0;
+  int fd;
+  bool ok;
+
+  ++s_compactions;
+
+  snapshot = s_index;
+  snapshot_size = s_file_size;
+  live_size = s_live_size;
+
+  lock.unlock();
+
+  // if the live records alone are over half the limit, drop the least
+  // recently used ones so that we don't end up compacting on every put
+  if (live_size > s_max_size / 2) {
+    vector<pair<uint64_t, string> > by_use;
+
+    by_use.reserve(snapshot.size());
+
+    for (index_map::const_iterator itor = snapshot.begin(); itor != snapshot.end(); ++itor)
+      by_use.push_back(make_pair(itor->second.last_used, itor->first));
+
+    std::sort(by_use.begin(), by_use.end());
+
+    for (size_t i = 0; i < by_use.size() && live_size > s_max_size / 2; i++) {
+      index_map::iterator itor = snapshot.find(by_use[i].second);
+
+      live_size -= itor->second.size;
+      snapshot.erase(itor);
+
+      ++s_evictions;
+    }
+  }
+
+  fd = open(temp_file.c_str(), O_RDWR | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+  ok = (fd != -1 && write_all(fd, header, 0));
+  new_size = header.size();
+
+  for (index_map::const_iterator itor = snapshot.begin(); ok && itor != snapshot.end(); ++itor) {
+    index_entry &ie = new_index[itor->first];
+
+    ie = itor->second;
+    ok = copy_record(fd, &ie, &new_size);
+  }
+
+  ok = ok && (fsync(fd) == 0);
+
+  lock.lock();
+
+  // catch up with what changed since the snapshot: copy records put since,
+  // and note paths erased since, which the new file still has records for
+  for (index_map::const_iterator itor = s_index.begin(); ok && itor != s_index.end(); ++itor) {
+    index_map::const_iterator copied = new_index.find(itor->first);
+    index_entry &ie = final_index[itor->first];
+
+    ie = itor->second;
+
+    if (ie.offset >= snapshot_size) {
+      ok = copy_record(fd, &ie, &new_size);
+
+    } else if (copied != new_index.end()) {
+      ie.offset = copied->second.offset;
+
+    } else {
+      // evicted above
+      final_index.erase(itor->first);
+      continue;
+    }
+
+    final_live_size += ie.size;
+  }
+
+  for (index_map::const_iterator itor = new_index.begin(); ok && itor != new_index.end(); ++itor) {
+    if (s_index.find(itor->first) == s_index.end()) {
+      string record = build_record(itor->first, RECORD_ERASE, string());
+
+      ok = write_all(fd, record, new_size);
+      new_size += record.size();
+    }
+  }
+
+  if (ok && rename(temp_file.c_str(), s_file.c_str()) == 0) {
+    set_fd(fd);
+
+    s_file_size = new_size;
+    s_live_size = final_live_size;
+    s_index.swap(final_index);
+
+    S3_LOG(LOG_DEBUG, "metadata_store::compact", "compacted [%s] to %zu entries.\n", s_file.c_str(), s_index.size());
+
+    return;
+  }
+
+  S3_LOG(LOG_WARNING, "metadata_store::compact", "compaction of [%s] failed. clearing store.\n", s_file.c_str());
+
+  if (fd != -1) {
+    close(fd);
+    unlink(temp_file.c_str());
+  }
+
+  // losing the store only costs us round trips, so start over rather than
+  // let the log grow without bound
+  s_index.clear();
+  s_live_size = 0;
+
+  if (ftruncate(s_fd, 0) || !write_all(s_fd, header, 0)) {
+    set_fd(-1);
+    return;
+  }
+
+  s_file_size = header.size();
+}
+
+// copies the record at ie->offset in s_fd to the end of fd, and points ie at
+// the copy
+bool metadata_store::copy_record(int fd, index_entry *ie, off_t *size)
+{
+  string record(ie->size, '\0');
+
+  if (pread(s_fd, &record[0], record.size(), ie->offset) != static_cast<ssize_t>(record.size()))
+    return false;
+
+  if (!write_all(fd, record, *size))
+    return false;
+
+  ie->offset = *size;
+  *size += record.size();
+
+  return true;
+}
+
+void metadata_store::statistics_writer(ostream *o)
+{
+  size_t entries;
+  off_t file_size;
+
+  {
+    mutex::scoped_lock lock(s_mutex);
+
+    if (s_fd == -1)
+      return;
+
+    entries = s_index.size();
+    file_size = s_file_size;
+  }
+
+  *o <<
+    "metadata store:\n"
+    "  entries: " << entries << "\n"
+    "  file size: " << file_size << "\n"
+    "  compactions: " << s_compactions << "\n"
+    "  evictions: " << s_evictions << "\n"
+    "  bad records: " << s_bad_records << "\n";
+}
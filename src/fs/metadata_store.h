@@ -0,0 +1,142 @@
+/*
+ * fs/metadata_store.h
+ * -------------------------------------------------------------------------
+ * Persists object metadata (response headers) across mounts.
+ * -------------------------------------------------------------------------
+ *
+ * Copyright (c) 2012, Tarick Bedeir.
+ * 
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ * 
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ * 
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef S3_FS_METADATA_STORE_H
+#define S3_FS_METADATA_STORE_H
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include <map>
+#include <string>
+
+#include <boost/smart_ptr.hpp>
+#include <boost/thread.hpp>
+#include <boost/utility.hpp>
+
+#include "base/request.h"
+#include "base/statistics.h"
+
+namespace s3
+{
+  namespace fs
+  {
+    // the store is an append-only log of records, each holding the URL and
+    // response headers last seen for a path (or noting that the path has
+    // been dropped).  the log is mapped and scanned once at startup to build
+    // an index of path -> record offset; records are read back on demand.
+    //
+    // the cache serves metadata saved less than max_saved_metadata_age_in_s
+    // ago as is, and revalidates it in the background.  older metadata costs
+    // a HEAD to the saved URL first, but no more than one (there's no probing
+    // for a directory and then a file).
+    class metadata_store
+    {
+    public:
+      struct entry
+      {
+        std::string url;
+        time_t last_modified, saved_at;
+        base::header_map headers;
+      };
+
+      static void init();
+
+      // init() opens the configured store with these.  a store opened with
+      // open_store() must be closed before opening another.
+      static bool open_store(const std::string &file, off_t max_size);
+      static void close_store();
+
+      inline static bool is_enabled() { return s_fd != -1; }
+
+      static bool find(const std::string &path, entry *e);
+      static void put(const std::string &path, const base::request::ptr &req);
+      static void put(const std::string &path, const entry &e);
+
+      // copies what put() would save from the response to "req", for when
+      // the request will be reused before we know whether to save it
+      static void capture(const base::request::ptr &req, entry *e);
+      static void erase(const std::string &path);
+
+      // start (and stop) the thread that compacts the store.  compaction
+      // rewrites and fsyncs the whole file, so it gets a thread of its own
+      // rather than holding up the cache's sweeper, which also keeps the
+      // coarse clock (see base::timer) ticking.
+      static void start_compactor();
+      static void stop_compactor();
+
+      // rewrites the store without dropped records.  only one thread may
+      // compact at a time.
+      static void compact();
+
+    private:
+      // find() reads records without holding s_mutex, so a compaction that
+      // swaps in a new file mustn't close the old descriptor out from under
+      // it.  the last reference closes it.
+      class descriptor : boost::noncopyable
+      {
+      public:
+        typedef boost::shared_ptr<descriptor> ptr;
+
+        inline explicit descriptor(int fd) : _fd(fd) { }
+        inline ~descriptor() { ::close(_fd); }
+
+        inline int get() const { return _fd; }
+
+      private:
+        int _fd;
+      };
+
+      struct index_entry
+      {
+        off_t offset;
+        uint32_t size;
+        uint64_t last_used;
+      };
+
+      typedef std::map<std::string, index_entry> index_map;
+
+      static void set_fd(int fd);
+      static bool load(const std::string &bucket_url);
+      static void append(const std::string &path, uint32_t type, const std::string &payload);
+      static bool read(int fd, const index_entry &ie, std::string *path, std::string *payload);
+      static void compactor();
+      static void compact_if_due();
+      static bool copy_record(int fd, index_entry *ie, off_t *size);
+
+      static void statistics_writer(std::ostream *o);
+
+      static boost::mutex s_mutex;
+      static std::string s_file;
+      static int s_fd;
+      static descriptor::ptr s_descriptor;
+      static off_t s_file_size, s_live_size, s_max_size;
+      static bool s_compact_due;
+      static uint64_t s_use_counter;
+      static index_map s_index;
+      static boost::scoped_ptr<boost::thread> s_compactor;
+      static base::statistics::writers::entry s_writer;
+    };
+  }
+}
+
+#endif
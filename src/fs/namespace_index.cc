@@ -0,0 +1,274 @@
+/*
+ * fs/namespace_index.cc
+ * -------------------------------------------------------------------------
+ * Index of the directory hierarchy, built from listings and our own changes.
+ * -------------------------------------------------------------------------
+ *
+ * Copyright (c) 2012, Tarick Bedeir.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <boost/detail/atomic_count.hpp>
+
+#include "base/config.h"
+#include "base/logger.h"
+#include "fs/namespace_index.h"
+
+using boost::mutex;
+using boost::detail::atomic_count;
+using std::ostream;
+using std::string;
+using std::vector;
+
+using s3::base::config;
+using s3::base::path_tree;
+using s3::base::statistics;
+using s3::fs::namespace_index;
+
+bool namespace_index::s_enabled(false);
+size_t namespace_index::s_max_size(0);
+mutex namespace_index::s_mutex;
+path_tree namespace_index::s_tree;
+statistics::writers::entry namespace_index::s_writer(namespace_index::statistics_writer, 0);
+
+namespace
+{
+  atomic_count s_listings(0), s_stale_listings(0), s_resets(0);
+  atomic_count s_missing_hits(0), s_empty_hits(0), s_listing_hits(0);
+
+  inline string get_parent(const string &path)
+  {
+    size_t last_slash = path.rfind('/');
+
+    return (last_slash == string::npos) ? string() : path.substr(0, last_slash);
+  }
+
+  inline time_t get_expiry()
+  {
+    return time(NULL) + config::get_cache_expiry_in_s();
+  }
+}
+
+void namespace_index::init()
+{
+  s_enabled = config::get_index_directories();
+  s_max_size = config::get_max_index_entries();
+}
+
+void namespace_index::statistics_writer(ostream *o)
+{
+  size_t size;
+
+  if (!s_enabled)
+    return;
+
+  {
+    mutex::scoped_lock lock(s_mutex);
+
+    size = s_tree.get_size();
+  }
+
+  *o <<
+    "namespace index:\n"
+    "  entries: " << size << "\n"
+    "  listings indexed: " << s_listings << "\n"
+    "  listings dropped (directory changed while listing): " << s_stale_listings << "\n"
+    "  resets (grew past max_index_entries): " << s_resets << "\n"
+    "  lookups answered as missing: " << s_missing_hits << "\n"
+    "  emptiness checks answered: " << s_empty_hits << "\n"
+    "  listings served: " << s_listing_hits << "\n";
+}
+
+void namespace_index::trim()
+{
+  // nodes share their ancestors, so there's no cheap way to drop just the
+  // oldest listings.  start over instead -- it's only a cache.
+  if (s_tree.get_size() <= s_max_size)
+    return;
+
+  S3_LOG(LOG_DEBUG, "namespace_index::trim", "clearing index with %zu entries.\n", s_tree.get_size());
+
+  ++s_resets;
+  s_tree.clear();
+}
+
+void namespace_index::set_listing(const string &path, const vector<string> &names)
+{
+  if (!s_enabled)
+    return;
+
+  {
+    mutex::scoped_lock lock(s_mutex);
+
+    s_tree.set_children(path, names, get_expiry());
+    trim();
+  }
+
+  ++s_listings;
+}
+
+bool namespace_index::set_listing(const string &path, const vector<string> &names, uint64_t generation)
+{
+  if (!s_enabled)
+    return false;
+
+  {
+    mutex::scoped_lock lock(s_mutex);
+
+    if (s_tree.children_changed_since(path, generation)) {
+      lock.unlock();
+      ++s_stale_listings;
+
+      return false;
+    }
+
+    s_tree.set_children(path, names, get_expiry());
+    trim();
+  }
+
+  ++s_listings;
+
+  return true;
+}
+
+void namespace_index::add(const string &path)
+{
+  if (!s_enabled)
+    return;
+
+  mutex::scoped_lock lock(s_mutex);
+
+  s_tree.mark_changed(get_parent(path));
+  s_tree.insert(path, get_expiry());
+  trim();
+}
+
+void namespace_index::remove(const string &path)
+{
+  if (!s_enabled)
+    return;
+
+  mutex::scoped_lock lock(s_mutex);
+
+  s_tree.mark_changed(get_parent(path));
+  s_tree.erase(path);
+}
+
+void namespace_index::add_listed(const string &subtree, const string &path, uint64_t generation)
+{
+  if (!s_enabled)
+    return;
+
+  mutex::scoped_lock lock(s_mutex);
+
+  if (s_tree.subtree_changed_since(subtree, generation))
+    return;
+
+  s_tree.insert(path, get_expiry());
+  trim();
+}
+
+void namespace_index::remove_children(const string &path)
+{
+  if (!s_enabled)
+    return;
+
+  mutex::scoped_lock lock(s_mutex);
+
+  s_tree.mark_changed(path);
+  s_tree.erase_children(path);
+}
+
+uint64_t namespace_index::get_generation(const string &path)
+{
+  uint64_t generation;
+
+  if (!s_enabled)
+    return 0;
+
+  mutex::scoped_lock lock(s_mutex);
+
+  // trim() first, so that the node it may clear is the one we watch
+  trim();
+  generation = s_tree.watch(path);
+
+  return generation;
+}
+
+void namespace_index::set_subtree_listing(const string &path, uint64_t generation)
+{
+  if (!s_enabled)
+    return;
+
+  mutex::scoped_lock lock(s_mutex);
+
+  if (s_tree.subtree_changed_since(path, generation))
+    return;
+
+  s_tree.set_subtree_listed(path, get_expiry());
+}
+
+bool namespace_index::is_known_missing(const string &path)
+{
+  if (!s_enabled)
+    return false;
+
+  mutex::scoped_lock lock(s_mutex);
+
+  if (s_tree.find(path, time(NULL)) != base::PT_ABSENT)
+    return false;
+
+  lock.unlock();
+  ++s_missing_hits;
+
+  return true;
+}
+
+bool namespace_index::is_empty(const string &path, bool *is_empty)
+{
+  base::path_tree_state state;
+
+  if (!s_enabled)
+    return false;
+
+  {
+    mutex::scoped_lock lock(s_mutex);
+
+    state = s_tree.has_children(path, time(NULL));
+  }
+
+  if (state == base::PT_UNKNOWN)
+    return false;
+
+  ++s_empty_hits;
+  *is_empty = (state == base::PT_ABSENT);
+
+  return true;
+}
+
+bool namespace_index::get_listing(const string &path, vector<string> *names)
+{
+  if (!s_enabled)
+    return false;
+
+  mutex::scoped_lock lock(s_mutex);
+
+  if (!s_tree.get_children(path, time(NULL), names))
+    return false;
+
+  lock.unlock();
+  ++s_listing_hits;
+
+  return true;
+}
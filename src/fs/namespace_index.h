@@ -0,0 +1,113 @@
+/*
+ * fs/namespace_index.h
+ * -------------------------------------------------------------------------
+ * Index of the directory hierarchy, built from listings and our own changes.
+ * -------------------------------------------------------------------------
+ *
+ * Copyright (c) 2012, Tarick Bedeir.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef S3_FS_NAMESPACE_INDEX_H
+#define S3_FS_NAMESPACE_INDEX_H
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+#include <boost/thread.hpp>
+
+#include "base/path_tree.h"
+#include "base/statistics.h"
+
+namespace s3
+{
+  namespace fs
+  {
+    // remembers which names each listed directory holds, for as long as
+    // objects stay in the cache (cache_expiry_in_s), so that we can say
+    // without a request that a name isn't in a directory, or that a
+    // directory is empty.  entries we create or remove ourselves are applied
+    // as we go.  the index is only as current as the object cache: changes
+    // made by other clients aren't seen until the listing expires.
+    //
+    // all methods do nothing (or know nothing) unless index_directories is
+    // set.
+    class namespace_index
+    {
+    public:
+      static void init();
+
+      inline static bool is_enabled() { return s_enabled; }
+
+      // "names" is the complete listing of the directory at "path" (one we've
+      // just created, say)
+      static void set_listing(const std::string &path, const std::vector<std::string> &names);
+
+      // as above, but from a listing that started when get_generation(path)
+      // returned "generation".  does nothing, and returns false, if the
+      // directory's entries have changed since, as the listing may have
+      // missed the change.
+      static bool set_listing(const std::string &path, const std::vector<std::string> &names, uint64_t generation);
+
+      // "path" was created, or removed (along with anything under it)
+      static void add(const std::string &path);
+      static void remove(const std::string &path);
+
+      // "path" was in a listing of everything under "subtree" that started
+      // when get_generation(subtree) returned "generation".  does nothing if
+      // anything under "subtree" has changed since.
+      static void add_listed(const std::string &subtree, const std::string &path, uint64_t generation);
+
+      // forget what's under "path" (e.g., because it's being renamed), but
+      // keep "path" itself
+      static void remove_children(const std::string &path);
+
+      // call before listing "path".  the index keeps a generation for each
+      // directory, which changes whenever we add, remove or forget names in
+      // it other than from a listing, so that a listing that was in flight at
+      // the time can't undo the change.  changes elsewhere don't affect it.
+      static uint64_t get_generation(const std::string &path);
+
+      // everything under "path" has been added (with add_listed()) from a
+      // listing that started when get_generation(path) returned
+      // "generation", so the names under "path" are complete -- unless
+      // anything under "path" has changed since, in which case this does
+      // nothing
+      static void set_subtree_listing(const std::string &path, uint64_t generation);
+
+      // true if "path" is known not to exist
+      static bool is_known_missing(const std::string &path);
+
+      // returns false if we don't know, otherwise sets "is_empty"
+      static bool is_empty(const std::string &path, bool *is_empty);
+
+      // returns false if we don't have a current, complete listing
+      static bool get_listing(const std::string &path, std::vector<std::string> *names);
+
+    private:
+      static void trim();
+      static void statistics_writer(std::ostream *o);
+
+      static bool s_enabled;
+      static size_t s_max_size;
+      static boost::mutex s_mutex;
+      static base::path_tree s_tree;
+      static base::statistics::writers::entry s_writer;
+    };
+  }
+}
+
+#endif
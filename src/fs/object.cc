@@ -22,6 +22,8 @@
 #include <string.h>
 #include <sys/xattr.h>
 
+#include <algorithm>
+
 #include <boost/detail/atomic_count.hpp>
 
 #include "base/config.h"
@@ -32,6 +34,7 @@
 #include "base/xml.h"
 #include "fs/cache.h"
 #include "fs/metadata.h"
+#include "fs/metadata_store.h"
 #include "fs/object.h"
 #include "fs/static_xattr.h"
 #include "services/service.h"
@@ -79,6 +82,9 @@ namespace
   const char *INTERNAL_OBJECT_PREFIX_CSTR = INTERNAL_OBJECT_PREFIX.c_str();
   const size_t INTERNAL_OBJECT_PREFIX_SIZE = INTERNAL_OBJECT_PREFIX.size();
 
+  // map node plus shared_ptr control block, roughly
+  const size_t XATTR_OVERHEAD = 64;
+
   #ifdef NEED_XATTR_PREFIX
     const string XATTR_PREFIX = "user.";
     const size_t XATTR_PREFIX_LEN = XATTR_PREFIX.size();
@@ -105,6 +111,47 @@ namespace
 
   atomic_count s_precon_failed_commits(0), s_new_etag_on_commit(0);
   atomic_count s_commit_failures(0), s_precon_rescues(0), s_abandoned_commits(0);
+  atomic_count s_ttl_increases(0), s_ttl_decreases(0);
+
+  // TTLs handed out, in power-of-two buckets: [0, 16), [16, 32), ...
+  // [16 * 2^(TTL_BUCKETS - 2), inf)
+  const int TTL_BUCKETS = 12;
+  const int TTL_FIRST_BUCKET_LIMIT = 16;
+
+  // atomic_count has no default constructor, so it can't be an array element
+  // by itself
+  struct ttl_bucket
+  {
+    atomic_count count;
+
+    inline ttl_bucket() : count(0) { }
+  };
+
+  ttl_bucket s_ttl_histogram[TTL_BUCKETS];
+
+  inline void record_ttl(int ttl)
+  {
+    int bucket = 0;
+
+    for (int limit = TTL_FIRST_BUCKET_LIMIT; bucket < TTL_BUCKETS - 1 && ttl >= limit; limit *= 2)
+      bucket++;
+
+    ++s_ttl_histogram[bucket].count;
+  }
+
+  int adjust_ttl(int ttl, bool changed)
+  {
+    if (!config::get_adaptive_cache_expiry())
+      return config::get_cache_expiry_in_s();
+
+    if (changed) {
+      ++s_ttl_decreases;
+      return std::max(ttl / 2, config::get_min_cache_expiry_in_s());
+    }
+
+    ++s_ttl_increases;
+    return std::min(ttl * 2, config::get_max_cache_expiry_in_s());
+  }
 
   void statistics_writer(ostream *o)
   {
@@ -114,7 +161,19 @@ namespace
       "  new etag on commit: " << s_new_etag_on_commit << "\n"
       "  commit failures: " << s_commit_failures << "\n"
       "  precondition failed rescues: " << s_precon_rescues << "\n"
-      "  abandoned commits: " << s_abandoned_commits << "\n";
+      "  abandoned commits: " << s_abandoned_commits << "\n"
+      "  ttl increases: " << s_ttl_increases << "\n"
+      "  ttl decreases: " << s_ttl_decreases << "\n"
+      "  ttls assigned (seconds):\n";
+
+    for (int i = 0, limit = TTL_FIRST_BUCKET_LIMIT; i < TTL_BUCKETS; i++, limit *= 2) {
+      if (i < TTL_BUCKETS - 1)
+        *o << "    < " << limit << ": ";
+      else
+        *o << "    >= " << limit / 2 << ": ";
+
+      *o << s_ttl_histogram[i].count << "\n";
+    }
   }
 
   inline string build_url_no_internal_check(const string &path)
@@ -203,41 +262,138 @@ int object::remove_by_url(const request::ptr &req, const string &url)
 
 object::object(const string &path)
   : _path(path),
-    _expiry(0)
+    _intact(false),
+    _list_derived(false),
+    _last_modified(0),
+    _expiry(0),
+    _ttl_in_s(config::get_cache_expiry_in_s())
 {
+  // build_url() would throw here too, but we don't keep the url
+  if (is_internal_path(path))
+    throw runtime_error("path cannot start with " PACKAGE_NAME " internal object prefix.");
+
   memset(&_stat, 0, sizeof(_stat));
 
-  _stat.st_nlink = 1; // laziness (see FUSE FAQ re. find)
-  _stat.st_blksize = BLOCK_SIZE;
-  _stat.st_mode = config::get_default_mode() & ~S_IFMT;
-  _stat.st_uid = config::get_default_uid();
-  _stat.st_gid = config::get_default_gid();
-  _stat.st_ctime = time(NULL);
-  _stat.st_mtime = time(NULL);
+  _stat.mode = config::get_default_mode() & ~S_IFMT;
+  _stat.uid = config::get_default_uid();
+  _stat.gid = config::get_default_gid();
+  _stat.ctime = time(NULL);
+  _stat.mtime = time(NULL);
 
-  if (_stat.st_uid == UID_MAX)
-    _stat.st_uid = getuid();
+  if (_stat.uid == UID_MAX)
+    _stat.uid = getuid();
 
-  if (_stat.st_gid == GID_MAX)
-    _stat.st_gid = getgid();
+  if (_stat.gid == GID_MAX)
+    _stat.gid = getgid();
 
-  _content_type = config::get_default_content_type();
+  set_content_type(config::get_default_content_type());
 
   if (!config::get_default_cache_control().empty())
     _metadata.replace(static_xattr::from_string(CACHE_CONTROL_XATTR, config::get_default_cache_control(), META_XATTR_FLAGS));
-
-  _url = build_url(_path);
 }
 
 object::~object()
 {
 }
 
+void object::renew()
+{
+  _ttl_in_s = adjust_ttl(_ttl_in_s, false);
+  _expiry = time(NULL) + _ttl_in_s;
+
+  record_ttl(_ttl_in_s);
+}
+
+void object::inherit_ttl(const ptr &previous)
+{
+  ttl_history history;
+
+  previous->get_ttl_history(&history);
+  inherit_ttl(history);
+}
+
+void object::inherit_ttl(const ttl_history &previous)
+{
+  // the etag alone misses metadata-only changes, which would then be
+  // trusted for ever longer
+  bool changed = (
+    _etag != previous.etag ||
+    _last_modified != previous.last_modified ||
+    _stat.mtime != previous.mtime);
+
+  _ttl_in_s = adjust_ttl(previous.ttl_in_s, changed);
+  _expiry = time(NULL) + _ttl_in_s;
+
+  record_ttl(_ttl_in_s);
+}
+
+void object::get_ttl_history(ttl_history *history) const
+{
+  history->etag = _etag;
+  history->mtime = _stat.mtime;
+  history->last_modified = _last_modified;
+  history->ttl_in_s = _ttl_in_s;
+}
+
+void object::mark_written()
+{
+  _ttl_in_s = adjust_ttl(_ttl_in_s, true);
+  _expiry = time(NULL) + _ttl_in_s;
+
+  record_ttl(_ttl_in_s);
+}
+
 bool object::is_removable()
 {
   return true;
 }
 
+string object::get_url() const
+{
+  // directories are stored with a trailing slash (see directory::build_url())
+  if (get_type() == S_IFDIR)
+    return build_url_no_internal_check(get_path()) + "/";
+
+  return build_url_no_internal_check(get_path());
+}
+
+void object::copy_stat(struct stat *s)
+{
+  update_stat();
+
+  memset(s, 0, sizeof(*s));
+
+  s->st_nlink = 1; // laziness (see FUSE FAQ re. find)
+  s->st_blksize = BLOCK_SIZE;
+  s->st_size = _stat.size;
+  s->st_blocks = (_stat.size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+  s->st_ctime = _stat.ctime;
+  s->st_mtime = _stat.mtime;
+  s->st_mode = _stat.mode;
+  s->st_uid = _stat.uid;
+  s->st_gid = _stat.gid;
+}
+
+size_t object::get_resident_size()
+{
+  mutex::scoped_lock lock(_mutex);
+  size_t size = sizeof(*this);
+
+  // the path and content type are interned, and are shared with the cache
+  // and with other objects, so only the etag is ours alone
+  size += _etag.size();
+
+  for (xattr_map::const_iterator itor = _metadata.begin(); itor != _metadata.end(); ++itor)
+    size += XATTR_OVERHEAD + itor->first.size() + itor->second->get_resident_size();
+
+  #ifdef WITH_AWS
+    if (_glacier)
+      size += sizeof(glacier);
+  #endif
+
+  return size;
+}
+
 void object::update_stat()
 {
 }
@@ -333,10 +489,10 @@ void object::set_mode(mode_t mode)
   if (mode == 0)
     mode = config::get_default_mode() & ~S_IFMT;
 
-  _stat.st_mode = (_stat.st_mode & S_IFMT) | mode;
+  _stat.mode = (_stat.mode & S_IFMT) | mode;
 
   // successful chmod updates ctime
-  _stat.st_ctime = time(NULL);
+  _stat.ctime = time(NULL);
 }
 
 void object::init(const request::ptr &req)
@@ -350,14 +506,15 @@ void object::init(const request::ptr &req)
   uid_t uid;
   gid_t gid;
 
-  _content_type = req->get_response_header("Content-Type");
+  set_content_type(req->get_response_header("Content-Type"));
   _etag = req->get_response_header("ETag");
+  _last_modified = req->get_last_modified();
 
   _intact = (_etag == req->get_response_header(meta_prefix + metadata::LAST_UPDATE_ETAG));
 
-  _stat.st_size = strtol(req->get_response_header("Content-Length").c_str(), NULL, 0);
-  _stat.st_ctime = strtol(req->get_response_header(meta_prefix + metadata::CREATED_TIME).c_str(), NULL, 0);
-  _stat.st_mtime = strtol(req->get_response_header(meta_prefix + metadata::LAST_MODIFIED_TIME).c_str(), NULL, 0);
+  _stat.size = strtol(req->get_response_header("Content-Length").c_str(), NULL, 0);
+  _stat.ctime = strtol(req->get_response_header(meta_prefix + metadata::CREATED_TIME).c_str(), NULL, 0);
+  _stat.mtime = strtol(req->get_response_header(meta_prefix + metadata::LAST_MODIFIED_TIME).c_str(), NULL, 0);
 
   mode = strtol(req->get_response_header(meta_prefix + metadata::MODE).c_str(), NULL, 0) & ~S_IFMT;
   uid = strtol(req->get_response_header(meta_prefix + metadata::UID).c_str(), NULL, 0);
@@ -378,7 +535,7 @@ void object::init(const request::ptr &req)
     }
   }
 
-  _metadata.replace(static_xattr::from_string(CONTENT_TYPE_XATTR, _content_type, xattr::XM_VISIBLE));
+  _metadata.replace(static_xattr::from_string(CONTENT_TYPE_XATTR, get_content_type(), xattr::XM_VISIBLE));
   _metadata.replace(static_xattr::from_string(ETAG_XATTR, _etag, xattr::XM_VISIBLE));
 
   if (cache_control.empty())
@@ -387,26 +544,26 @@ void object::init(const request::ptr &req)
     _metadata.replace(static_xattr::from_string(CACHE_CONTROL_XATTR, cache_control, META_XATTR_FLAGS));
 
   // this workaround is for cases when the file was updated by someone else and the mtime header wasn't set
-  if (!is_intact() && req->get_last_modified() > _stat.st_mtime)
-    _stat.st_mtime = req->get_last_modified();
+  if (!is_intact() && _last_modified > _stat.mtime)
+    _stat.mtime = _last_modified;
 
   // only accept uid, gid, mode from response if object is intact or if values 
   // are non-zero (we do this so that objects created by some other mechanism 
   // don't appear here with uid = 0, gid = 0, mode = 0)
 
   if (is_intact() || mode)
-    _stat.st_mode = (_stat.st_mode & S_IFMT) | mode;
+    _stat.mode = (_stat.mode & S_IFMT) | mode;
 
   if (is_intact() || uid)
-    _stat.st_uid = uid;
+    _stat.uid = uid;
 
   if (is_intact() || gid)
-    _stat.st_gid = gid;
-
-  _stat.st_blocks = (_stat.st_size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    _stat.gid = gid;
 
   // setting _expiry > 0 makes this object valid
-  _expiry = time(NULL) + config::get_cache_expiry_in_s();
+  _expiry = time(NULL) + _ttl_in_s;
+
+  record_ttl(_ttl_in_s);
 
   #ifdef WITH_AWS
     if (config::get_allow_glacier_restores()) {
@@ -438,24 +595,24 @@ void object::set_request_headers(const request::ptr &req)
     req->set_header(meta_prefix + key, value);
   }
 
-  snprintf(buf, 16, "%#o", _stat.st_mode & ~S_IFMT);
+  snprintf(buf, 16, "%#o", _stat.mode & ~S_IFMT);
   req->set_header(meta_prefix + metadata::MODE, buf);
 
-  snprintf(buf, 16, "%i", _stat.st_uid);
+  snprintf(buf, 16, "%i", _stat.uid);
   req->set_header(meta_prefix + metadata::UID, buf);
 
-  snprintf(buf, 16, "%i", _stat.st_gid);
+  snprintf(buf, 16, "%i", _stat.gid);
   req->set_header(meta_prefix + metadata::GID, buf);
 
-  snprintf(buf, 16, "%li", _stat.st_ctime);
+  snprintf(buf, 16, "%li", _stat.ctime);
   req->set_header(meta_prefix + metadata::CREATED_TIME, buf);
 
-  snprintf(buf, 16, "%li", _stat.st_mtime);
+  snprintf(buf, 16, "%li", _stat.mtime);
   req->set_header(meta_prefix + metadata::LAST_MODIFIED_TIME, buf);
 
   req->set_header(meta_prefix + metadata::LAST_UPDATE_ETAG, _etag);
 
-  req->set_header("Content-Type", _content_type);
+  req->set_header("Content-Type", get_content_type());
 
   itor = _metadata.find(CACHE_CONTROL_XATTR);
 
@@ -470,12 +627,17 @@ void object::set_request_body(const request::ptr &req)
 int object::commit(const request::ptr &req)
 {
   int current_error = 0, last_error = 0;
+  const string url = get_url();
 
   // we may need to try to commit several times because:
   //
   // 1. the etag can change as a result of a copy
   // 2. we may get intermittent "precondition failed" errors
 
+  // a metadata-only commit keeps the object's etag, so saved headers would
+  // pass revalidation despite being out of date
+  metadata_store::erase(get_path());
+
   for (int i = 0; i < config::get_max_inconsistent_state_retries(); i++) {
     xml::document_ptr doc;
     string response, new_etag;
@@ -485,7 +647,7 @@ int object::commit(const request::ptr &req)
     last_error = current_error;
 
     req->init(base::HTTP_PUT);
-    req->set_url(_url);
+    req->set_url(url);
 
     set_request_headers(req);
 
@@ -495,7 +657,7 @@ int object::commit(const request::ptr &req)
     if (_etag.empty()) {
       set_request_body(req);
     } else {
-      req->set_header(service::get_header_prefix() + "copy-source", _url);
+      req->set_header(service::get_header_prefix() + "copy-source", url);
       req->set_header(service::get_header_prefix() + "copy-source-if-match", _etag);
       req->set_header(service::get_header_prefix() + "metadata-directive", "REPLACE");
     }
@@ -505,7 +667,7 @@ int object::commit(const request::ptr &req)
 
     if (req->get_response_code() == base::HTTP_SC_PRECONDITION_FAILED) {
       ++s_precon_failed_commits;
-      S3_LOG(LOG_WARNING, "object::commit", "got precondition failed error for [%s].\n", _url.c_str());
+      S3_LOG(LOG_WARNING, "object::commit", "got precondition failed error for [%s].\n", url.c_str());
 
       timer::sleep(i + 1);
 
@@ -514,22 +676,25 @@ int object::commit(const request::ptr &req)
     }
 
     if (req->get_response_code() != base::HTTP_SC_OK) {
-      S3_LOG(LOG_WARNING, "object::commit", "failed to commit object metadata for [%s].\n", _url.c_str());
+      S3_LOG(LOG_WARNING, "object::commit", "failed to commit object metadata for [%s].\n", url.c_str());
 
       current_error = -EIO;
       break;
     }
 
-    response = req->get_output_string();
+    // if we started out without an etag, then this was a plain PUT, and the
+    // new object's etag is in the response headers
+    if (_etag.empty()) {
+      _etag = req->get_response_header("ETag");
 
-    // an empty response means the etag hasn't changed
-    if (response.empty()) {
       current_error = 0;
       break;
     }
 
-    // if we started out without an etag, then ignore anything we get here
-    if (_etag.empty()) {
+    response = req->get_output_string();
+
+    // an empty response means the etag hasn't changed
+    if (response.empty()) {
       current_error = 0;
       break;
     }
@@ -573,7 +738,7 @@ int object::commit(const request::ptr &req)
       ++s_commit_failures;
     } else {
       ++s_abandoned_commits;
-      S3_LOG(LOG_WARNING, "object::commit", "giving up on [%s].\n", _url.c_str());
+      S3_LOG(LOG_WARNING, "object::commit", "giving up on [%s].\n", url.c_str());
     }
   } else if (last_error == -EBUSY) {
     ++s_precon_rescues;
@@ -588,8 +753,9 @@ int object::remove(const request::ptr &req)
     return -EBUSY;
 
   cache::remove(get_path());
+  metadata_store::erase(get_path());
 
-  return object::remove_by_url(req, _url);
+  return object::remove_by_url(req, get_url());
 }
 
 int object::rename(const request::ptr &req, const string &to)
@@ -599,7 +765,7 @@ int object::rename(const request::ptr &req, const string &to)
   if (!is_removable())
     return -EBUSY;
  
-  r = object::copy_by_path(req, _path, to);
+  r = object::copy_by_path(req, get_path(), to);
 
   if (r)
     return r;
@@ -31,7 +31,9 @@
 #include <boost/smart_ptr.hpp>
 #include <boost/thread.hpp>
 
+#include "base/interned_string.h"
 #include "base/static_list.h"
+#include "base/timer.h"
 #include "fs/xattr.h"
 #include "threads/pool.h"
 
@@ -71,39 +73,93 @@ namespace s3
       virtual ~object();
 
       inline bool is_intact() const { return _intact; }
-      inline bool is_expired() const { return (_expiry == 0 || time(NULL) >= _expiry); }
+
+      // true if this object was built from a bucket listing rather than from
+      // its own headers, so that it has none of our metadata (mode, owner,
+      // type, hashes, encryption).  such objects are only good for stat().
+      inline bool is_list_derived() const { return _list_derived; }
+      inline void set_list_derived() { _list_derived = true; }
+      inline bool is_expired() const { return (_expiry == 0 || base::timer::get_coarse_time() >= _expiry); }
+
+      // true if the object expired less than "grace" seconds ago (and wasn't
+      // expired explicitly)
+      inline bool is_within_grace(int grace) const { return (_expiry != 0 && base::timer::get_coarse_time() < _expiry + grace); }
+
+      // zero if the object was expired explicitly
+      inline time_t get_expiry() const { return _expiry; }
+
+      // called when the server confirms that neither the object nor its
+      // metadata has changed (see is_same_version())
+      void renew();
+
+      // what inherit_ttl() needs from an object, so that it can be kept
+      // after the object itself is evicted
+      struct ttl_history
+      {
+        std::string etag;
+        time_t mtime, last_modified;
+        int ttl_in_s;
+      };
+
+      // called on a freshly-fetched object that replaces "previous", to carry
+      // over (and adjust) the previous object's time-to-live
+      void inherit_ttl(const ptr &previous);
+      void inherit_ttl(const ttl_history &previous);
+
+      void get_ttl_history(ttl_history *history) const;
+
+      // called once we've written the object ourselves, so that what we hold
+      // is what's on the server, and can be cached as if just fetched
+      void mark_written();
 
       virtual bool is_removable();
 
-      inline const std::string & get_path() const { return _path; }
-      inline const std::string & get_content_type() const { return _content_type; }
-      inline const std::string & get_url() const { return _url; }
+      // estimate of the memory held by this object while it's in the cache
+      virtual size_t get_resident_size();
+
+      inline const std::string & get_path() const { return _path.str(); }
+      inline const base::interned_string & get_interned_path() const { return _path; }
+      inline const std::string & get_content_type() const { return _content_type.str(); }
       inline const std::string & get_etag() const { return _etag; }
-      inline mode_t get_mode() const { return _stat.st_mode; }
-      inline mode_t get_type() const { return _stat.st_mode & S_IFMT; }
-      inline uid_t get_uid() const { return _stat.st_uid; }
+      inline mode_t get_mode() const { return _stat.mode; }
+      inline mode_t get_type() const { return _stat.mode & S_IFMT; }
+      inline uid_t get_uid() const { return _stat.uid; }
+      inline time_t get_mtime() const { return _stat.mtime; }
+
+      // the server's Last-Modified as of when we fetched the object.  unlike
+      // the etag, this changes when only the metadata is rewritten.
+      inline time_t get_last_modified() const { return _last_modified; }
+
+      // true if "other", freshly fetched, is the same version of the object
+      // as this one, metadata included
+      inline bool is_same_version(const ptr &other) const
+      {
+        return
+          _etag == other->_etag &&
+          _last_modified == other->_last_modified &&
+          _stat.mtime == other->_stat.mtime;
+      }
+
+      // built on demand rather than kept with every cached object
+      std::string get_url() const;
 
       void get_metadata_keys(std::vector<std::string> *keys);
       int get_metadata(const std::string &key, char *buffer, size_t max_size);
       int set_metadata(const std::string &key, const char *value, size_t size, int flags, bool *needs_commit);
       int remove_metadata(const std::string &key);
 
-      inline void set_uid(uid_t uid) { _stat.st_uid = uid; }
-      inline void set_gid(gid_t gid) { _stat.st_gid = gid; }
+      inline void set_uid(uid_t uid) { _stat.uid = uid; }
+      inline void set_gid(gid_t gid) { _stat.gid = gid; }
 
-      inline void set_mtime(time_t mtime) { _stat.st_mtime = mtime; }
+      inline void set_mtime(time_t mtime) { _stat.mtime = mtime; }
       inline void set_mtime() { set_mtime(time(NULL)); }
 
-      inline void set_ctime(time_t ctime) { _stat.st_ctime = ctime; }
+      inline void set_ctime(time_t ctime) { _stat.ctime = ctime; }
       inline void set_ctime() { set_ctime(time(NULL)); }
 
       void set_mode(mode_t mode);
 
-      inline void copy_stat(struct stat *s)
-      {
-        update_stat();
-        memcpy(s, &_stat, sizeof(_stat));
-      }
+      virtual void copy_stat(struct stat *s);
 
       int commit(const boost::shared_ptr<base::request> &req);
 
@@ -141,30 +197,41 @@ namespace s3
 
       virtual void update_stat();
 
-      inline void set_url(const std::string &url) { _url = url; }
-      inline void set_content_type(const std::string &content_type) { _content_type = content_type; }
+      inline void set_content_type(const std::string &content_type) { _content_type = base::interned_string(content_type); }
       inline void set_etag(const std::string &etag) { _etag = etag; }
 
       inline void set_type(mode_t mode)
       { 
-        _stat.st_mode &= ~S_IFMT; // clear existing mode
-        _stat.st_mode |= mode & S_IFMT; 
+        _stat.mode &= ~S_IFMT; // clear existing mode
+        _stat.mode |= mode & S_IFMT; 
       }
 
       inline xattr_map * get_metadata() { return &_metadata; }
-      inline struct stat * get_stat() { return &_stat; }
+
+      inline off_t get_size() const { return _stat.size; }
+      inline void set_size(off_t size) { _stat.size = size; }
 
       inline void expire() { _expiry = 0; }
-      inline void force_zero_size() { _stat.st_size = 0; }
+      inline void force_zero_size() { _stat.size = 0; }
 
     private:
+      // the parts of struct stat that vary between objects; copy_stat() fills
+      // in the rest
+      struct stat_fields
+      {
+        off_t size;
+        time_t ctime, mtime;
+        mode_t mode;
+        uid_t uid;
+        gid_t gid;
+      };
+
       boost::mutex _mutex;
 
       // should only be modified during init()
-      std::string _path;
-      std::string _content_type;
-      std::string _url;
-      bool _intact;
+      base::interned_string _path;
+      base::interned_string _content_type;
+      bool _intact, _list_derived;
 
       #ifdef WITH_AWS
         boost::shared_ptr<glacier> _glacier;
@@ -172,8 +239,9 @@ namespace s3
 
       // unprotected
       std::string _etag;
-      struct stat _stat;
-      time_t _expiry;
+      stat_fields _stat;
+      time_t _last_modified, _expiry;
+      int _ttl_in_s;
 
       // protected by _mutex
       xattr_map _metadata;
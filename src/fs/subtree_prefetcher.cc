@@ -0,0 +1,264 @@
+/*
+ * fs/subtree_prefetcher.cc
+ * -------------------------------------------------------------------------
+ * Caches metadata for everything under a directory with one flat listing.
+ * -------------------------------------------------------------------------
+ *
+ * Copyright (c) 2012, Tarick Bedeir.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <boost/detail/atomic_count.hpp>
+
+#include "base/config.h"
+#include "base/logger.h"
+#include "base/request.h"
+#include "fs/cache.h"
+#include "fs/list_reader.h"
+#include "fs/namespace_index.h"
+#include "fs/object.h"
+#include "fs/subtree_prefetcher.h"
+#include "threads/pool.h"
+
+using boost::mutex;
+using boost::scoped_ptr;
+using boost::detail::atomic_count;
+using std::ostream;
+using std::set;
+using std::string;
+
+using s3::base::config;
+using s3::base::request;
+using s3::base::statistics;
+using s3::fs::cache;
+using s3::fs::list_reader;
+using s3::fs::namespace_index;
+using s3::fs::object;
+using s3::fs::subtree_prefetcher;
+using s3::threads::pool;
+
+int subtree_prefetcher::s_after_dirs(0);
+mutex subtree_prefetcher::s_mutex;
+scoped_ptr<subtree_prefetcher::walk_map> subtree_prefetcher::s_walks;
+scoped_ptr<subtree_prefetcher::expiry_map> subtree_prefetcher::s_recent;
+set<string> subtree_prefetcher::s_running;
+statistics::writers::entry subtree_prefetcher::s_writer(subtree_prefetcher::statistics_writer, 0);
+
+namespace
+{
+  // the most keys a single list request can return (for S3, at least)
+  const int PAGE_SIZE = 1000;
+
+  // a walk that hasn't listed a directory in this long is over
+  const int WALK_IDLE_IN_S = 60;
+
+  const size_t MAX_WALK_ENTRIES = 4096;
+  const size_t MAX_RECENT_ENTRIES = 256;
+
+  atomic_count s_started(0), s_detected(0), s_failed(0);
+  atomic_count s_pages(0), s_objects(0);
+
+  inline string get_parent(const string &path)
+  {
+    size_t last_slash = path.rfind('/');
+
+    return (last_slash == string::npos) ? "" : path.substr(0, last_slash);
+  }
+}
+
+void subtree_prefetcher::init()
+{
+  s_after_dirs = config::get_prefetch_subtree_after_dirs();
+
+  s_walks.reset(new walk_map(MAX_WALK_ENTRIES));
+  s_recent.reset(new expiry_map(MAX_RECENT_ENTRIES));
+}
+
+void subtree_prefetcher::statistics_writer(ostream *o)
+{
+  *o <<
+    "subtree prefetches:\n"
+    "  started: " << s_started << "\n"
+    "  started on detecting a walk: " << s_detected << "\n"
+    "  failed: " << s_failed << "\n"
+    "  list requests: " << s_pages << "\n"
+    "  objects cached: " << s_objects << "\n";
+}
+
+bool subtree_prefetcher::is_covered(const string &path, const mutex::scoped_lock &)
+{
+  time_t now = time(NULL);
+  string p = path;
+
+  while (true) {
+    time_t expiry;
+
+    if (s_running.find(p) != s_running.end())
+      return true;
+
+    if (s_recent->find(p, &expiry)) {
+      if (expiry > now)
+        return true;
+
+      s_recent->erase(p);
+    }
+
+    if (p.empty())
+      return false;
+
+    p = get_parent(p);
+  }
+}
+
+void subtree_prefetcher::prefetch(const string &path)
+{
+  {
+    mutex::scoped_lock lock(s_mutex);
+
+    if (is_covered(path, lock))
+      return;
+
+    s_running.insert(path);
+  }
+
+  S3_LOG(LOG_DEBUG, "subtree_prefetcher::prefetch", "prefetching [%s].\n", path.c_str());
+  ++s_started;
+
+  pool::call_async(
+    threads::PR_REQ_1,
+    bind(&subtree_prefetcher::run, _1, path));
+}
+
+void subtree_prefetcher::on_listed(const string &path)
+{
+  mutex::scoped_lock lock(s_mutex);
+  time_t now = time(NULL);
+  walk_entry *parent = NULL, *root = NULL;
+  string root_path = path;
+
+  if (s_after_dirs == 0 || is_covered(path, lock))
+    return;
+
+  if (!path.empty())
+    parent = s_walks->find(get_parent(path));
+
+  if (parent) {
+    root = s_walks->find(parent->root);
+
+    if (root && now - root->last_listed <= WALK_IDLE_IN_S)
+      root_path = parent->root;
+    else
+      root = NULL;
+  }
+
+  if (!root) {
+    // this listing starts a new walk
+    walk_entry &e = (*s_walks)[path];
+
+    e.root = path;
+    e.count = 0;
+    e.last_listed = now;
+
+    return;
+  }
+
+  (*s_walks)[path].root = root_path;
+
+  // operator [] may have moved entries around
+  root = s_walks->find(root_path);
+
+  if (!root)
+    return;
+
+  root->last_listed = now;
+
+  if (++root->count < s_after_dirs)
+    return;
+
+  s_walks->erase(root_path);
+  lock.unlock();
+
+  ++s_detected;
+  prefetch(root_path);
+}
+
+int subtree_prefetcher::run(const request::ptr &req, const string &path)
+{
+  string prefix = path.empty() ? string() : path + "/";
+  list_reader reader(prefix, false, PAGE_SIZE);
+  list_reader::entry_list keys;
+  bool index = namespace_index::is_enabled();
+  uint64_t generation = 0;
+  int r;
+
+  // start from nothing, so that names removed since the last listing don't
+  // survive the prefetch
+  if (index) {
+    namespace_index::remove_children(path);
+    generation = namespace_index::get_generation(path);
+  }
+
+  try {
+    while ((r = reader.read(req, &keys, NULL)) > 0) {
+      ++s_pages;
+
+      for (list_reader::entry_list::const_iterator itor = keys.begin(); itor != keys.end(); ++itor) {
+        const string &key = itor->key;
+        string p;
+
+        // the directory itself
+        if (key.size() <= prefix.size())
+          continue;
+
+        if (path.empty() && object::is_internal_path(key))
+          continue;
+
+        p = (key[key.size() - 1] == '/') ? key.substr(0, key.size() - 1) : key;
+
+        cache::insert_listed(req, p, *itor);
+
+        if (index)
+          namespace_index::add_listed(path, p, generation);
+
+        ++s_objects;
+      }
+    }
+
+  } catch (...) {
+    mutex::scoped_lock lock(s_mutex);
+
+    ++s_failed;
+    s_running.erase(path);
+    throw;
+  }
+
+  if (!r && index)
+    namespace_index::set_subtree_listing(path, generation);
+
+  {
+    mutex::scoped_lock lock(s_mutex);
+
+    s_running.erase(path);
+
+    if (!r)
+      (*s_recent)[path] = time(NULL) + config::get_cache_expiry_in_s();
+  }
+
+  if (r) {
+    S3_LOG(LOG_WARNING, "subtree_prefetcher::run", "listing [%s] failed with error %i.\n", path.c_str(), r);
+    ++s_failed;
+  }
+
+  return r;
+}
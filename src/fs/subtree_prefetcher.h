@@ -0,0 +1,102 @@
+/*
+ * fs/subtree_prefetcher.h
+ * -------------------------------------------------------------------------
+ * Caches metadata for everything under a directory with one flat listing.
+ * -------------------------------------------------------------------------
+ *
+ * Copyright (c) 2012, Tarick Bedeir.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef S3_FS_SUBTREE_PREFETCHER_H
+#define S3_FS_SUBTREE_PREFETCHER_H
+
+#include <set>
+#include <string>
+
+#include <boost/smart_ptr.hpp>
+#include <boost/thread.hpp>
+
+#include "base/hash_lru_cache_map.h"
+#include "base/statistics.h"
+
+namespace s3
+{
+  namespace base
+  {
+    class request;
+  }
+
+  namespace fs
+  {
+    // walking a tree (find, du, rsync) costs a delimited listing per
+    // directory and, without list_derived_metadata, a HEAD per entry.  a
+    // prefetch instead lists everything under a directory without a
+    // delimiter, 1000 keys to a page, and caches a list-derived object (see
+    // object::is_list_derived()) for each key.  with index_directories set,
+    // it also fills in the namespace index, so that the walk's listings and
+    // lookups of missing names don't go to the server either.
+    //
+    // a prefetch starts when prefetch_subtree_after_dirs directories below
+    // the same directory are listed in turn, or when the prefetch xattr is
+    // set on a directory.
+    class subtree_prefetcher
+    {
+    public:
+      static void init();
+
+      // starts a prefetch of everything under "path" in the background,
+      // unless one covering "path" is running or finished recently
+      static void prefetch(const std::string &path);
+
+      // called after the directory at "path" was listed from the server
+      static void on_listed(const std::string &path);
+
+    private:
+      struct walk_entry
+      {
+        // the directory at which the walk that listed this one started
+        std::string root;
+
+        // only meaningful for the root: how many directories the walk has
+        // listed, and when it last listed one
+        int count;
+        time_t last_listed;
+
+        inline walk_entry()
+          : count(0),
+            last_listed(0)
+        {
+        }
+      };
+
+      typedef base::hash_lru_cache_map<std::string, walk_entry> walk_map;
+      typedef base::hash_lru_cache_map<std::string, time_t> expiry_map;
+
+      static int run(const boost::shared_ptr<base::request> &req, const std::string &path);
+      static bool is_covered(const std::string &path, const boost::mutex::scoped_lock &);
+
+      static void statistics_writer(std::ostream *o);
+
+      static int s_after_dirs;
+      static boost::mutex s_mutex;
+      static boost::scoped_ptr<walk_map> s_walks;
+      static boost::scoped_ptr<expiry_map> s_recent;
+      static std::set<std::string> s_running;
+      static base::statistics::writers::entry s_writer;
+    };
+  }
+}
+
+#endif
@@ -0,0 +1,231 @@
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include <string>
+#include <vector>
+#include <gtest/gtest.h>
+
+#include "fs/block_cache.h"
+
+using std::string;
+using std::vector;
+
+using s3::fs::block_cache;
+
+namespace
+{
+  const string URL = "/bucket/file";
+  const string ETAG = "\"etag\"";
+  const size_t BLOCK_SIZE = 1024;
+
+  // each block is stored with its sha256
+  const size_t STORED_SIZE = BLOCK_SIZE + 32;
+
+  class temp_dir
+  {
+  public:
+    inline temp_dir()
+    {
+      char name[] = "/tmp/s3fuse-block-cache-test-XXXXXX";
+
+      if (mkdtemp(name))
+        _name = name;
+    }
+
+    inline ~temp_dir()
+    {
+      vector<string> files = list();
+
+      block_cache::close_cache();
+
+      for (size_t i = 0; i < files.size(); i++)
+        unlink((_name + "/" + files[i]).c_str());
+
+      rmdir(_name.c_str());
+    }
+
+    inline const string & get() const { return _name; }
+
+    inline vector<string> list() const
+    {
+      vector<string> files;
+      DIR *dir = opendir(_name.c_str());
+      struct dirent *de;
+
+      if (!dir)
+        return files;
+
+      while ((de = readdir(dir)))
+        if (de->d_name[0] != '.')
+          files.push_back(de->d_name);
+
+      closedir(dir);
+
+      return files;
+    }
+
+  private:
+    string _name;
+  };
+
+  vector<char> make_block(char fill)
+  {
+    vector<char> block(BLOCK_SIZE);
+
+    for (size_t i = 0; i < block.size(); i++)
+      block[i] = fill + static_cast<char>(i % 7);
+
+    return block;
+  }
+
+  void put(size_t index, const vector<char> &block)
+  {
+    block_cache::put(URL, ETAG, BLOCK_SIZE, index, &block[0], block.size());
+  }
+
+  bool get(size_t index, vector<char> *block)
+  {
+    return block_cache::get(URL, ETAG, BLOCK_SIZE, index, BLOCK_SIZE, block);
+  }
+}
+
+TEST(block_cache, round_trip)
+{
+  temp_dir d;
+  vector<char> in = make_block('a'), out;
+
+  ASSERT_TRUE(block_cache::open_cache(d.get(), 16 * STORED_SIZE));
+  ASSERT_TRUE(block_cache::is_enabled());
+
+  EXPECT_FALSE(get(0, &out));
+
+  put(0, in);
+
+  ASSERT_TRUE(get(0, &out));
+  EXPECT_TRUE(in == out);
+
+  // keyed on the etag and the block size too
+  EXPECT_FALSE(block_cache::get(URL, "\"other\"", BLOCK_SIZE, 0, BLOCK_SIZE, &out));
+  EXPECT_FALSE(block_cache::get(URL, ETAG, 2 * BLOCK_SIZE, 0, BLOCK_SIZE, &out));
+  EXPECT_FALSE(get(1, &out));
+
+  block_cache::erase(URL, ETAG, BLOCK_SIZE, 1);
+  EXPECT_FALSE(get(0, &out));
+  EXPECT_TRUE(d.list().empty());
+}
+
+TEST(block_cache, rejects_wrong_size)
+{
+  temp_dir d;
+  vector<char> in = make_block('a'), out;
+
+  ASSERT_TRUE(block_cache::open_cache(d.get(), 16 * STORED_SIZE));
+
+  put(0, in);
+
+  // the last block of a file is short, so a block of another size isn't the
+  // one we're looking for
+  EXPECT_FALSE(block_cache::get(URL, ETAG, BLOCK_SIZE, 0, BLOCK_SIZE - 1, &out));
+
+  // and is left alone
+  EXPECT_TRUE(get(0, &out));
+}
+
+TEST(block_cache, drops_damaged_block)
+{
+  temp_dir d;
+  vector<char> in = make_block('a'), out;
+  vector<string> files;
+  int fd;
+
+  ASSERT_TRUE(block_cache::open_cache(d.get(), 16 * STORED_SIZE));
+
+  put(0, in);
+
+  files = d.list();
+  ASSERT_EQ(static_cast<size_t>(1), files.size());
+
+  // flip a byte of the data, leaving the stored hash as it was
+  fd = open((d.get() + "/" + files[0]).c_str(), O_WRONLY);
+  ASSERT_NE(-1, fd);
+  ASSERT_EQ(1, pwrite(fd, "!", 1, 10));
+  close(fd);
+
+  EXPECT_FALSE(get(0, &out));
+  EXPECT_TRUE(d.list().empty());
+
+  // and it's gone from the index too, so it can be stored again
+  put(0, in);
+  EXPECT_TRUE(get(0, &out));
+}
+
+TEST(block_cache, evicts_least_recently_used)
+{
+  temp_dir d;
+  vector<char> out;
+
+  ASSERT_TRUE(block_cache::open_cache(d.get(), 3 * STORED_SIZE));
+
+  put(0, make_block('a'));
+  put(1, make_block('b'));
+  put(2, make_block('c'));
+
+  // a hit makes block 0 the most recently used, so block 1 goes first
+  ASSERT_TRUE(get(0, &out));
+
+  put(3, make_block('d'));
+
+  EXPECT_EQ(static_cast<size_t>(3), d.list().size());
+  EXPECT_TRUE(get(0, &out));
+  EXPECT_FALSE(get(1, &out));
+  EXPECT_TRUE(get(2, &out));
+  EXPECT_TRUE(get(3, &out));
+
+  // too big to ever fit
+  block_cache::close_cache();
+  ASSERT_TRUE(block_cache::open_cache(d.get(), STORED_SIZE - 1));
+
+  EXPECT_TRUE(d.list().empty());
+
+  put(4, make_block('e'));
+  EXPECT_FALSE(get(4, &out));
+}
+
+TEST(block_cache, reopen_keeps_blocks_and_removes_temp_files)
+{
+  temp_dir d;
+  vector<char> out;
+  int fd;
+
+  ASSERT_TRUE(block_cache::open_cache(d.get(), 16 * STORED_SIZE));
+
+  put(0, make_block('a'));
+  put(1, make_block('b'));
+
+  block_cache::close_cache();
+
+  // as left behind by a put() that didn't finish
+  fd = open((d.get() + "/tmp.abcdef").c_str(), O_WRONLY | O_CREAT, S_IRUSR | S_IWUSR);
+  ASSERT_NE(-1, fd);
+  close(fd);
+
+  ASSERT_TRUE(block_cache::open_cache(d.get(), 16 * STORED_SIZE));
+
+  EXPECT_EQ(static_cast<size_t>(2), d.list().size());
+
+  ASSERT_TRUE(get(0, &out));
+  EXPECT_TRUE(make_block('a') == out);
+
+  ASSERT_TRUE(get(1, &out));
+  EXPECT_TRUE(make_block('b') == out);
+
+  // and trims to a smaller limit
+  block_cache::close_cache();
+  ASSERT_TRUE(block_cache::open_cache(d.get(), STORED_SIZE));
+
+  EXPECT_EQ(static_cast<size_t>(1), d.list().size());
+}
@@ -0,0 +1,139 @@
+#include <errno.h>
+
+#include <string>
+#include <gtest/gtest.h>
+
+#include "base/xml.h"
+#include "fs/list_reader.h"
+
+using std::string;
+
+using s3::base::xml;
+using s3::fs::list_reader;
+
+namespace
+{
+  bool s_is_init = false;
+
+  // S3 leaves out NextMarker when the request has no delimiter
+  const char *NO_DELIMITER_PAGE = 
+    "<ListBucketResult>"
+      "<IsTruncated>true</IsTruncated>"
+      "<Contents><Key>a/b c</Key></Contents>"
+      "<Contents><Key>a/d/e</Key></Contents>"
+    "</ListBucketResult>";
+
+  const char *DELIMITER_PAGE = 
+    "<ListBucketResult>"
+      "<IsTruncated>true</IsTruncated>"
+      "<NextMarker>a/z/</NextMarker>"
+      "<Contents><Key>a/b</Key></Contents>"
+      "<CommonPrefixes><Prefix>a/z/</Prefix></CommonPrefixes>"
+    "</ListBucketResult>";
+
+  const char *PREFIXES_ONLY_PAGE = 
+    "<ListBucketResult>"
+      "<IsTruncated>true</IsTruncated>"
+      "<Contents><Key>a/b</Key></Contents>"
+      "<CommonPrefixes><Prefix>a/c/</Prefix></CommonPrefixes>"
+    "</ListBucketResult>";
+
+  const char *EMPTY_PAGE = 
+    "<ListBucketResult>"
+      "<IsTruncated>true</IsTruncated>"
+    "</ListBucketResult>";
+
+  void init()
+  {
+    if (s_is_init)
+      return;
+
+    xml::init();
+    s_is_init = true;
+  }
+
+  list_reader::entry_list make_keys(const xml::document_ptr &doc)
+  {
+    xml::element_map_list contents;
+    list_reader::entry_list keys;
+
+    xml::find(doc, "/ListBucketResult/Contents", &contents);
+
+    for (xml::element_map_list::iterator itor = contents.begin(); itor != contents.end(); ++itor)
+      keys.insert(keys.end(), list_reader::entry())->key = (*itor)["Key"];
+
+    return keys;
+  }
+}
+
+TEST(list_reader, no_delimiter_pages_after_last_key)
+{
+  xml::document_ptr doc;
+  string marker;
+
+  init();
+
+  doc = xml::parse(NO_DELIMITER_PAGE);
+  ASSERT_TRUE(doc);
+
+  ASSERT_EQ(0, list_reader::get_next_marker(doc, true, make_keys(doc), NULL, &marker));
+  EXPECT_EQ(string("a/d/e"), marker);
+}
+
+TEST(list_reader, next_marker_used_when_present)
+{
+  xml::document_ptr doc;
+  string marker;
+
+  init();
+
+  doc = xml::parse(DELIMITER_PAGE);
+  ASSERT_TRUE(doc);
+
+  ASSERT_EQ(0, list_reader::get_next_marker(doc, true, make_keys(doc), NULL, &marker));
+  EXPECT_EQ(string("a/z/"), marker);
+}
+
+TEST(list_reader, next_marker_ignored_when_unsupported)
+{
+  xml::document_ptr doc;
+  string marker;
+
+  init();
+
+  doc = xml::parse(DELIMITER_PAGE);
+  ASSERT_TRUE(doc);
+
+  ASSERT_EQ(0, list_reader::get_next_marker(doc, false, make_keys(doc), NULL, &marker));
+  EXPECT_EQ(string("a/b"), marker);
+}
+
+TEST(list_reader, later_prefix_wins_over_last_key)
+{
+  xml::document_ptr doc;
+  xml::element_list prefixes;
+  string marker;
+
+  init();
+
+  doc = xml::parse(PREFIXES_ONLY_PAGE);
+  ASSERT_TRUE(doc);
+  ASSERT_EQ(0, xml::find(doc, "/ListBucketResult/CommonPrefixes/Prefix", &prefixes));
+
+  ASSERT_EQ(0, list_reader::get_next_marker(doc, true, make_keys(doc), &prefixes, &marker));
+  EXPECT_EQ(string("a/c/"), marker);
+}
+
+TEST(list_reader, empty_truncated_page_fails)
+{
+  xml::document_ptr doc;
+  string marker = "unchanged";
+
+  init();
+
+  doc = xml::parse(EMPTY_PAGE);
+  ASSERT_TRUE(doc);
+
+  EXPECT_EQ(-EIO, list_reader::get_next_marker(doc, true, make_keys(doc), NULL, &marker));
+  EXPECT_EQ(string("unchanged"), marker);
+}
@@ -0,0 +1,235 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include <string>
+#include <vector>
+#include <boost/bind.hpp>
+#include <gtest/gtest.h>
+
+#include "fs/manifest.h"
+
+using std::string;
+using std::vector;
+
+using s3::fs::manifest;
+
+namespace
+{
+  const char *BUCKET = "https://bucket.example.com";
+
+  // where the header keeps records_offset (after the magic and count)
+  const off_t RECORDS_OFFSET_FIELD = 32;
+
+  class temp_file
+  {
+  public:
+    inline temp_file()
+    {
+      char name[] = "/tmp/s3fuse-manifest-test-XXXXXX";
+      int fd = mkstemp(name);
+
+      if (fd != -1)
+        close(fd);
+
+      _name = name;
+    }
+
+    inline ~temp_file()
+    {
+      manifest::unmap();
+      unlink(_name.c_str());
+    }
+
+    inline const string & get() const { return _name; }
+
+  private:
+    string _name;
+  };
+
+  struct stat make_stat(mode_t type, off_t size, time_t mtime)
+  {
+    struct stat s;
+
+    memset(&s, 0, sizeof(s));
+
+    s.st_mode = type | 0640;
+    s.st_size = size;
+    s.st_mtime = mtime;
+    s.st_uid = 123;
+    s.st_gid = 456;
+
+    return s;
+  }
+
+  void add_name(vector<string> *names, const string &name, const struct stat *)
+  {
+    names->push_back(name);
+  }
+
+  string list(const string &path)
+  {
+    vector<string> names;
+    string s;
+
+    if (manifest::read_directory(path, boost::bind(&add_name, &names, _1, _2)))
+      return "(error)";
+
+    for (vector<string>::const_iterator itor = names.begin(); itor != names.end(); ++itor)
+      s += (s.empty() ? "" : ",") + *itor;
+
+    return s;
+  }
+
+  // listing order: "a.txt" sorts ahead of "a/" in a listing, since '.' is
+  // less than '/'
+  size_t write_sample(const string &file)
+  {
+    manifest::builder b(file, BUCKET);
+
+    b.add("a.txt", make_stat(S_IFREG, 10, 1000), "\"etag-1\"");
+    b.add("a/b", make_stat(S_IFREG, 20, 2000), "\"etag-2\"");
+    b.add("a/c", make_stat(S_IFDIR, 0, 3000), "\"etag-3\"");
+    b.add("a/c/d/e", make_stat(S_IFREG, 30, 4000), "\"etag-4\"");
+    b.add("z", make_stat(S_IFREG, 40, 5000), "\"etag-5\"");
+
+    return b.commit();
+  }
+}
+
+TEST(manifest, round_trip)
+{
+  temp_file f;
+  struct stat s;
+
+  // five keys, plus directories "a" and "a/c/d", which have no objects
+  ASSERT_EQ(static_cast<size_t>(7), write_sample(f.get()));
+  ASSERT_TRUE(manifest::map(f.get(), BUCKET));
+  ASSERT_TRUE(manifest::is_enabled());
+
+  ASSERT_TRUE(manifest::get_stat("a/b", &s));
+  EXPECT_TRUE(S_ISREG(s.st_mode));
+  EXPECT_EQ(20, s.st_size);
+  EXPECT_EQ(2000, s.st_mtime);
+  EXPECT_EQ(static_cast<uid_t>(123), s.st_uid);
+  EXPECT_EQ(static_cast<gid_t>(456), s.st_gid);
+
+  ASSERT_TRUE(manifest::get_stat("a/c", &s));
+  EXPECT_TRUE(S_ISDIR(s.st_mode));
+  EXPECT_EQ(3000, s.st_mtime) << "listed directory keeps its own attributes";
+
+  ASSERT_TRUE(manifest::get_stat("a/c/d", &s));
+  EXPECT_TRUE(S_ISDIR(s.st_mode)) << "implied by a/c/d/e";
+
+  EXPECT_TRUE(manifest::contains(""));
+  EXPECT_TRUE(manifest::contains("a"));
+  EXPECT_FALSE(manifest::contains("a/x"));
+  EXPECT_FALSE(manifest::contains("a/c/d/e/f"));
+  EXPECT_FALSE(manifest::contains("b"));
+}
+
+TEST(manifest, read_directory_order)
+{
+  temp_file f;
+  vector<string> names;
+
+  write_sample(f.get());
+  ASSERT_TRUE(manifest::map(f.get(), BUCKET));
+
+  // siblings are grouped by parent, so "a.txt" and "a" are listed together
+  // even though "a/b" comes between them in key order
+  EXPECT_EQ(".,..,a,a.txt,z", list(""));
+  EXPECT_EQ(".,..,b,c", list("a"));
+  EXPECT_EQ(".,..,d", list("a/c"));
+  EXPECT_EQ(".,..,e", list("a/c/d"));
+
+  EXPECT_EQ(-ENOTDIR, manifest::read_directory("a/b", boost::bind(&add_name, &names, _1, _2)));
+  EXPECT_EQ(-ENOENT, manifest::read_directory("missing", boost::bind(&add_name, &names, _1, _2)));
+  EXPECT_TRUE(names.empty());
+}
+
+TEST(manifest, directory_wins_over_file)
+{
+  temp_file f;
+  struct stat s;
+
+  {
+    manifest::builder b(f.get(), BUCKET);
+
+    // a key "x" alongside keys under "x/", out of order so that "x" is
+    // implied twice
+    b.add("x/1", make_stat(S_IFREG, 1, 1), "\"1\"");
+    b.add("x", make_stat(S_IFREG, 2, 2), "\"2\"");
+    b.add("x/2", make_stat(S_IFREG, 3, 3), "\"3\"");
+
+    EXPECT_EQ(static_cast<size_t>(3), b.commit());
+  }
+
+  ASSERT_TRUE(manifest::map(f.get(), BUCKET));
+  ASSERT_TRUE(manifest::get_stat("x", &s));
+  EXPECT_TRUE(S_ISDIR(s.st_mode));
+  EXPECT_EQ(".,..,1,2", list("x"));
+}
+
+TEST(manifest, empty)
+{
+  temp_file f;
+
+  {
+    manifest::builder b(f.get(), BUCKET);
+
+    EXPECT_EQ(static_cast<size_t>(0), b.commit());
+  }
+
+  ASSERT_TRUE(manifest::map(f.get(), BUCKET));
+  EXPECT_EQ(".,..", list(""));
+  EXPECT_FALSE(manifest::contains("a"));
+}
+
+TEST(manifest, rejects_other_bucket)
+{
+  temp_file f;
+
+  write_sample(f.get());
+
+  EXPECT_FALSE(manifest::map(f.get(), "https://other.example.com"));
+  EXPECT_FALSE(manifest::is_enabled());
+}
+
+TEST(manifest, rejects_bad_record)
+{
+  temp_file f;
+  uint64_t records_offset = 0, bad_offset = UINT64_MAX / 2;
+  int fd;
+
+  write_sample(f.get());
+
+  fd = open(f.get().c_str(), O_RDWR);
+  ASSERT_NE(-1, fd);
+
+  // point the first record's path past the end of the string table
+  ASSERT_EQ(static_cast<ssize_t>(sizeof(records_offset)), pread(fd, &records_offset, sizeof(records_offset), RECORDS_OFFSET_FIELD));
+  ASSERT_EQ(static_cast<ssize_t>(sizeof(bad_offset)), pwrite(fd, &bad_offset, sizeof(bad_offset), records_offset));
+  close(fd);
+
+  EXPECT_FALSE(manifest::map(f.get(), BUCKET));
+  EXPECT_FALSE(manifest::is_enabled());
+}
+
+TEST(manifest, rejects_truncated_file)
+{
+  temp_file f;
+  struct stat s;
+
+  write_sample(f.get());
+
+  ASSERT_EQ(0, stat(f.get().c_str(), &s));
+  ASSERT_EQ(0, truncate(f.get().c_str(), s.st_size - 1));
+
+  EXPECT_FALSE(manifest::map(f.get(), BUCKET));
+  EXPECT_FALSE(manifest::is_enabled());
+}
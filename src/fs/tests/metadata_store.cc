@@ -0,0 +1,320 @@
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include <map>
+#include <string>
+#include <boost/lexical_cast.hpp>
+#include <boost/thread.hpp>
+#include <gtest/gtest.h>
+
+#include "fs/metadata_store.h"
+#include "services/impl.h"
+#include "services/service.h"
+
+using boost::lexical_cast;
+using boost::shared_ptr;
+using boost::thread;
+using std::map;
+using std::string;
+
+using s3::fs::metadata_store;
+using s3::services::file_transfer;
+using s3::services::impl;
+using s3::services::service;
+
+namespace
+{
+  const off_t LARGE_STORE = 64 * 1024 * 1024;
+  const int PATHS = 64;
+
+  bool s_is_init = false;
+
+  // the store only needs the bucket url and the header prefix
+  class test_service : public impl
+  {
+  public:
+    inline test_service()
+      : _prefix("x-amz-"),
+        _meta_prefix("x-amz-meta-"),
+        _bucket_url("/test-bucket")
+    {
+    }
+
+    virtual const string & get_header_prefix() { return _prefix; }
+    virtual const string & get_header_meta_prefix() { return _meta_prefix; }
+    virtual const string & get_bucket_url() { return _bucket_url; }
+    virtual bool is_next_marker_supported() { return true; }
+    virtual string adjust_url(const string &url) { return url; }
+    virtual void pre_run(s3::base::request *, int) { }
+    virtual shared_ptr<file_transfer> build_file_transfer() { return shared_ptr<file_transfer>(); }
+
+  private:
+    string _prefix, _meta_prefix, _bucket_url;
+  };
+
+  void init()
+  {
+    if (s_is_init)
+      return;
+
+    service::init(impl::ptr(new test_service()));
+    s_is_init = true;
+  }
+
+  class temp_store
+  {
+  public:
+    inline temp_store()
+    {
+      char name[] = "/tmp/s3fuse-metadata-store-test-XXXXXX";
+      int fd = mkstemp(name);
+
+      if (fd != -1)
+        close(fd);
+
+      _name = name;
+
+      init();
+    }
+
+    inline ~temp_store()
+    {
+      metadata_store::close_store();
+
+      unlink(_name.c_str());
+      unlink((_name + ".compact").c_str());
+    }
+
+    inline const string & get() const { return _name; }
+
+    // as after a remount
+    inline bool reopen(off_t max_size = LARGE_STORE)
+    {
+      metadata_store::close_store();
+
+      return metadata_store::open_store(_name, max_size);
+    }
+
+  private:
+    string _name;
+  };
+
+  metadata_store::entry make_entry(const string &path, int version)
+  {
+    metadata_store::entry e;
+
+    e.url = "/test-bucket/" + path;
+    e.last_modified = 1000 + version;
+    e.saved_at = time(NULL);
+    e.headers["ETag"] = "\"" + lexical_cast<string>(version) + "\"";
+    e.headers["Content-Length"] = lexical_cast<string>(version * 10);
+    e.headers["x-amz-meta-s3fuse-mode"] = "0644";
+
+    // not one we look at, so not saved
+    e.headers["Server"] = "AmazonS3";
+
+    return e;
+  }
+
+  string path_for(int i)
+  {
+    return "dir/file-" + lexical_cast<string>(i);
+  }
+
+  void compact_repeatedly(int count)
+  {
+    for (int i = 0; i < count; i++)
+      metadata_store::compact();
+  }
+
+  // puts and erases that follow a simple pattern, so that the expected
+  // state after any number of steps is easy to work out.  the last
+  // operation on each path decides whether it's there, and with which
+  // version.
+  void churn(int steps, map<string, int> *expected)
+  {
+    for (int i = 0; i < steps; i++) {
+      string path = path_for((i * 7) % PATHS);
+
+      if (i % 5 == 4) {
+        metadata_store::erase(path);
+        expected->erase(path);
+      } else {
+        metadata_store::entry e;
+
+        metadata_store::put(path, make_entry(path, i));
+        (*expected)[path] = i;
+
+        // a record read back while a compaction swaps files must still be
+        // the one we just put
+        ASSERT_TRUE(metadata_store::find(path, &e)) << path;
+        EXPECT_EQ(1000 + i, e.last_modified) << path;
+      }
+    }
+  }
+
+  void check_store(const map<string, int> &expected)
+  {
+    for (int i = 0; i < PATHS; i++) {
+      string path = path_for(i);
+      map<string, int>::const_iterator itor = expected.find(path);
+      metadata_store::entry e;
+
+      if (itor == expected.end()) {
+        EXPECT_FALSE(metadata_store::find(path, &e)) << path;
+        continue;
+      }
+
+      ASSERT_TRUE(metadata_store::find(path, &e)) << path;
+      EXPECT_EQ("/test-bucket/" + path, e.url);
+      EXPECT_EQ(1000 + itor->second, e.last_modified) << path;
+      EXPECT_EQ("\"" + lexical_cast<string>(itor->second) + "\"", e.headers["ETag"]) << path;
+    }
+  }
+}
+
+TEST(metadata_store, round_trip)
+{
+  temp_store s;
+  metadata_store::entry in = make_entry("a", 1), out;
+
+  ASSERT_TRUE(metadata_store::open_store(s.get(), LARGE_STORE));
+  ASSERT_TRUE(metadata_store::is_enabled());
+
+  metadata_store::put("a", in);
+  ASSERT_TRUE(s.reopen());
+
+  ASSERT_TRUE(metadata_store::find("a", &out));
+  EXPECT_EQ(in.url, out.url);
+  EXPECT_EQ(in.last_modified, out.last_modified);
+  EXPECT_EQ(in.saved_at, out.saved_at);
+  EXPECT_EQ(string("\"1\""), out.headers["ETag"]);
+  EXPECT_EQ(string("10"), out.headers["Content-Length"]);
+  EXPECT_EQ(string("0644"), out.headers["x-amz-meta-s3fuse-mode"]);
+  EXPECT_TRUE(out.headers.find("Server") == out.headers.end());
+
+  EXPECT_FALSE(metadata_store::find("b", &out));
+}
+
+TEST(metadata_store, erase_survives_reopen)
+{
+  temp_store s;
+  metadata_store::entry e;
+
+  ASSERT_TRUE(metadata_store::open_store(s.get(), LARGE_STORE));
+
+  metadata_store::put("a", make_entry("a", 1));
+  metadata_store::put("b", make_entry("b", 2));
+  metadata_store::erase("a");
+
+  ASSERT_TRUE(s.reopen());
+
+  EXPECT_FALSE(metadata_store::find("a", &e));
+  EXPECT_TRUE(metadata_store::find("b", &e));
+}
+
+TEST(metadata_store, truncated_record_is_dropped)
+{
+  temp_store s;
+  metadata_store::entry e;
+  struct stat st;
+
+  ASSERT_TRUE(metadata_store::open_store(s.get(), LARGE_STORE));
+
+  metadata_store::put("a", make_entry("a", 1));
+  metadata_store::put("b", make_entry("b", 2));
+  metadata_store::close_store();
+
+  // as if the last write were cut short
+  ASSERT_EQ(0, stat(s.get().c_str(), &st));
+  ASSERT_EQ(0, truncate(s.get().c_str(), st.st_size - 1));
+
+  ASSERT_TRUE(metadata_store::open_store(s.get(), LARGE_STORE));
+
+  EXPECT_TRUE(metadata_store::find("a", &e));
+  EXPECT_FALSE(metadata_store::find("b", &e));
+}
+
+TEST(metadata_store, compaction_keeps_live_records)
+{
+  temp_store s;
+  map<string, int> expected;
+  struct stat before, after;
+
+  ASSERT_TRUE(metadata_store::open_store(s.get(), LARGE_STORE));
+
+  churn(1000, &expected);
+  ASSERT_EQ(0, stat(s.get().c_str(), &before));
+
+  metadata_store::compact();
+
+  ASSERT_EQ(0, stat(s.get().c_str(), &after));
+  EXPECT_LT(after.st_size, before.st_size);
+
+  check_store(expected);
+
+  ASSERT_TRUE(s.reopen());
+  check_store(expected);
+}
+
+// puts and erases that land while a compaction is copying records must be
+// carried over to the new file, and the index must still match the file
+// once it's reloaded
+TEST(metadata_store, compaction_during_puts_and_erases)
+{
+  temp_store s;
+  map<string, int> expected;
+
+  ASSERT_TRUE(metadata_store::open_store(s.get(), LARGE_STORE));
+
+  churn(PATHS, &expected);
+
+  {
+    thread compactor(compact_repeatedly, 50);
+
+    churn(20000, &expected);
+    compactor.join();
+  }
+
+  check_store(expected);
+
+  ASSERT_TRUE(s.reopen());
+  check_store(expected);
+
+  // and once more with nothing going on
+  metadata_store::compact();
+
+  ASSERT_TRUE(s.reopen());
+  check_store(expected);
+}
+
+TEST(metadata_store, compaction_evicts_least_recently_used)
+{
+  temp_store s;
+  metadata_store::entry e;
+  struct stat st;
+  const off_t max_size = 4096;
+
+  ASSERT_TRUE(metadata_store::open_store(s.get(), max_size));
+
+  for (int i = 0; i < PATHS; i++)
+    metadata_store::put(path_for(i), make_entry(path_for(i), i));
+
+  // a lookup counts as a use
+  ASSERT_TRUE(metadata_store::find(path_for(0), &e));
+
+  metadata_store::compact();
+
+  ASSERT_EQ(0, stat(s.get().c_str(), &st));
+  EXPECT_LE(st.st_size, max_size);
+
+  EXPECT_TRUE(metadata_store::find(path_for(0), &e));
+  EXPECT_TRUE(metadata_store::find(path_for(PATHS - 1), &e));
+  EXPECT_FALSE(metadata_store::find(path_for(1), &e));
+
+  ASSERT_TRUE(s.reopen(max_size));
+  EXPECT_TRUE(metadata_store::find(path_for(0), &e));
+  EXPECT_FALSE(metadata_store::find(path_for(1), &e));
+}
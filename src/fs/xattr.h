@@ -63,6 +63,9 @@ namespace s3
 
       virtual void to_header(std::string *header, std::string *value) = 0;
 
+      // estimate of the memory held by this attribute
+      virtual size_t get_resident_size() const { return sizeof(*this) + _key.size(); }
+
     protected:
       inline xattr(const std::string &key, int mode)
         : _key(key),
@@ -27,12 +27,19 @@
 #include "base/statistics.h"
 #include "base/xml.h"
 #include "crypto/buffer.h"
+#include "fs/block_cache.h"
 #include "fs/cache.h"
+#include "fs/change_poller.h"
 #include "fs/encryption.h"
 #include "fs/file.h"
 #include "fs/list_reader.h"
+#include "fs/manifest.h"
+#include "fs/memory_block_cache.h"
+#include "fs/metadata_store.h"
 #include "fs/mime_types.h"
+#include "fs/namespace_index.h"
 #include "fs/object.h"
+#include "fs/subtree_prefetcher.h"
 #include "services/service.h"
 #include "threads/pool.h"
 
@@ -58,12 +65,19 @@ using s3::base::request;
 using s3::base::statistics;
 using s3::base::xml;
 using s3::crypto::buffer;
+using s3::fs::block_cache;
 using s3::fs::cache;
+using s3::fs::change_poller;
 using s3::fs::encryption;
 using s3::fs::file;
 using s3::fs::list_reader;
+using s3::fs::manifest;
+using s3::fs::memory_block_cache;
+using s3::fs::metadata_store;
 using s3::fs::mime_types;
+using s3::fs::namespace_index;
 using s3::fs::object;
+using s3::fs::subtree_prefetcher;
 using s3::services::impl;
 using s3::services::service;
 using s3::threads::pool;
@@ -136,10 +150,19 @@ void init::fs()
   file::test_transfer_chunk_sizes();
 
   cache::init();
+  block_cache::init();
+  memory_block_cache::init();
+  metadata_store::init();
+  namespace_index::init();
+  subtree_prefetcher::init();
   encryption::init();
   mime_types::init();
 
   test_bucket_access();
+
+  // after the access test, since this may list the whole bucket
+  manifest::init();
+  change_poller::init();
 }
 
 void init::services()
@@ -176,6 +199,9 @@ void init::services()
 void init::threads()
 {
   pool::init();
+  cache::start_sweeper();
+  change_poller::start();
+  metadata_store::start_compactor();
 }
 
 string init::get_enabled_services()
@@ -27,6 +27,9 @@
 #include "base/config.h"
 #include "base/logger.h"
 #include "base/statistics.h"
+#include "fs/cache.h"
+#include "fs/change_poller.h"
+#include "fs/metadata_store.h"
 #include "threads/pool.h"
 
 using std::cerr;
@@ -38,6 +41,9 @@ using s3::init;
 using s3::operations;
 using s3::base::config;
 using s3::base::statistics;
+using s3::fs::cache;
+using s3::fs::change_poller;
+using s3::fs::metadata_store;
 using s3::threads::pool;
 
 namespace
@@ -254,6 +260,10 @@ int main(int argc, char **argv)
   fuse_opt_free_args(&args);
 
   try {
+    // before the pool, since these post work to it
+    change_poller::stop();
+    cache::stop_sweeper();
+    metadata_store::stop_compactor();
     pool::terminate();
 
     // these won't do anything if statistics::init() wasn't called
@@ -31,6 +31,8 @@
 #include "fs/directory.h"
 #include "fs/encrypted_file.h"
 #include "fs/file.h"
+#include "fs/manifest.h"
+#include "fs/namespace_index.h"
 #include "fs/special.h"
 #include "fs/symlink.h"
 
@@ -50,6 +52,8 @@ using s3::fs::cache;
 using s3::fs::directory;
 using s3::fs::encrypted_file;
 using s3::fs::file;
+using s3::fs::manifest;
+using s3::fs::namespace_index;
 using s3::fs::object;
 using s3::fs::special;
 using s3::fs::symlink;
@@ -61,9 +65,9 @@ namespace
   atomic_count s_create(0), s_mkdir(0), s_mknod(0), s_open(0), s_rename(0), s_symlink(0), s_truncate(0), s_unlink(0);
   atomic_count s_getattr(0), s_readdir(0), s_readlink(0);
 
-  void dir_filler(fuse_fill_dir_t filler, void *buf, const std::string &path)
+  void dir_filler(fuse_fill_dir_t filler, void *buf, const std::string &path, const struct stat *s)
   {
-    filler(buf, path.c_str(), NULL, 0);
+    filler(buf, path.c_str(), s, 0);
   }
 
   inline string get_parent(const string &path)
@@ -73,10 +77,43 @@ namespace
     return (last_slash == string::npos) ? "" : path.substr(0, last_slash);
   }
 
-  inline void invalidate(const string &path)
+  inline string get_name(const string &path)
   {
-    if (!path.empty())
-      cache::remove(path);
+    size_t last_slash = path.rfind('/');
+
+    return (last_slash == string::npos) ? path : path.substr(last_slash + 1);
+  }
+
+  // patch the parent directory's cached listing (if we have one) instead of
+  // dropping the parent from the cache and listing it again
+  void add_to_parent(const string &path)
+  {
+    object::ptr parent = cache::peek(get_parent(path));
+
+    if (parent && parent->get_type() == S_IFDIR)
+      static_pointer_cast<directory>(parent)->add_cached_entry(get_name(path));
+
+    namespace_index::add(path);
+  }
+
+  void remove_from_parent(const string &path)
+  {
+    object::ptr parent = cache::peek(get_parent(path));
+
+    if (parent && parent->get_type() == S_IFDIR)
+      static_pointer_cast<directory>(parent)->remove_cached_entry(get_name(path));
+
+    namespace_index::remove(path);
+  }
+
+  // cache what we've just written, rather than letting the next lookup
+  // fetch it
+  void write_through(const object::ptr &obj)
+  {
+    obj->mark_written();
+    cache::insert(obj);
+
+    add_to_parent(obj->get_path());
   }
 
   int touch(const string &path)
@@ -158,6 +195,13 @@ namespace
       return -EPERM; \
   } while (0)
 
+// a manifest is a snapshot, so nothing may change while it's in use
+#define CHECK_WRITABLE() \
+  do { \
+    if (manifest::is_enabled()) \
+      return -EROFS; \
+  } while (0)
+
 #define BEGIN_TRY \
   try {
 
@@ -252,6 +296,7 @@ int operations::chmod(const char *path, mode_t mode)
   S3_LOG(LOG_DEBUG, "chmod", "path: %s, mode: %i\n", path, mode);
 
   ASSERT_VALID_PATH(path);
+  CHECK_WRITABLE();
 
   BEGIN_TRY;
     GET_OBJECT(obj, path);
@@ -268,6 +313,7 @@ int operations::chown(const char *path, uid_t uid, gid_t gid)
   S3_LOG(LOG_DEBUG, "chown", "path: %s, user: %i, group: %i\n", path, uid, gid);
 
   ASSERT_VALID_PATH(path);
+  CHECK_WRITABLE();
 
   BEGIN_TRY;
     GET_OBJECT(obj, path);
@@ -292,6 +338,7 @@ int operations::create(const char *path, mode_t mode, fuse_file_info *file_info)
   ++s_create;
 
   ASSERT_VALID_PATH(path);
+  CHECK_WRITABLE();
 
   BEGIN_TRY;
     file::ptr f;
@@ -304,8 +351,6 @@ int operations::create(const char *path, mode_t mode, fuse_file_info *file_info)
       return -EEXIST;
     }
 
-    invalidate(parent);
-
     if (config::get_use_encryption() && config::get_encrypt_new_files())
       f.reset(new encrypted_file(path));
     else
@@ -316,6 +361,9 @@ int operations::create(const char *path, mode_t mode, fuse_file_info *file_info)
     f->set_gid(ctx->gid);
 
     RETURN_ON_ERROR(f->commit());
+
+    write_through(f);
+
     RETURN_ON_ERROR(touch(parent));
 
     // rarely, the newly created file won't be downloadable right away, so
@@ -391,8 +439,14 @@ int operations::getattr(const char *path, struct stat *s)
     return 0;
   }
 
+  if (manifest::is_enabled())
+    return manifest::get_stat(path, s) ? 0 : -ENOENT;
+
   BEGIN_TRY;
-    GET_OBJECT(obj, path);
+    object::ptr obj = cache::get_for_stat(path);
+
+    if (!obj)
+      return -ENOENT;
 
     obj->copy_stat(s);
 
@@ -455,6 +509,7 @@ int operations::mkdir(const char *path, mode_t mode)
   ++s_mkdir;
 
   ASSERT_VALID_PATH(path);
+  CHECK_WRITABLE();
 
   BEGIN_TRY;
     directory::ptr dir;
@@ -465,8 +520,6 @@ int operations::mkdir(const char *path, mode_t mode)
       return -EEXIST;
     }
 
-    invalidate(parent);
-
     dir.reset(new directory(path));
 
     dir->set_mode(mode);
@@ -475,6 +528,12 @@ int operations::mkdir(const char *path, mode_t mode)
 
     RETURN_ON_ERROR(dir->commit());
 
+    write_through(dir);
+
+    // we've just created it, so we know what's in it
+    dir->set_empty_listing();
+    namespace_index::set_listing(path, vector<string>());
+
     return touch(parent);
   END_TRY;
 }
@@ -487,6 +546,7 @@ int operations::mknod(const char *path, mode_t mode, dev_t dev)
   ++s_mknod;
 
   ASSERT_VALID_PATH(path);
+  CHECK_WRITABLE();
 
   BEGIN_TRY;
     special::ptr obj;
@@ -497,8 +557,6 @@ int operations::mknod(const char *path, mode_t mode, dev_t dev)
       return -EEXIST;
     }
 
-    invalidate(parent);
-
     obj.reset(new special(path));
 
     obj->set_type(mode);
@@ -510,6 +568,8 @@ int operations::mknod(const char *path, mode_t mode, dev_t dev)
 
     RETURN_ON_ERROR(obj->commit());
 
+    write_through(obj);
+
     return touch(parent);
   END_TRY;
 }
@@ -521,6 +581,9 @@ int operations::open(const char *path, fuse_file_info *file_info)
 
   ASSERT_VALID_PATH(path);
 
+  if (file_info->flags & (O_WRONLY | O_RDWR | O_TRUNC))
+    CHECK_WRITABLE();
+
   BEGIN_TRY;
     RETURN_ON_ERROR(file::open(
       static_cast<string>(path), 
@@ -552,9 +615,12 @@ int operations::readdir(const char *path, void *buf, fuse_fill_dir_t filler, off
   ASSERT_VALID_PATH(path);
 
   BEGIN_TRY;
+    if (manifest::is_enabled())
+      return manifest::read_directory(path, bind(&dir_filler, filler, buf, _1, _2));
+
     GET_OBJECT_AS(directory, S_IFDIR, dir, path);
 
-    return dir->read(bind(&dir_filler, filler, buf, _1));
+    return dir->read(bind(&dir_filler, filler, buf, _1, _2));
   END_TRY;
 }
 
@@ -601,6 +667,7 @@ int operations::removexattr(const char *path, const char *name)
   S3_LOG(LOG_DEBUG, "removexattr", "path: %s, name: %s\n", path, name);
 
   ASSERT_VALID_PATH(path);
+  CHECK_WRITABLE();
 
   BEGIN_TRY;
     GET_OBJECT(obj, path);
@@ -618,6 +685,7 @@ int operations::rename(const char *from, const char *to)
 
   ASSERT_VALID_PATH(from);
   ASSERT_VALID_PATH(to);
+  CHECK_WRITABLE();
 
   BEGIN_TRY;
     GET_OBJECT(from_obj, from);
@@ -626,9 +694,6 @@ int operations::rename(const char *from, const char *to)
     // doesn't exist
     object::ptr to_obj = cache::get(to);
 
-    invalidate(get_parent(from));
-    invalidate(get_parent(to));
-
     if (to_obj) {
       if (to_obj->get_type() == S_IFDIR) {
         if (from_obj->get_type() != S_IFDIR)
@@ -646,6 +711,12 @@ int operations::rename(const char *from, const char *to)
 
     RETURN_ON_ERROR(from_obj->rename(to));
 
+    remove_from_parent(from);
+    add_to_parent(to);
+
+    // the lookup above may have recorded "to" as nonexistent
+    cache::clear_negative(to);
+
     for (int i = 0; i < config::get_max_inconsistent_state_retries(); i++) {
       to_obj = cache::get(to);
 
@@ -680,6 +751,7 @@ int operations::setxattr(const char *path, const char *name, const char *value,
   S3_LOG(LOG_DEBUG, "setxattr", "path: [%s], name: [%s], size: %i\n", path, name, size);
 
   ASSERT_VALID_PATH(path);
+  CHECK_WRITABLE();
 
   BEGIN_TRY;
     bool needs_commit = false;
@@ -707,6 +779,9 @@ int operations::statfs(const char * /* ignored */, struct statvfs *s)
   s->f_files = numeric_limits<size_t>::max();
   s->f_ffree = numeric_limits<size_t>::max();
 
+  if (manifest::is_enabled())
+    s->f_flag |= ST_RDONLY;
+
   return 0;
 }
 
@@ -718,6 +793,7 @@ int operations::symlink(const char *target, const char *path)
   ++s_symlink;
 
   ASSERT_VALID_PATH(path);
+  CHECK_WRITABLE();
 
   BEGIN_TRY;
     symlink::ptr link;
@@ -728,8 +804,6 @@ int operations::symlink(const char *target, const char *path)
       return -EEXIST;
     }
 
-    invalidate(parent);
-
     link.reset(new s3::fs::symlink(path));
 
     link->set_uid(ctx->uid);
@@ -739,6 +813,8 @@ int operations::symlink(const char *target, const char *path)
 
     RETURN_ON_ERROR(link->commit());
 
+    write_through(link);
+
     return touch(parent);
   END_TRY;
 }
@@ -752,6 +828,7 @@ int operations::truncate(const char *path, off_t size)
   ++s_truncate;
 
   ASSERT_VALID_PATH(path);
+  CHECK_WRITABLE();
 
   BEGIN_TRY;
     int r;
@@ -787,16 +864,17 @@ int operations::unlink(const char *path)
   ++s_unlink;
 
   ASSERT_VALID_PATH(path);
+  CHECK_WRITABLE();
 
   BEGIN_TRY;
     string parent = get_parent(path);
 
     GET_OBJECT(obj, path);
 
-    invalidate(parent);
-
     RETURN_ON_ERROR(obj->remove());
 
+    remove_from_parent(path);
+
     return touch(parent);
   END_TRY;
 }
@@ -806,6 +884,7 @@ int operations::utimens(const char *path, const timespec times[2])
   S3_LOG(LOG_DEBUG, "utimens", "path: %s, time: %li\n", path, times[1].tv_sec);
 
   ASSERT_VALID_PATH(path);
+  CHECK_WRITABLE();
 
   BEGIN_TRY;
     GET_OBJECT(obj, path);
@@ -58,7 +58,7 @@ using s3::threads::pool;
 
 namespace
 {
-  struct download_range
+  struct part_range
   {
     size_t size;
     off_t offset;
@@ -66,6 +66,7 @@ namespace
 
   atomic_count s_downloads_single(0), s_downloads_single_failed(0);
   atomic_count s_downloads_multi(0), s_downloads_multi_failed(0), s_downloads_multi_chunks_failed(0);
+  atomic_count s_downloads_range(0), s_downloads_range_failed(0);
   atomic_count s_uploads_single(0), s_uploads_single_failed(0);
   atomic_count s_uploads_multi(0), s_uploads_multi_failed(0);
 
@@ -79,6 +80,9 @@ namespace
       "  succeeded: " << s_downloads_multi << "\n"
       "  failed: " << s_downloads_multi_failed << "\n"
       "  chunks failed: " << s_downloads_multi_chunks_failed << "\n"
+      "common range downloads:\n"
+      "  succeeded: " << s_downloads_range << "\n"
+      "  failed: " << s_downloads_range_failed << "\n"
       "common single-part uploads:\n"
       "  succeeded: " << s_uploads_single << "\n"
       "  failed: " << s_uploads_single_failed << "\n"
@@ -89,7 +93,7 @@ namespace
 
   statistics::writers::entry s_writer(statistics_writer, 0);
 
-  int download_part(const request::ptr &req, const string &url, download_range *range, const file_transfer::write_chunk_fn &on_write, bool is_retry)
+  int download_part(const request::ptr &req, const string &url, part_range *range, const file_transfer::write_chunk_fn &on_write, bool is_retry)
   {
     // yes, relying on is_retry will result in the chunks failed count being off by one, maybe, but we don't care
     if (is_retry)
@@ -113,6 +117,13 @@ namespace
     return on_write(&req->get_output_buffer()[0], range->size, range->offset);
   }
 
+  template <class queue_type>
+  void prioritize_part(queue_type *queue, off_t first_offset, size_t chunk_size, off_t offset)
+  {
+    if (offset >= first_offset)
+      queue->prioritize((offset - first_offset) / chunk_size);
+  }
+
   int increment_on_result(int r, atomic_count *success, atomic_count *failure)
   {
     if (r)
@@ -138,11 +149,11 @@ size_t file_transfer::get_upload_chunk_size()
   return 0; // this file_transfer impl doesn't do chunks
 }
 
-int file_transfer::download(const string &url, size_t size, const write_chunk_fn &on_write)
+int file_transfer::download(const string &url, size_t size, const write_chunk_fn &on_write, const download_priority::ptr &priority)
 {
   if (get_download_chunk_size() > 0 && size > get_download_chunk_size())
     return increment_on_result(
-      download_multi(url, size, on_write), 
+      download_multi(url, size, on_write, priority), 
       &s_downloads_multi,
       &s_downloads_multi_failed);
   else
@@ -184,19 +195,34 @@ int file_transfer::download_single(const request::ptr &req, const string &url, s
   return on_write(&req->get_output_buffer()[0], req->get_output_buffer().size(), 0);
 }
 
-int file_transfer::download_multi(const string &url, size_t size, const file_transfer::write_chunk_fn &on_write)
+int file_transfer::download_range(const string &url, off_t offset, size_t size, const write_chunk_fn &on_write)
+{
+  return increment_on_result(
+    download_parts(url, offset, size, on_write, download_priority::ptr()),
+    &s_downloads_range,
+    &s_downloads_range_failed);
+}
+
+int file_transfer::download_multi(const string &url, size_t size, const file_transfer::write_chunk_fn &on_write, const download_priority::ptr &priority)
 {
-  typedef parallel_work_queue<download_range> multipart_download;
+  return download_parts(url, 0, size, on_write, priority);
+}
+
+int file_transfer::download_parts(const string &url, off_t offset, size_t size, const write_chunk_fn &on_write, const download_priority::ptr &priority)
+{
+  typedef parallel_work_queue<part_range> multipart_download;
 
   scoped_ptr<multipart_download> dl;
-  size_t num_parts = (size + get_download_chunk_size() - 1) / get_download_chunk_size();
-  vector<download_range> parts(num_parts);
+  int r;
+  size_t chunk_size = get_download_chunk_size() ? get_download_chunk_size() : size;
+  size_t num_parts = (size + chunk_size - 1) / chunk_size;
+  vector<part_range> parts(num_parts);
 
   for (size_t i = 0; i < num_parts; i++) {
-    download_range *range = &parts[i];
+    part_range *range = &parts[i];
 
-    range->offset = i * get_download_chunk_size();
-    range->size = (i != num_parts - 1) ? get_download_chunk_size() : (size - get_download_chunk_size() * i);
+    range->offset = offset + i * chunk_size;
+    range->size = (i != num_parts - 1) ? chunk_size : (size - chunk_size * i);
   }
 
   dl.reset(new multipart_download(
@@ -205,7 +231,22 @@ int file_transfer::download_multi(const string &url, size_t size, const file_tra
     bind(&download_part, _1, url, _2, on_write, false),
     bind(&download_part, _1, url, _2, on_write, true)));
 
-  return dl->process();
+  if (!priority)
+    return dl->process();
+
+  priority->attach(bind(&prioritize_part<multipart_download>, dl.get(), offset, chunk_size, _1));
+
+  try {
+    r = dl->process();
+
+  } catch (...) {
+    priority->detach();
+    throw;
+  }
+
+  priority->detach();
+
+  return r;
 }
 
 int file_transfer::upload_single(const request::ptr &req, const string &url, size_t size, const read_chunk_fn &on_read, string *returned_etag)
@@ -25,6 +25,7 @@
 #include <string>
 #include <boost/function.hpp>
 #include <boost/smart_ptr.hpp>
+#include <boost/thread.hpp>
 
 #include "base/request.h"
 
@@ -32,6 +33,40 @@ namespace s3
 {
   namespace services
   {
+    // lets whoever is waiting on a download ask for the chunk holding a
+    // particular offset to be fetched next
+    class download_priority
+    {
+    public:
+      typedef boost::shared_ptr<download_priority> ptr;
+      typedef boost::function1<void, off_t> prioritize_fn;
+
+      inline void prioritize(off_t offset)
+      {
+        boost::mutex::scoped_lock lock(_mutex);
+
+        if (_fn)
+          _fn(offset);
+      }
+
+      // for file_transfer, while a multi-part download is running
+      inline void attach(const prioritize_fn &fn)
+      {
+        boost::mutex::scoped_lock lock(_mutex);
+
+        _fn = fn;
+      }
+
+      inline void detach()
+      {
+        attach(prioritize_fn());
+      }
+
+    private:
+      boost::mutex _mutex;
+      prioritize_fn _fn;
+    };
+
     class file_transfer
     {
     public:
@@ -43,9 +78,19 @@ namespace s3
       virtual size_t get_download_chunk_size();
       virtual size_t get_upload_chunk_size();
 
-      int download(const std::string &url, size_t size, const write_chunk_fn &on_write);
+      // "priority", if set, can be used to reorder the chunks of a multi-part
+      // download while it runs
+      int download(
+        const std::string &url,
+        size_t size,
+        const write_chunk_fn &on_write,
+        const download_priority::ptr &priority = download_priority::ptr());
       int upload(const std::string &url, size_t size, const read_chunk_fn &on_read, std::string *returned_etag);
 
+      // fetches "size" bytes starting at "offset", in parallel chunks of
+      // get_download_chunk_size() bytes
+      int download_range(const std::string &url, off_t offset, size_t size, const write_chunk_fn &on_write);
+
     protected:
       virtual int download_single(
         const base::request::ptr &req, 
@@ -56,7 +101,8 @@ namespace s3
       virtual int download_multi(
         const std::string &url,
         size_t size,
-        const write_chunk_fn &on_write);
+        const write_chunk_fn &on_write,
+        const download_priority::ptr &priority);
 
       virtual int upload_single(
         const base::request::ptr &req, 
@@ -70,6 +116,14 @@ namespace s3
         size_t size,
         const read_chunk_fn &on_read,
         std::string *returned_etag);
+
+    private:
+      int download_parts(
+        const std::string &url,
+        off_t offset,
+        size_t size,
+        const write_chunk_fn &on_write,
+        const download_priority::ptr &priority);
     };
   }
 }
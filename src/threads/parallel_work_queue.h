@@ -22,8 +22,11 @@
 #ifndef S3_THREADS_PARALLEL_WORK_QUEUE_H
 #define S3_THREADS_PARALLEL_WORK_QUEUE_H
 
+#include <algorithm>
 #include <iostream>
+#include <list>
 #include <vector>
+#include <boost/thread.hpp>
 
 #include "base/config.h"
 #include "base/logger.h"
@@ -53,7 +56,8 @@ namespace s3
         const retry_part_fn &on_retry_part,
         int max_retries = -1,
         int max_parts_in_progress = -1)
-        : _on_process_part(on_process_part),
+        : _next(0),
+          _on_process_part(on_process_part),
           _on_retry_part(on_retry_part)
       {
         size_t id = 0;
@@ -65,20 +69,36 @@ namespace s3
           p.id = id++;
 
           _parts.push_back(p);
+          _order.push_back(p.id);
         }
 
         _max_retries = (max_retries == -1) ? base::config::get_max_transfer_retries() : max_retries;
         _max_parts_in_progress = (max_parts_in_progress == -1) ? base::config::get_max_parts_in_progress() : max_parts_in_progress;
       }
 
+      // has part "id" (counting from zero, in the order given to the
+      // constructor) start next, if it hasn't started already.  may be
+      // called from any thread while process() runs.
+      inline void prioritize(size_t id)
+      {
+        boost::mutex::scoped_lock lock(_mutex);
+        std::vector<size_t>::iterator itor = std::find(_order.begin() + _next, _order.end(), id);
+
+        if (itor == _order.end())
+          return;
+
+        // the parts that were ahead of it keep their order
+        std::rotate(_order.begin() + _next, itor, itor + 1);
+      }
+
       int process()
       {
-        size_t last_part = 0;
         std::list<process_part *> parts_in_progress;
+        process_part *next_part = NULL;
         int r = 0;
 
-        for (last_part = 0; last_part < std::min(_max_parts_in_progress, _parts.size()); last_part++) {
-          process_part *part = &_parts[last_part];
+        while (parts_in_progress.size() < _max_parts_in_progress && (next_part = get_next_part())) {
+          process_part *part = next_part;
 
           part->handle = threads::pool::post(
             threads::PR_REQ_1, 
@@ -116,8 +136,8 @@ namespace s3
           // keep collecting parts until we have nothing left pending
           // if one part fails, keep going but stop posting new parts
 
-          if (r == 0 && last_part < _parts.size()) {
-            part = &_parts[last_part++];
+          if (r == 0 && (next_part = get_next_part())) {
+            part = next_part;
 
             part->handle = threads::pool::post(
               threads::PR_REQ_1, 
@@ -148,8 +168,20 @@ namespace s3
         }
       };
 
+      inline process_part * get_next_part()
+      {
+        boost::mutex::scoped_lock lock(_mutex);
+
+        return (_next < _order.size()) ? &_parts[_order[_next++]] : NULL;
+      }
+
       std::vector<process_part> _parts;
 
+      // the order in which to start parts, and how many have started
+      boost::mutex _mutex;
+      std::vector<size_t> _order;
+      size_t _next;
+
       process_part_fn _on_process_part;
       retry_part_fn _on_retry_part;
 
@@ -46,8 +46,9 @@ namespace
   BOOST_STATIC_ASSERT(s3::threads::PR_0 == 0);
   BOOST_STATIC_ASSERT(s3::threads::PR_REQ_0 == 1);
   BOOST_STATIC_ASSERT(s3::threads::PR_REQ_1 == 2);
+  BOOST_STATIC_ASSERT(s3::threads::PR_REQ_2 == 3);
 
-  const int POOL_COUNT = 3; // PR_0, PR_REQ_0, PR_REQ_1
+  const int POOL_COUNT = 4; // PR_0, PR_REQ_0, PR_REQ_1, PR_REQ_2
   const int NUM_THREADS_PER_POOL = 8;
 
   void sleep_one_second()
@@ -156,6 +157,7 @@ void pool::init()
   s_pools[PR_0] = new _pool_impl<worker, false>("PR_0");
   s_pools[PR_REQ_0] = new _pool_impl<request_worker, true>("PR_REQ_0");
   s_pools[PR_REQ_1] = new _pool_impl<request_worker, true>("PR_REQ_1");
+  s_pools[PR_REQ_2] = new _pool_impl<request_worker, true>("PR_REQ_2");
 }
 
 void pool::terminate()
@@ -33,7 +33,11 @@ namespace s3
     {
       PR_0 = 0,
       PR_REQ_0 = 1,
-      PR_REQ_1 = 2
+      PR_REQ_1 = 2,
+
+      // for requests that don't wait on any pool (e.g., type probes), so
+      // that a worker elsewhere can block on them safely
+      PR_REQ_2 = 3
     };
 
     class pool